@@ -6,6 +6,9 @@ TARGET = common
 INCLUDEPATH += include/ ../3rdparty/minizip/
 
 HEADERS += include/common/quadtree.h \
+    include/common/tileraster.h \
+    include/common/fieldofview.h \
+    include/common/gridline.h \
     include/common/tga.h \
     include/common/global.h \
     include/common/paths.h \
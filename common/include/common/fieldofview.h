@@ -0,0 +1,318 @@
+#ifndef FIELDOFVIEW_H
+#define FIELDOFVIEW_H
+
+#include <QtCore/QtAlgorithms>
+#include <QtCore/QVector>
+
+/**
+  Field of view computations on a grid of tiles, which are either transparent or opaque.
+
+  Both algorithms share the same definition of visibility (symmetric shadowcasting):
+  Looking from the origin in one of the four directions, the tiles are divided into rows. A line
+  from the center of the origin is blocked if it crosses the center line of a row within an opaque
+  tile. Lines passing exactly between two tiles are blocked if both tiles are opaque, or if the line
+  squeezes between opaque tiles on its left and on its right in different rows. A transparent tile is
+  visible if the line to its center isn't blocked, and an opaque tile is visible if lines to some
+  part of its piece of the row's center line aren't blocked. This makes visibility between
+  transparent tiles symmetric, and walls are seen as a whole.
+
+  Opaque is a functor called with (x, y) that returns true for tiles that block vision, Reveal is
+  a functor called with (x, y) for every visible tile.
+  */
+namespace FieldOfView {
+
+    /**
+      A slope (column / depth) of a line from the origin, as a fraction.
+      */
+    struct Slope {
+        Slope(int _numerator, int _denominator) : numerator(_numerator), denominator(_denominator)
+        {
+        }
+
+        int numerator;
+        int denominator; // Always positive
+    };
+
+    inline qint64 floorDiv(qint64 numerator, qint64 denominator)
+    {
+        qint64 result = numerator / denominator;
+        if ((numerator % denominator != 0) && ((numerator < 0) != (denominator < 0)))
+            result--;
+        return result;
+    }
+
+    inline qint64 ceilDiv(qint64 numerator, qint64 denominator)
+    {
+        return -floorDiv(-numerator, denominator);
+    }
+
+    /**
+      Maps a tile given by its row (depth) and column in one of the four quadrants to the map.
+      */
+    inline void transform(int quadrant, int originX, int originY, int depth, int column, int &x, int &y)
+    {
+        switch (quadrant) {
+        case 0: // North
+            x = originX + column;
+            y = originY - depth;
+            break;
+        case 1: // East
+            x = originX + depth;
+            y = originY + column;
+            break;
+        case 2: // South
+            x = originX + column;
+            y = originY + depth;
+            break;
+        default: // West
+            x = originX - depth;
+            y = originY + column;
+            break;
+        }
+    }
+
+    template<typename Opaque, typename Reveal>
+    class ShadowCaster {
+    public:
+        ShadowCaster(int originX, int originY, int radius, const Opaque &opaque, Reveal &reveal)
+            : mOriginX(originX), mOriginY(originY), mRadius(radius), mRadiusSquared(radius * radius),
+            mOpaque(opaque), mReveal(reveal)
+        {
+        }
+
+        void cast()
+        {
+            mReveal(mOriginX, mOriginY);
+
+            for (mQuadrant = 0; mQuadrant < 4; ++mQuadrant)
+                scan(1, Slope(-1, 1), Slope(1, 1));
+        }
+
+    private:
+        bool isOpaque(int depth, int column) const
+        {
+            int x, y;
+            transform(mQuadrant, mOriginX, mOriginY, depth, column, x, y);
+            return mOpaque(x, y);
+        }
+
+        void reveal(int depth, int column)
+        {
+            if (depth * depth + column * column > mRadiusSquared)
+                return;
+
+            int x, y;
+            transform(mQuadrant, mOriginX, mOriginY, depth, column, x, y);
+            mReveal(x, y);
+        }
+
+        /**
+          Scans one row of tiles between two slopes, and the rows behind it that are still visible.
+          Opaque tiles split the slopes into several ranges, which are scanned recursively.
+          */
+        void scan(int depth, Slope start, const Slope &end)
+        {
+            if (depth > mRadius)
+                return;
+
+            // The tiles whose part of the row's center line is between the slopes (rounding ties inwards)
+            int minColumn = (int)floorDiv(2 * depth * start.numerator + start.denominator, 2 * start.denominator);
+            int maxColumn = (int)ceilDiv(2 * depth * end.numerator - end.denominator, 2 * end.denominator);
+
+            bool previousOpaque = false;
+
+            for (int column = minColumn; column <= maxColumn; ++column) {
+                bool opaque = isOpaque(depth, column);
+
+                // Transparent tiles are only visible if their center is between the slopes
+                if (opaque || (column * start.denominator >= depth * start.numerator
+                               && column * end.denominator <= depth * end.numerator))
+                    reveal(depth, column);
+
+                if (column > minColumn) {
+                    if (previousOpaque && !opaque)
+                        start = Slope(2 * column - 1, 2 * depth);
+                    else if (!previousOpaque && opaque)
+                        scan(depth + 1, start, Slope(2 * column - 1, 2 * depth));
+                }
+
+                previousOpaque = opaque;
+            }
+
+            if (minColumn <= maxColumn && !previousOpaque)
+                scan(depth + 1, start, end);
+        }
+
+        int mOriginX;
+        int mOriginY;
+        int mRadius;
+        int mRadiusSquared;
+        const Opaque &mOpaque;
+        Reveal &mReveal;
+        int mQuadrant;
+    };
+
+    /**
+      Reveals all tiles within a radius around the origin that are visible from the origin, using
+      recursive symmetric shadowcasting. Every tile is only checked a constant number of times,
+      so this is O(radius^2). Tiles on the diagonals and axes may be revealed more than once.
+      */
+    template<typename Opaque, typename Reveal>
+    void castShadows(int originX, int originY, int radius, const Opaque &opaque, Reveal &reveal)
+    {
+        ShadowCaster<Opaque, Reveal> caster(originX, originY, radius, opaque, reveal);
+        caster.cast();
+    }
+
+    /**
+      A position on the center line of a row, as a fraction of columns.
+      */
+    struct Position {
+        Position(qint64 _numerator, qint64 _denominator) : numerator(_numerator), denominator(_denominator)
+        {
+        }
+
+        bool operator <(const Position &other) const
+        {
+            return numerator * other.denominator < other.numerator * denominator;
+        }
+
+        qint64 numerator;
+        qint64 denominator; // Always positive
+    };
+
+    /**
+      Checks whether the line from the origin to a position on the center line of a row is blocked
+      by one of the rows in between.
+      */
+    template<typename Opaque>
+    bool isLineBlocked(int quadrant, int originX, int originY, int depth, const Position &position,
+                       const Opaque &opaque)
+    {
+        int x, y;
+        bool touchesLeft = false;
+        bool touchesRight = false;
+
+        for (int row = 1; row < depth; ++row) {
+            // Twice the column the line crosses the row at
+            qint64 numerator = 2 * position.numerator * row;
+            qint64 denominator = position.denominator * depth;
+
+            if (numerator % denominator == 0 && (numerator / denominator) % 2 != 0) {
+                // Exactly between two tiles
+                int left = (int)floorDiv(numerator / denominator, 2LL);
+                transform(quadrant, originX, originY, row, left, x, y);
+                bool leftOpaque = opaque(x, y);
+                transform(quadrant, originX, originY, row, left + 1, x, y);
+                bool rightOpaque = opaque(x, y);
+
+                touchesLeft |= leftOpaque;
+                touchesRight |= rightOpaque;
+
+                if (touchesLeft && touchesRight)
+                    return true;
+            } else {
+                transform(quadrant, originX, originY, row, (int)floorDiv(numerator + denominator, 2 * denominator), x, y);
+                if (opaque(x, y))
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+      Checks whether a single tile is visible from the origin, by checking the lines to it directly.
+      This is a lot slower than castShadows for revealing an area, since the same tiles are checked
+      over and over again, but it gives exactly the same result.
+      */
+    template<typename Opaque>
+    bool isVisible(int originX, int originY, int x, int y, const Opaque &opaque)
+    {
+        int dx = x - originX;
+        int dy = y - originY;
+
+        if (!dx && !dy)
+            return true;
+
+        bool targetOpaque = opaque(x, y);
+
+        // Tiles on the diagonals belong to two quadrants and are visible if they're visible in either
+        for (int quadrant = 0; quadrant < 4; ++quadrant) {
+            int depth, column;
+
+            switch (quadrant) {
+            case 0:
+                depth = -dy;
+                column = dx;
+                break;
+            case 1:
+                depth = dx;
+                column = dy;
+                break;
+            case 2:
+                depth = dy;
+                column = dx;
+                break;
+            default:
+                depth = -dx;
+                column = dy;
+                break;
+            }
+
+            if (depth <= 0 || qAbs(column) > depth)
+                continue;
+
+            if (!targetOpaque) {
+                if (!isLineBlocked(quadrant, originX, originY, depth, Position(column, 1), opaque))
+                    return true;
+                continue;
+            }
+
+            /*
+              Opaque tiles are visible if the lines to some part of their piece of the center line
+              aren't blocked. Lines never leave the quadrant. Whether lines are blocked only changes
+              where they cross the border between two tiles of another row, so it suffices to check
+              one point between each two of these.
+              */
+            Position low = qMax(Position(2 * column - 1, 2), Position(-depth, 1));
+            Position high = qMin(Position(2 * column + 1, 2), Position(depth, 1));
+
+            QVector<Position> borders;
+            borders.append(low);
+
+            for (int row = 1; row < depth; ++row) {
+                // Borders of the row are at (2k + 1) * depth / (2 * row)
+                for (qint64 k = floorDiv(low.numerator * row, low.denominator * depth) - 1;; ++k) {
+                    Position border((2 * k + 1) * depth, 2 * row);
+                    if (!(border < high))
+                        break;
+                    if (low < border)
+                        borders.append(border);
+                }
+            }
+
+            borders.append(high);
+            qSort(borders);
+
+            for (int i = 1; i < borders.size(); ++i) {
+                const Position &previous = borders.at(i - 1);
+                const Position &next = borders.at(i);
+
+                if (!(previous < next))
+                    continue;
+
+                Position between(previous.numerator * next.denominator + next.numerator * previous.denominator,
+                                 2 * previous.denominator * next.denominator);
+
+                if (!isLineBlocked(quadrant, originX, originY, depth, between, opaque))
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+}
+
+#endif // FIELDOFVIEW_H
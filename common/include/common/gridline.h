@@ -0,0 +1,62 @@
+#ifndef GRIDLINE_H
+#define GRIDLINE_H
+
+#include <QtCore/QtGlobal>
+
+#include <algorithm>
+#include <stdlib.h>
+
+/**
+  Walks the tiles on the Bresenham line between two tiles, including both of them. The tiles are
+  visited in order of the major axis, which may be from the end to the start.
+
+  Passable is a functor called with (x, y) that returns false for tiles that block the line.
+
+  @return True if all tiles on the line are passable. The walk stops at the first blocked tile.
+  */
+template<typename Passable>
+bool walkGridLine(int x0, int y0, int x1, int y1, const Passable &passable)
+{
+    bool steep = abs(y1 - y0) > abs(x1 - x0);
+    if (steep) {
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+    }
+    if (x0 > x1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+    }
+    int deltax = x1 - x0;
+    int deltay = abs(y1 - y0);
+    float error = 0;
+    float deltaerr = 0;
+    // An integer division would make every line shallower than 45 degrees run along the axis
+    if (deltax != 0)
+        deltaerr = deltay / (float)deltax;
+    int ystep;
+    int y = y0;
+    if (y0 < y1)
+        ystep = 1;
+    else
+        ystep = -1;
+
+    for (int x = x0; x <= x1; ++x) {
+        if (steep) {
+            if (!passable(y, x))
+                return false;
+        } else {
+            if (!passable(x, y))
+                return false;
+        }
+
+        error += deltaerr;
+        if (error >= 0.5) {
+            y = y + ystep;
+            error = error - 1.0;
+        }
+    }
+
+    return true;
+}
+
+#endif // GRIDLINE_H
@@ -119,6 +119,22 @@ public:
         return n->value;
     }
 
+    int sidelength() const
+    {
+        return mSidelength;
+    }
+
+    /**
+      Calls visitor(x, y, sidelength, value) for every leaf of this tree, where x and y is the upper
+      left corner of the square covered by the leaf. The squares are only exact for trees with a
+      power-of-two sidelength, since the quadrants of other trees are not aligned.
+      */
+    template<typename Visitor>
+    void visitLeaves(Visitor &visitor) const
+    {
+        visitLeaves(mRoot, 0, 0, mSidelength, visitor);
+    }
+
     void compact()
     {
         QList<Node*> canidates;
@@ -136,6 +152,21 @@ public:
 
 private:
 
+    template<typename Visitor>
+    static void visitLeaves(const Node *n, int x, int y, int sidelength, Visitor &visitor)
+    {
+        if (n->leaf) {
+            visitor(x, y, sidelength, n->value);
+            return;
+        }
+
+        int half = sidelength / 2;
+        visitLeaves(n->children[Node::NorthWest], x, y, half, visitor);
+        visitLeaves(n->children[Node::NorthEast], x + half, y, half, visitor);
+        visitLeaves(n->children[Node::SouthWest], x, y + half, half, visitor);
+        visitLeaves(n->children[Node::SouthEast], x + half, y + half, half, visitor);
+    }
+
     T findFirstLeaf(Node *n)
     {
         while (!n->leaf) {
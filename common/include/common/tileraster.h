@@ -0,0 +1,279 @@
+#ifndef TILERASTER_H
+#define TILERASTER_H
+
+#include <QHash>
+#include <QVector>
+
+#include "quadtree.h"
+
+/**
+  Dense rasters are an alternative to quadtrees for tile layers that are queried very often.
+  They are decoded once from a quadtree and store the tiles in blocks of 64x64 tiles, which keeps
+  neighbouring tiles in the same cache lines. Blocks that have the same value for all tiles are
+  shared, so large uniform areas (i.e. the unused parts of a map) cost only a block index.
+
+  A lookup is two memory accesses instead of a walk from the root of a quadtree.
+  */
+namespace TileRasterBlocks {
+    enum {
+        Shift = 6,
+        Sidelength = 1 << Shift,
+        Mask = Sidelength - 1,
+        Area = Sidelength * Sidelength
+    };
+
+    inline bool isPowerOfTwo(int value)
+    {
+        return value > 0 && (value & (value - 1)) == 0;
+    }
+}
+
+/**
+  A raster of boolean tile flags using one bit per tile.
+  */
+class BitRaster {
+public:
+    BitRaster() : mSidelength(0), mBlocksPerAxis(0)
+    {
+    }
+
+    void decode(const BoolQuadtree &tree)
+    {
+        resize(tree.sidelength());
+
+        if (TileRasterBlocks::isPowerOfTwo(mSidelength)) {
+            DecodeVisitor visitor(this);
+            tree.visitLeaves(visitor);
+        } else {
+            for (int y = 0; y < mSidelength; ++y)
+                for (int x = 0; x < mSidelength; ++x)
+                    if (tree.get(x, y))
+                        set(x, y);
+        }
+    }
+
+    /**
+      Returns the flag of a tile. Tiles outside of the raster are never set.
+      */
+    bool get(int x, int y) const
+    {
+        if ((uint)x >= (uint)mSidelength || (uint)y >= (uint)mSidelength)
+            return false;
+
+        const Block &block = mBlocks[mBlockIndex[(y >> TileRasterBlocks::Shift) * mBlocksPerAxis
+                                                 + (x >> TileRasterBlocks::Shift)]];
+        return (block.rows[y & TileRasterBlocks::Mask] >> (x & TileRasterBlocks::Mask)) & 1;
+    }
+
+    int sidelength() const
+    {
+        return mSidelength;
+    }
+
+    /**
+      The number of bytes used by this raster.
+      */
+    uint memoryUsage() const
+    {
+        return mBlocks.size() * sizeof(Block) + mBlockIndex.size() * sizeof(int);
+    }
+
+private:
+    struct Block {
+        quint64 rows[TileRasterBlocks::Sidelength];
+    };
+
+    enum {
+        ClearedBlock = 0,
+        SetBlock = 1
+    };
+
+    struct DecodeVisitor {
+        DecodeVisitor(BitRaster *_raster) : raster(_raster) {}
+
+        void operator()(int x, int y, int sidelength, bool value)
+        {
+            if (sidelength >= TileRasterBlocks::Sidelength) {
+                // The leaf covers entire blocks
+                for (int by = y; by < y + sidelength; by += TileRasterBlocks::Sidelength)
+                    for (int bx = x; bx < x + sidelength; bx += TileRasterBlocks::Sidelength)
+                        raster->blockIndex(bx, by) = value ? SetBlock : ClearedBlock;
+            } else if (value) {
+                for (int ty = y; ty < y + sidelength; ++ty)
+                    for (int tx = x; tx < x + sidelength; ++tx)
+                        raster->set(tx, ty);
+            }
+        }
+
+        BitRaster *raster;
+    };
+
+    void resize(int sidelength)
+    {
+        mSidelength = sidelength;
+        mBlocksPerAxis = (sidelength + TileRasterBlocks::Mask) >> TileRasterBlocks::Shift;
+        mBlockIndex.fill(ClearedBlock, mBlocksPerAxis * mBlocksPerAxis);
+
+        mBlocks.resize(2);
+        for (int i = 0; i < TileRasterBlocks::Sidelength; ++i) {
+            mBlocks[ClearedBlock].rows[i] = 0;
+            mBlocks[SetBlock].rows[i] = ~Q_UINT64_C(0);
+        }
+    }
+
+    int &blockIndex(int x, int y)
+    {
+        return mBlockIndex[(y >> TileRasterBlocks::Shift) * mBlocksPerAxis + (x >> TileRasterBlocks::Shift)];
+    }
+
+    void set(int x, int y)
+    {
+        int &index = blockIndex(x, y);
+
+        // Shared blocks are copied before they're modified
+        if (index == ClearedBlock || index == SetBlock) {
+            Block copy = mBlocks[index];
+            mBlocks.append(copy);
+            index = mBlocks.size() - 1;
+        }
+
+        mBlocks[index].rows[y & TileRasterBlocks::Mask] |= Q_UINT64_C(1) << (x & TileRasterBlocks::Mask);
+    }
+
+    int mSidelength;
+    int mBlocksPerAxis;
+    QVector<int> mBlockIndex;
+    QVector<Block> mBlocks;
+};
+
+/**
+  A raster of byte-sized tile values using one byte per tile.
+  */
+template<typename T>
+class DenseRaster {
+public:
+    DenseRaster() : mSidelength(0), mBlocksPerAxis(0)
+    {
+    }
+
+    void decode(const Quadtree<T> &tree)
+    {
+        mSidelength = tree.sidelength();
+        mBlocksPerAxis = (mSidelength + TileRasterBlocks::Mask) >> TileRasterBlocks::Shift;
+        mBlocks.clear();
+        mUniformBlocks.clear();
+
+        // All blocks start out sharing the default value
+        int defaultBlock = uniformBlock(T());
+        mBlockIndex.fill(defaultBlock, mBlocksPerAxis * mBlocksPerAxis);
+
+        if (TileRasterBlocks::isPowerOfTwo(mSidelength)) {
+            DecodeVisitor visitor(this);
+            tree.visitLeaves(visitor);
+        } else {
+            for (int y = 0; y < mSidelength; ++y)
+                for (int x = 0; x < mSidelength; ++x)
+                    set(x, y, tree.get(x, y));
+        }
+    }
+
+    /**
+      Returns the value of a tile. Tiles outside of the raster have the default value.
+      */
+    T get(int x, int y) const
+    {
+        if ((uint)x >= (uint)mSidelength || (uint)y >= (uint)mSidelength)
+            return T();
+
+        const Block &block = mBlocks[mBlockIndex[(y >> TileRasterBlocks::Shift) * mBlocksPerAxis
+                                                 + (x >> TileRasterBlocks::Shift)]];
+        return block.values[((y & TileRasterBlocks::Mask) << TileRasterBlocks::Shift) | (x & TileRasterBlocks::Mask)];
+    }
+
+    int sidelength() const
+    {
+        return mSidelength;
+    }
+
+    /**
+      The number of bytes used by this raster.
+      */
+    uint memoryUsage() const
+    {
+        return mBlocks.size() * sizeof(Block) + mBlockIndex.size() * sizeof(int);
+    }
+
+private:
+    struct Block {
+        T values[TileRasterBlocks::Area];
+    };
+
+    struct DecodeVisitor {
+        DecodeVisitor(DenseRaster<T> *_raster) : raster(_raster) {}
+
+        void operator()(int x, int y, int sidelength, const T &value)
+        {
+            if (sidelength >= TileRasterBlocks::Sidelength) {
+                int block = raster->uniformBlock(value);
+                for (int by = y; by < y + sidelength; by += TileRasterBlocks::Sidelength)
+                    for (int bx = x; bx < x + sidelength; bx += TileRasterBlocks::Sidelength)
+                        raster->blockIndex(bx, by) = block;
+            } else {
+                for (int ty = y; ty < y + sidelength; ++ty)
+                    for (int tx = x; tx < x + sidelength; ++tx)
+                        raster->set(tx, ty, value);
+            }
+        }
+
+        DenseRaster<T> *raster;
+    };
+
+    int uniformBlock(const T &value)
+    {
+        typename QHash<T, int>::const_iterator it = mUniformBlocks.constFind(value);
+        if (it != mUniformBlocks.constEnd())
+            return it.value();
+
+        Block block;
+        for (int i = 0; i < TileRasterBlocks::Area; ++i)
+            block.values[i] = value;
+        mBlocks.append(block);
+        mUniformBlocks.insert(value, mBlocks.size() - 1);
+        return mBlocks.size() - 1;
+    }
+
+    int &blockIndex(int x, int y)
+    {
+        return mBlockIndex[(y >> TileRasterBlocks::Shift) * mBlocksPerAxis + (x >> TileRasterBlocks::Shift)];
+    }
+
+    void set(int x, int y, const T &value)
+    {
+        int &index = blockIndex(x, y);
+
+        Block &current = mBlocks[index];
+        int i = ((y & TileRasterBlocks::Mask) << TileRasterBlocks::Shift) | (x & TileRasterBlocks::Mask);
+
+        if (current.values[i] == value)
+            return;
+
+        // Shared blocks are copied before they're modified
+        if (mUniformBlocks.value(current.values[0], -1) == index) {
+            Block copy = current;
+            mBlocks.append(copy);
+            index = mBlocks.size() - 1;
+        }
+
+        mBlocks[index].values[i] = value;
+    }
+
+    int mSidelength;
+    int mBlocksPerAxis;
+    QVector<int> mBlockIndex;
+    QVector<Block> mBlocks;
+    QHash<T, int> mUniformBlocks;
+};
+
+typedef DenseRaster<qint8> CharRaster;
+
+#endif // TILERASTER_H
@@ -1,11 +1,28 @@
 /**
  * Describes a path between two points in the world.
  * The path may be updated and traversed.
+ * @param points Optional points of a path that was already found for the object (see Path.createGroup).
  */
-var Path = function(object, to) {
+var Path = function(object, to, points) {
     if (!(this instanceof Path))
         throw "Only use the Path constructor.";
-    this.update(object, to);
+    if (points === undefined)
+        this.update(object, to);
+    else
+        this.setPoints(object, points);
+};
+
+/**
+ * Creates paths for several objects that move to the same position. This only searches once for
+ * all objects of the same size.
+ * @returns An array with the path of every object, in the same order as the objects.
+ */
+Path.createGroup = function(objects, to) {
+    var points = Maps.currentMap.findGroupPaths(objects, to);
+
+    return objects.map(function(object, i) {
+        return new Path(object, to, points[i]);
+    });
 };
 
 (function() {
@@ -23,20 +40,28 @@ var Path = function(object, to) {
      * @param to The target point for the path.
      */
     Path.prototype.update = function(object, to) {
-        this.from = object.position;
-        this.radius = object.radius;
-
-        this.segments = [];
-
         var points;
 
         if (to instanceof Array) {
             print("Moving using array");
-            points = Maps.currentMap.findPath(object, to);
+            // Paths for movement can cross the entire map, which is what the hierarchical search is for
+            points = Maps.currentMap.findPath(object, to, Pathfinder.HierarchicalSearch);
         } else {
             points = Maps.currentMap.findPathIntoRange(object, to, 25);
         }
 
+        this.setPoints(object, points);
+    };
+
+    /**
+     * Replaces this path with the segments between the given points.
+     */
+    Path.prototype.setPoints = function(object, points) {
+        this.from = object.position;
+        this.radius = object.radius;
+
+        this.segments = [];
+
         for (var i = 0; i < points.length - 1; ++i) {
             var d = V3.sub(points[i + 1], points[i]);
             var l = V3.length(d);
@@ -463,6 +463,10 @@ BaseObject.prototype.dealDamage = function(damage, source) {
             this.playAnimation(Animations.Death);
             this.updateIdleAnimation();
 
+            // Others can walk over the body
+            if (this.map)
+                this.map.removeObstacle(this);
+
             // Notify the event bus
             EventBus.notify(EventTypes.CritterDied, this, damage, source);
         } else {
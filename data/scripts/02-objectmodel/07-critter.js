@@ -43,6 +43,23 @@ Critter.prototype.canSee = function(object) {
     return Maps.currentMap.checkLineOfSight(this.position, object.position);
 };
 
+/**
+ * Living critters on the current map block the tiles they stand on for the pathfinding of others.
+ */
+Critter.prototype.createRenderState = function() {
+    BaseObject.prototype.createRenderState.call(this);
+
+    if (this.map && this.map === Maps.currentMap && !this.disabled && !this.isUnconscious())
+        this.map.addObstacle(this);
+};
+
+Critter.prototype.removeRenderState = function() {
+    if (this.map)
+        this.map.removeObstacle(this);
+
+    BaseObject.prototype.removeRenderState.call(this);
+};
+
 Critter.prototype.updateIdleAnimation = function() {
 
     var renderState = this.getRenderState();
@@ -6,6 +6,10 @@ var CombatUi = {};
     var initiativeBarDialog = null;
     var movementIndicatorNode = null;
     var movementIndicatorRootNode = null;
+    var movementPreviewRequest = 0; // The pending path request for the movement indicator
+    var movementArea = null; // The area the active participant can reach this turn
+
+    var MovementRange = 250; // How far a participant can move per turn
 
     /**
      * Make the combat UI visible.
@@ -96,7 +100,7 @@ var CombatUi = {};
             for (var i = 0; i < path.length; ++i) {
                 if (i + 1 < path.length) {
                     var line = new DecoratedLineRenderable(gameView.scene, gameView.materials);
-                    if (length > 250)
+                    if (length > MovementRange)
                         line.color = [1, 0, 0, 1];
                     else
                         line.color = [0, 1, 0, 1];
@@ -211,6 +215,7 @@ var CombatUi = {};
 
     function participantChanged(previousParticipant) {
         hideMovementIndicator();
+        movementArea = null;
 
         updateInitiative();
         updateCombatBar();
@@ -222,6 +227,40 @@ var CombatUi = {};
         activeParticipant.setSelected(true); // Show on the battlefield who is acting
     }
 
+    /**
+     * Returns the area the participant can reach this turn. It is only searched once per turn and position.
+     */
+    function getMovementArea(participant) {
+        if (!movementArea || movementArea.participant !== participant
+            || !movementArea.position.equals(participant.position)) {
+            movementArea = {
+                participant: participant,
+                position: participant.position.slice(0),
+                id: Maps.currentMap.reachableArea(participant, MovementRange)
+            };
+        }
+
+        return movementArea.id;
+    }
+
+    function showMovementPath(path) {
+        var length = pathLength(path);
+
+        movementIndicatorRootNode = gameView.scene.createNode();
+
+        for (var i = 0; i < path.length; ++i) {
+            if (i + 1 < path.length) {
+                var line = new DecoratedLineRenderable(gameView.scene, gameView.materials);
+                if (length > MovementRange)
+                    line.color = [1, 0, 0, 1];
+                else
+                    line.color = [0, 1, 0, 1];
+                line.addLine(path[i], path[i + 1]);
+                movementIndicatorRootNode.attachObject(line);
+            }
+        }
+    }
+
     function mouseMoved(event, worldPos) {
         hideMovementIndicator();
 
@@ -236,32 +275,34 @@ var CombatUi = {};
             indicator.circleWidth = 3;
             movementIndicatorNode.attachObject(indicator);
 
-            var path = Maps.currentMap.findPath(participant, worldPos);
+            // Positions within range are looked up in the area searched at the start of the turn
+            var path = Maps.currentMap.pathInReachableArea(getMovementArea(participant), worldPos);
 
-            if (path.length == 0) {
-                indicator.fillColor = [1, 0, 0, 0.5];
+            if (path.length > 0) {
+                showMovementPath(path);
                 return;
             }
 
-            var length = pathLength(path);
-
-            movementIndicatorRootNode = gameView.scene.createNode();
+            // The preview is updated on every mouse move, so don't wait for the path here
+            movementPreviewRequest = Maps.currentMap.findPathAsync(participant, worldPos, function(path) {
+                movementPreviewRequest = 0;
 
-            for (var i = 0; i < path.length; ++i) {
-                if (i + 1 < path.length) {
-                    var line = new DecoratedLineRenderable(gameView.scene, gameView.materials);
-                    if (length > 250)
-                        line.color = [1, 0, 0, 1];
-                    else
-                        line.color = [0, 1, 0, 1];
-                    line.addLine(path[i], path[i + 1]);
-                    movementIndicatorRootNode.attachObject(line);
+                if (path.length == 0) {
+                    indicator.fillColor = [1, 0, 0, 0.5];
+                    return;
                 }
-            }
+
+                showMovementPath(path);
+            });
         }
     }
 
     function hideMovementIndicator() {
+        // A path that is still being searched would show up for the previous position
+        if (movementPreviewRequest) {
+            Maps.currentMap.cancelPathRequest(movementPreviewRequest);
+            movementPreviewRequest = 0;
+        }
         if (movementIndicatorNode) {
             gameView.scene.removeNode(movementIndicatorNode);
             movementIndicatorNode = null;
@@ -68,3 +68,25 @@ Debug.markAllAreas = function() {
     WorldMap.mark("deklo_grove");
     return "Marked all worldmap areas.";
 };
+
+/**
+ * Compares the number of nodes expanded by A* and Jump Point Search on the current map.
+ * @param samples The number of random paths to search (defaults to 200).
+ * @param radius The radius of the actor (defaults to 25).
+ */
+Debug.comparePathfinding = function(samples, radius) {
+    if (!samples)
+        samples = 200;
+    if (!radius)
+        radius = 25;
+
+    var stats = Maps.currentMap.pathfinder.compareSearchModes(samples, radius);
+
+    if (!stats.samples)
+        return "Found no reachable positions to compare.";
+
+    return "Searched " + stats.samples + " paths.\n"
+        + "A*: " + stats.flatExpandedNodes + " expanded nodes, " + stats.flatTime + " ms\n"
+        + "Jump Point Search: " + stats.jumpPointExpandedNodes + " expanded nodes, " + stats.jumpPointTime + " ms\n"
+        + "Paths with different lengths: " + stats.differentLengths;
+};
@@ -138,6 +138,7 @@ MovementGoal.prototype.advance = function(critter, time) {
 
         var position = this.path.advance(driven);
         critter.position = position.slice(0); // Assign a copy, since position will be modified further
+        Maps.currentMap.moveObstacle(critter);
 
         position[1] = critter.getWaterDepth(); // Depth is DISPLAY ONLY
         sceneNode.position = position;
@@ -174,8 +175,17 @@ MoveInRangeGoal.prototype.advance = function(critter, time) {
     if (gapRemaining < range) {
         this.finished = true;
     } else {
-        // Calculate a path to the target and advance on it until we are within range.
-        var path = Maps.currentMap.findPath(critter, this.target.position);
+        /*
+         Targets in a different area can never be reached, so don't search for a path. The target
+         blocks its own position, so only the tiles in range of it are checked.
+         */
+        if (!Maps.currentMap.isReachable(critter, this.target.position, this.target.radius + this.range)) {
+            this.finished = true;
+            return;
+        }
+
+        // Calculate a path into range of the target and advance on it.
+        var path = Maps.currentMap.findPathIntoRange(critter, this.target, this.range);
 
         if (path.length < 2) {
             this.finished = true; // Pathing is impossible.
@@ -268,13 +268,159 @@ var Map = function(id) {
         SoundController.activate(this.soundSchemes);
     };
 
-    Map.prototype.findPath = function(object, target) {
+    /**
+     * Finds a path for an object to a target position.
+     * @param mode Optional search mode (i.e. Pathfinder.HierarchicalSearch). The pathfinder's default is used if omitted.
+     */
+    Map.prototype.findPath = function(object, target, mode) {
         if (!this.pathfinder) {
             print("Trying to find a path but Map is not active.");
             return [];
         }
 
-        return this.pathfinder.findPath(object.position, target, object.radius);
+        if (mode === undefined)
+            return this.pathfinder.findPath(object.position, target, object.radius);
+        else
+            return this.pathfinder.findPath(object.position, target, object.radius, mode);
+    };
+
+    /**
+     * Finds paths for several objects to the same target position. Objects of the same size share a
+     * single flow field search, instead of searching once per object.
+     * @returns An array with the path of every object, in the same order as the objects.
+     */
+    Map.prototype.findGroupPaths = function(objects, target) {
+        if (!this.pathfinder) {
+            print("Trying to find a path but Map is not active.");
+            return objects.map(function() { return []; });
+        }
+
+        var map = this;
+        var pathfinder = this.pathfinder;
+        var fields = {};
+
+        // The field only covers detours of up to half the distance of the object furthest away
+        var maxDistance = 0;
+        objects.forEach(function(object) {
+            maxDistance = Math.max(maxDistance, distance(object.position, target));
+        });
+        maxDistance = maxDistance * 1.5 + 100;
+
+        return objects.map(function(object) {
+            if (!(object.radius in fields))
+                fields[object.radius] = pathfinder.flowField([target], object.radius, 0, maxDistance);
+
+            var path = pathfinder.followFlowField(fields[object.radius], object.position);
+
+            // Objects that have to take a longer detour are searched for separately
+            if (path.length == 0)
+                path = map.findPath(object, target, Pathfinder.HierarchicalSearch);
+
+            return path;
+        });
+    };
+
+    /**
+     * Determines where an object can walk within a maximum distance, using a single search.
+     * @returns The identifier of the area, see reachableDistance and pathInReachableArea.
+     */
+    Map.prototype.reachableArea = function(object, maxDistance) {
+        if (!this.pathfinder)
+            return 0;
+
+        return this.pathfinder.reachableArea(object.position, object.radius, maxDistance);
+    };
+
+    /**
+     * Returns how far the object an area was created for has to walk to a position, or -1 if
+     * the position is outside of the area.
+     */
+    Map.prototype.reachableDistance = function(area, position) {
+        if (!this.pathfinder || !area)
+            return -1;
+
+        return this.pathfinder.flowFieldDistance(area, position);
+    };
+
+    /**
+     * Returns the path to a position within a reachable area, or an empty path if the position
+     * is outside of the area.
+     */
+    Map.prototype.pathInReachableArea = function(area, position) {
+        if (!this.pathfinder || !area)
+            return [];
+
+        return this.pathfinder.pathInReachableArea(area, position);
+    };
+
+    /**
+     * Finds a path for an object to a target position without blocking the game. The callback is
+     * called with the path later on, or with an empty array if there is no path.
+     * @returns A request id that can be passed to cancelPathRequest.
+     */
+    Map.prototype.findPathAsync = function(object, target, callback) {
+        if (!this.pathfinder) {
+            print("Trying to find a path but Map is not active.");
+            return 0;
+        }
+
+        return this.pathfinder.findPathAsync(object.position, target, object.radius, callback);
+    };
+
+    /**
+     * Drops a request made using findPathAsync. Its callback will not be called.
+     */
+    Map.prototype.cancelPathRequest = function(id) {
+        if (this.pathfinder && id)
+            this.pathfinder.cancelPathRequest(id);
+    };
+
+    /**
+     * Checks whether an object could walk to a position at all. This does not search for a path
+     * and is therefore cheap enough to filter many potential targets.
+     * @param range Optional distance to the position that is close enough. Required for positions
+     *              that are blocked themselves, such as the position of another critter.
+     */
+    Map.prototype.isReachable = function(object, position, range) {
+        if (!this.pathfinder)
+            return false;
+
+        if (range === undefined)
+            return this.pathfinder.isReachable(object.position, position, object.radius);
+        else
+            return this.pathfinder.isRangeReachable(object.position, position, object.radius, range);
+    };
+
+    /**
+     * Returns an identifier for the area an object can walk in. Two objects with the same component
+     * can reach each other, and 0 means the object is stuck.
+     */
+    Map.prototype.componentAt = function(object) {
+        if (!this.pathfinder)
+            return 0;
+
+        return this.pathfinder.componentAt(object.position, object.radius);
+    };
+
+    /**
+     * Makes an object block the tiles it stands on for the pathfinding of other objects.
+     */
+    Map.prototype.addObstacle = function(object) {
+        if (this.pathfinder && object.radius)
+            this.pathfinder.addObstacle(object.id, object.position, object.radius);
+    };
+
+    /**
+     * Updates the position of an object that is an obstacle. Does nothing for other objects.
+     */
+    Map.prototype.moveObstacle = function(object) {
+        if (this.pathfinder)
+            this.pathfinder.moveObstacle(object.id, object.position);
+    };
+
+    Map.prototype.removeObstacle = function(object) {
+        if (this.pathfinder)
+            this.pathfinder.removeObstacle(object.id);
     };
 
     Map.prototype.findPathIntoRange = function(object, target, range) {
@@ -415,9 +561,9 @@ var Map = function(id) {
 
         var removed = this.mobiles.splice(index, 1);
         assertTrue(removed.length == 1, "Didn't remove mobile from list.");
-        delete mobile['map'];
 
-        mobile.removeRenderState();
+        mobile.removeRenderState(); // Needs the map to remove the mobile's obstacle
+        delete mobile['map'];
     };
 
     /**
@@ -661,9 +807,41 @@ var Map = function(id) {
 
     StartupListeners.add(function() {
 
+        // The fog of war observer of every party member by id, and the fog they belong to
+        var fogObservers = {};
+        var observedFog = null;
+
         var fogCheck = function() {
-            if (Maps.currentMap && Maps.currentMap.renderFog) {
-                Maps.currentMap.renderFog.reveal(Party.getLeader().position, 100);
+            var fog = Maps.currentMap ? Maps.currentMap.renderFog : null;
+
+            // Observers are dropped together with the fog when the map changes
+            if (fog !== observedFog) {
+                fogObservers = {};
+                observedFog = fog;
+            }
+
+            if (fog) {
+                var members = {};
+
+                // The fog only recomputes the sight of members that moved onto another tile
+                Party.getMembers().forEach(function(member) {
+                    if (!member.position)
+                        return;
+
+                    members[member.id] = true;
+
+                    if (fogObservers[member.id] === undefined)
+                        fogObservers[member.id] = fog.addObserver(member.position, 100);
+                    else
+                        fog.moveObserver(fogObservers[member.id], member.position);
+                });
+
+                for (var id in fogObservers) {
+                    if (!members[id]) {
+                        fog.removeObserver(fogObservers[id]);
+                        delete fogObservers[id];
+                    }
+                }
             }
 
             gameView.addVisualTimer(500, fogCheck);
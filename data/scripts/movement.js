@@ -7,8 +7,13 @@
         if (event.button != Mouse.LeftButton)
             return;
 
-        Selection.get().forEach(function (critter) {
-            var path = new Path(critter, worldPosition);
+        var critters = Selection.get();
+
+        // The selection moves together, which only needs one search
+        var paths = Path.createGroup(critters, worldPosition);
+
+        critters.forEach(function (critter, i) {
+            var path = paths[i];
 
             if (!path.isEmpty()) {
                 var movementGoal = new MovementGoal(path, false);
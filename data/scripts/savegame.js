@@ -33,7 +33,12 @@ var SaveGames = {};
              */
             savingListeners.notify(payload);
 
-            if (id)
+            // The explored area is binary and stored next to the payload
+            var fog = Maps.currentMap ? Maps.currentMap.renderFog : null;
+
+            if (fog)
+                record = savegames.save(id || '', name, screenshot, JSON.stringify(payload), fog.saveSnapshot());
+            else if (id)
                 record = savegames.save(id, name, screenshot, JSON.stringify(payload));
             else
                 record = savegames.save(name, screenshot, JSON.stringify(payload));
@@ -64,6 +69,10 @@ var SaveGames = {};
          */
         loadingListeners.notify(payload);
 
+        // The listeners recreate the fog of war of the current map, which can then be restored
+        if (Maps.currentMap && Maps.currentMap.renderFog)
+            Maps.currentMap.renderFog.loadSnapshot(savegames.loadFogOfWar(id));
+
         /**
          * Once all data has been loaded, notify the second tier of listeners.
          * This allows listeners to assume that all state has been restored.
@@ -0,0 +1,210 @@
+#ifndef BINARYHEAP_H
+#define BINARYHEAP_H
+
+#include <QtCore/QVector>
+
+namespace EvilTemple {
+
+/**
+  A binary min-heap over small integer handles (i.e. indices into a node array) that supports
+  changing the priority of an already queued handle.
+
+  The heap remembers the position of every queued handle, so decreasing the priority of a node
+  that is already part of the open set of a search is a O(log n) operation. The storage is never
+  released by clear(), which allows reusing the same heap for many searches without touching the
+  allocator.
+  */
+template<typename Priority>
+class IndexedBinaryHeap
+{
+public:
+    IndexedBinaryHeap();
+
+    /**
+      Removes all handles from the heap. This is O(n) in the number of queued handles, not in the
+      number of handles the heap has ever seen.
+      */
+    void clear();
+
+    bool isEmpty() const;
+
+    int size() const;
+
+    /**
+      Checks whether the given handle is currently queued.
+      */
+    bool contains(uint handle) const;
+
+    /**
+      Queues a handle with the given priority. If the handle is already queued, its priority is
+      replaced instead.
+      */
+    void push(uint handle, const Priority &priority);
+
+    /**
+      Removes the handle with the lowest priority from the heap and returns it.
+      The heap must not be empty.
+      */
+    uint pop();
+
+    /**
+      Returns the handle with the lowest priority without removing it.
+      */
+    uint top() const;
+
+    const Priority &topPriority() const;
+
+private:
+    struct Entry {
+        Priority priority;
+        uint handle;
+    };
+
+    void siftUp(int pos);
+    void siftDown(int pos);
+    void place(int pos, const Entry &entry);
+
+    QVector<Entry> mEntries;
+    QVector<int> mPositions; // Maps a handle to its position in mEntries or -1
+    int mSize;
+};
+
+template<typename Priority>
+inline IndexedBinaryHeap<Priority>::IndexedBinaryHeap() : mSize(0)
+{
+}
+
+template<typename Priority>
+inline void IndexedBinaryHeap<Priority>::clear()
+{
+    for (int i = 0; i < mSize; ++i)
+        mPositions[mEntries[i].handle] = -1;
+    mSize = 0;
+}
+
+template<typename Priority>
+inline bool IndexedBinaryHeap<Priority>::isEmpty() const
+{
+    return mSize == 0;
+}
+
+template<typename Priority>
+inline int IndexedBinaryHeap<Priority>::size() const
+{
+    return mSize;
+}
+
+template<typename Priority>
+inline bool IndexedBinaryHeap<Priority>::contains(uint handle) const
+{
+    return handle < (uint)mPositions.size() && mPositions[handle] != -1;
+}
+
+template<typename Priority>
+inline void IndexedBinaryHeap<Priority>::place(int pos, const Entry &entry)
+{
+    mEntries[pos] = entry;
+    mPositions[entry.handle] = pos;
+}
+
+template<typename Priority>
+inline void IndexedBinaryHeap<Priority>::siftUp(int pos)
+{
+    Entry entry = mEntries[pos];
+
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (!(entry.priority < mEntries[parent].priority))
+            break;
+        place(pos, mEntries[parent]);
+        pos = parent;
+    }
+
+    place(pos, entry);
+}
+
+template<typename Priority>
+inline void IndexedBinaryHeap<Priority>::siftDown(int pos)
+{
+    Entry entry = mEntries[pos];
+
+    forever {
+        int child = pos * 2 + 1;
+        if (child >= mSize)
+            break;
+        if (child + 1 < mSize && mEntries[child + 1].priority < mEntries[child].priority)
+            child++;
+        if (!(mEntries[child].priority < entry.priority))
+            break;
+        place(pos, mEntries[child]);
+        pos = child;
+    }
+
+    place(pos, entry);
+}
+
+template<typename Priority>
+inline void IndexedBinaryHeap<Priority>::push(uint handle, const Priority &priority)
+{
+    if (handle >= (uint)mPositions.size()) {
+        int oldSize = mPositions.size();
+        mPositions.resize(qMax<int>(handle + 1, oldSize * 2));
+        for (int i = oldSize; i < mPositions.size(); ++i)
+            mPositions[i] = -1;
+    }
+
+    int pos = mPositions[handle];
+
+    if (pos != -1) {
+        // Already queued, so this is either a decrease- or an increase-key operation
+        bool decreased = priority < mEntries[pos].priority;
+        mEntries[pos].priority = priority;
+        if (decreased)
+            siftUp(pos);
+        else
+            siftDown(pos);
+        return;
+    }
+
+    if (mSize == mEntries.size())
+        mEntries.resize(qMax(16, mSize * 2));
+
+    mEntries[mSize].priority = priority;
+    mEntries[mSize].handle = handle;
+    mPositions[handle] = mSize;
+    siftUp(mSize++);
+}
+
+template<typename Priority>
+inline uint IndexedBinaryHeap<Priority>::pop()
+{
+    Q_ASSERT(mSize > 0);
+
+    uint result = mEntries[0].handle;
+    mPositions[result] = -1;
+
+    if (--mSize > 0) {
+        place(0, mEntries[mSize]);
+        siftDown(0);
+    }
+
+    return result;
+}
+
+template<typename Priority>
+inline uint IndexedBinaryHeap<Priority>::top() const
+{
+    Q_ASSERT(mSize > 0);
+    return mEntries[0].handle;
+}
+
+template<typename Priority>
+inline const Priority &IndexedBinaryHeap<Priority>::topPriority() const
+{
+    Q_ASSERT(mSize > 0);
+    return mEntries[0].priority;
+}
+
+}
+
+#endif // BINARYHEAP_H
@@ -0,0 +1,493 @@
+
+#include "clustergraph.h"
+#include "tileinfo.h"
+#include "tilesearch.h"
+
+namespace EvilTemple {
+
+/*
+  Borders with a connected run of at least this many tiles get an entrance at both ends of the
+  run instead of a single one in the middle.
+  */
+static const int MinDoubleEntranceLength = 6;
+
+/**
+  Passability functor for searches that are confined to a single cluster.
+  */
+struct ClusterTile {
+    ClusterTile(const TileInfo *_tileInfo, int _radius, const QRect &_area,
+                const OccupantExclusion *_exclusion = NULL)
+        : tileInfo(_tileInfo), radius(_radius), area(_area), exclusion(_exclusion)
+    {
+    }
+
+    inline bool operator()(int x, int y) const
+    {
+        if (!area.contains(x, y))
+            return false;
+        if (exclusion && exclusion->contains(x, y))
+            return exclusion->canStand(x, y);
+        return tileInfo->canStandOnTile(x, y, radius);
+    }
+
+    const TileInfo *tileInfo;
+    int radius;
+    QRect area;
+    const OccupantExclusion *exclusion;
+};
+
+/**
+  Search goal that expands nodes until all of the given tiles have been reached. This is used to
+  compute the cost to several tiles with a single search.
+  */
+struct ReachTiles {
+    ReachTiles(const QVector<QPoint> &_tiles, int _first)
+        : tiles(_tiles), first(_first), remaining(_tiles.size() - _first)
+    {
+    }
+
+    bool isGoal(const QPoint &tile) const
+    {
+        for (int i = first; i < tiles.size(); ++i)
+            if (tiles[i] == tile)
+                remaining--;
+        return remaining <= 0;
+    }
+
+    uint heuristic(const QPoint &) const
+    {
+        return 0;
+    }
+
+    const QVector<QPoint> &tiles;
+    int first;
+    mutable int remaining;
+};
+
+ClusterGraph::ClusterGraph(const TileInfo *tileInfo, int radius)
+    : mTileInfo(tileInfo), mRadius(radius), mClustersX(0), mClustersY(0), mSearchCount(0)
+{
+    const QRect &extent = tileInfo->clearanceMap().extent();
+
+    if (extent.isEmpty())
+        return;
+
+    // Clusters are aligned to the sector grid, not to the walkable area
+    mOrigin = QPoint(extent.left() - extent.left() % ClusterSize, extent.top() - extent.top() % ClusterSize);
+    mClustersX = (extent.right() - mOrigin.x()) / ClusterSize + 1;
+    mClustersY = (extent.bottom() - mOrigin.y()) / ClusterSize + 1;
+
+    mClusters.resize(mClustersX * mClustersY);
+
+    for (int cy = 0; cy < mClustersY; ++cy) {
+        for (int cx = 0; cx < mClustersX; ++cx) {
+            int index = cy * mClustersX + cx;
+            Cluster &cluster = mClusters[index];
+            cluster.area = QRect(mOrigin.x() + cx * ClusterSize, mOrigin.y() + cy * ClusterSize,
+                                 ClusterSize, ClusterSize).intersected(extent);
+            cluster.state = TilesChanged;
+            mChangedClusters.append(index);
+        }
+    }
+}
+
+void ClusterGraph::invalidate(const QRect &area)
+{
+    // The passability of a tile depends on all blocked tiles within the actor's radius
+    QRect affected = area.adjusted(-mRadius, -mRadius, mRadius, mRadius);
+
+    for (int i = 0; i < mClusters.size(); ++i) {
+        if (mClusters[i].area.intersects(affected))
+            markChanged(i, TilesChanged);
+    }
+}
+
+void ClusterGraph::markChanged(int cluster, ClusterState state)
+{
+    ClusterState &current = mClusters[cluster].state;
+
+    if (current == Valid)
+        mChangedClusters.append(cluster);
+
+    if (state > current)
+        current = state;
+}
+
+int ClusterGraph::clusterAt(const QPoint &tile) const
+{
+    if (tile.x() < mOrigin.x() || tile.y() < mOrigin.y())
+        return -1;
+
+    int cx = (tile.x() - mOrigin.x()) / ClusterSize;
+    int cy = (tile.y() - mOrigin.y()) / ClusterSize;
+
+    if (cx >= mClustersX || cy >= mClustersY)
+        return -1;
+
+    int index = cy * mClustersX + cx;
+    return mClusters[index].area.contains(tile) ? index : -1;
+}
+
+bool ClusterGraph::isPassable(int x, int y) const
+{
+    return mTileInfo->canStandOnTile(x, y, mRadius);
+}
+
+uint ClusterGraph::createNode(int cluster, const QPoint &tile)
+{
+    uint index;
+
+    if (!mFreeNodes.isEmpty()) {
+        index = mFreeNodes.last();
+        mFreeNodes.resize(mFreeNodes.size() - 1);
+    } else {
+        index = mNodes.size();
+        mNodes.resize(index + 1);
+    }
+
+    Node &node = mNodes[index];
+    node.tile = tile;
+    node.cluster = cluster;
+    node.partner = NoNode;
+    node.edges.clear();
+
+    mClusters[cluster].nodes.append(index);
+
+    return index;
+}
+
+void ClusterGraph::removeNode(uint index)
+{
+    Node &node = mNodes[index];
+
+    QVector<uint> &nodes = mClusters[node.cluster].nodes;
+    nodes.remove(nodes.indexOf(index));
+
+    node.cluster = -1;
+    node.partner = NoNode;
+    node.edges.clear();
+
+    mFreeNodes.append(index);
+}
+
+void ClusterGraph::clearEntrances(QVector<uint> &entrances)
+{
+    foreach (uint entrance, entrances) {
+        removeNode(mNodes[entrance].partner);
+        removeNode(entrance);
+    }
+    entrances.clear();
+}
+
+void ClusterGraph::addEntrance(int cluster, int neighbour, const QPoint &tile, const QPoint &across,
+                               QVector<uint> &entrances)
+{
+    uint inside = createNode(cluster, tile);
+    uint outside = createNode(neighbour, tile + across);
+
+    mNodes[inside].partner = outside;
+    mNodes[outside].partner = inside;
+
+    entrances.append(inside);
+}
+
+void ClusterGraph::scanBorder(int cluster, int neighbour, const QPoint &first, const QPoint &step,
+                              const QPoint &across, int length, QVector<uint> &entrances)
+{
+    int runStart = -1;
+
+    // Find the runs of tiles where the actor can cross the border
+    for (int i = 0; i <= length; ++i) {
+        QPoint tile = first + i * step;
+
+        if (i < length && isPassable(tile.x(), tile.y())
+            && isPassable(tile.x() + across.x(), tile.y() + across.y())) {
+            if (runStart == -1)
+                runStart = i;
+            continue;
+        }
+
+        if (runStart == -1)
+            continue;
+
+        int runEnd = i - 1;
+
+        if (runEnd - runStart + 1 < MinDoubleEntranceLength) {
+            addEntrance(cluster, neighbour, first + ((runStart + runEnd) / 2) * step, across, entrances);
+        } else {
+            addEntrance(cluster, neighbour, first + runStart * step, across, entrances);
+            addEntrance(cluster, neighbour, first + runEnd * step, across, entrances);
+        }
+
+        runStart = -1;
+    }
+}
+
+void ClusterGraph::buildEastBorder(int cluster)
+{
+    Cluster &c = mClusters[cluster];
+    clearEntrances(c.eastEntrances);
+
+    if ((cluster % mClustersX) == mClustersX - 1)
+        return;
+
+    int neighbour = cluster + 1;
+    scanBorder(cluster, neighbour, c.area.topRight(), QPoint(0, 1), QPoint(1, 0),
+               c.area.height(), c.eastEntrances);
+
+    markChanged(cluster, EdgesChanged);
+    markChanged(neighbour, EdgesChanged);
+}
+
+void ClusterGraph::buildSouthBorder(int cluster)
+{
+    Cluster &c = mClusters[cluster];
+    clearEntrances(c.southEntrances);
+
+    if (cluster / mClustersX == mClustersY - 1)
+        return;
+
+    int neighbour = cluster + mClustersX;
+    scanBorder(cluster, neighbour, c.area.bottomLeft(), QPoint(1, 0), QPoint(0, 1),
+               c.area.width(), c.southEntrances);
+
+    markChanged(cluster, EdgesChanged);
+    markChanged(neighbour, EdgesChanged);
+}
+
+void ClusterGraph::buildEdges(int cluster, TileSearch *search)
+{
+    const QVector<uint> &nodes = mClusters[cluster].nodes;
+    QVector<QPoint> tiles(nodes.size());
+
+    for (int i = 0; i < nodes.size(); ++i) {
+        mNodes[nodes[i]].edges.clear();
+        tiles[i] = mNodes[nodes[i]].tile;
+    }
+
+    ClusterTile passable(mTileInfo, mRadius, mClusters[cluster].area);
+
+    // Paths are symmetric, so every search only needs to reach the entrances after its start
+    for (int i = 0; i < nodes.size() - 1; ++i) {
+        search->findPath(tiles[i], passable, ReachTiles(tiles, i + 1));
+
+        for (int j = i + 1; j < nodes.size(); ++j) {
+            uint reached = search->expandedNode(tiles[j]);
+            if (reached == TileSearch::NoNode)
+                continue;
+
+            Edge edge;
+            edge.cost = search->costFromStart(reached);
+            edge.target = nodes[j];
+            mNodes[nodes[i]].edges.append(edge);
+            edge.target = nodes[i];
+            mNodes[nodes[j]].edges.append(edge);
+        }
+    }
+}
+
+void ClusterGraph::update(TileSearch *search)
+{
+    if (mChangedClusters.isEmpty())
+        return;
+
+    // Rebuild the borders of clusters whose tiles changed. This also marks their neighbours.
+    QVector<int> changedTiles;
+    foreach (int cluster, mChangedClusters) {
+        if (mClusters[cluster].state == TilesChanged)
+            changedTiles.append(cluster);
+    }
+
+    foreach (int cluster, changedTiles) {
+        buildEastBorder(cluster);
+        buildSouthBorder(cluster);
+
+        int cx = cluster % mClustersX;
+        if (cx > 0 && mClusters[cluster - 1].state != TilesChanged)
+            buildEastBorder(cluster - 1);
+        if (cluster >= mClustersX && mClusters[cluster - mClustersX].state != TilesChanged)
+            buildSouthBorder(cluster - mClustersX);
+    }
+
+    foreach (int cluster, mChangedClusters) {
+        buildEdges(cluster, search);
+        mClusters[cluster].state = Valid;
+    }
+
+    mChangedClusters.clear();
+}
+
+inline void ClusterGraph::relax(uint node, uint parent, uint cost, const QPoint &tile, const QPoint &goal)
+{
+    if (mVisited[node] == mSearchCount && mCosts[node] <= cost)
+        return;
+
+    mVisited[node] = mSearchCount;
+    mCosts[node] = cost;
+    mParents[node] = parent;
+    mOpenSet.push(node, TileSearch::priority(cost + TileSearch::octileDistance(tile, goal), cost));
+}
+
+QVector<ClusterGraph::Edge> ClusterGraph::connect(const QPoint &tile, int cluster, TileSearch *search,
+                                                  const OccupantExclusion *exclusion) const
+{
+    const QVector<uint> &nodes = mClusters[cluster].nodes;
+    QVector<QPoint> tiles(nodes.size());
+    QVector<Edge> result;
+
+    for (int i = 0; i < nodes.size(); ++i)
+        tiles[i] = mNodes[nodes[i]].tile;
+
+    search->findPath(tile, ClusterTile(mTileInfo, mRadius, mClusters[cluster].area, exclusion), ReachTiles(tiles, 0));
+
+    for (int i = 0; i < nodes.size(); ++i) {
+        uint reached = search->expandedNode(tiles[i]);
+        if (reached == TileSearch::NoNode)
+            continue;
+
+        Edge edge;
+        edge.target = nodes[i];
+        edge.cost = search->costFromStart(reached);
+        result.append(edge);
+    }
+
+    return result;
+}
+
+bool ClusterGraph::refine(const QPoint &from, const QPoint &to, int cluster, TileSearch *search,
+                          const OccupantExclusion *exclusion, QVector<QPoint> &tiles) const
+{
+    if (from == to)
+        return true;
+
+    ClusterTile passable(mTileInfo, mRadius, mClusters[cluster].area, exclusion);
+    uint node = search->findPath(from, passable, TileGoal(to));
+
+    if (node == TileSearch::NoNode)
+        return false;
+
+    QVector<QPoint> segment = search->tracePath(node);
+    for (int i = 1; i < segment.size(); ++i)
+        tiles.append(segment[i]);
+
+    return true;
+}
+
+QVector<QPoint> ClusterGraph::findPath(const QPoint &start, const QPoint &goal, TileSearch *search,
+                                       const OccupantExclusion *exclusion)
+{
+    QVector<QPoint> result;
+
+    update(search);
+
+    int startCluster = clusterAt(start);
+    int goalCluster = clusterAt(goal);
+
+    if (startCluster == -1 || goalCluster == -1)
+        return result;
+
+    // A path that stays within the cluster is good enough
+    if (startCluster == goalCluster) {
+        result.append(start);
+        if (refine(start, goal, startCluster, search, exclusion, result))
+            return result;
+        result.clear();
+    }
+
+    QVector<Edge> startEdges = connect(start, startCluster, search, exclusion);
+    if (startEdges.isEmpty())
+        return result;
+
+    QVector<Edge> goalEdges = connect(goal, goalCluster, search, exclusion);
+    if (goalEdges.isEmpty())
+        return result;
+
+    // The start and goal of the query are temporary nodes after all entrances
+    uint startNode = mNodes.size();
+    uint goalNode = startNode + 1;
+    uint nodeCount = goalNode + 1;
+
+    if ((uint)mCosts.size() < nodeCount) {
+        mCosts.resize(nodeCount);
+        mParents.resize(nodeCount);
+        mVisited.resize(nodeCount);
+        mVisited.fill(0);
+        mSearchCount = 0;
+    }
+
+    mSearchCount++;
+    mOpenSet.clear();
+
+    relax(startNode, NoNode, 0, start, goal);
+
+    bool found = false;
+
+    while (!mOpenSet.isEmpty()) {
+        uint current = mOpenSet.pop();
+
+        if (current == goalNode) {
+            found = true;
+            break;
+        }
+
+        uint currentCost = mCosts[current];
+
+        if (current == startNode) {
+            foreach (const Edge &edge, startEdges)
+                relax(edge.target, current, currentCost + edge.cost, mNodes[edge.target].tile, goal);
+            continue;
+        }
+
+        const Node &node = mNodes[current];
+
+        foreach (const Edge &edge, node.edges)
+            relax(edge.target, current, currentCost + edge.cost, mNodes[edge.target].tile, goal);
+
+        relax(node.partner, current, currentCost + TileSearch::StraightCost, mNodes[node.partner].tile, goal);
+
+        if (node.cluster == goalCluster) {
+            foreach (const Edge &edge, goalEdges) {
+                if (edge.target == current)
+                    relax(goalNode, current, currentCost + edge.cost, goal, goal);
+            }
+        }
+    }
+
+    if (!found)
+        return result;
+
+    // Collect the abstract path backwards
+    QVector<uint> abstractPath;
+    for (uint node = mParents[goalNode]; node != startNode; node = mParents[node])
+        abstractPath.prepend(node);
+
+    // Refine each step of the abstract path into tiles
+    result.append(start);
+
+    QPoint previousTile = start;
+    int previousCluster = startCluster;
+
+    foreach (uint node, abstractPath) {
+        const Node &entrance = mNodes[node];
+
+        if (entrance.cluster != previousCluster) {
+            // Crossing a border from one entrance to its partner
+            result.append(entrance.tile);
+        } else if (!refine(previousTile, entrance.tile, entrance.cluster, search, exclusion, result)) {
+            qWarning("Unable to refine the path between two connected entrances.");
+            return QVector<QPoint>();
+        }
+
+        previousTile = entrance.tile;
+        previousCluster = entrance.cluster;
+    }
+
+    if (!refine(previousTile, goal, goalCluster, search, exclusion, result)) {
+        qWarning("Unable to refine the path to the goal.");
+        return QVector<QPoint>();
+    }
+
+    return result;
+}
+
+}
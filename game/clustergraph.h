@@ -0,0 +1,139 @@
+#ifndef CLUSTERGRAPH_H
+#define CLUSTERGRAPH_H
+
+#include <QtCore/QPoint>
+#include <QtCore/QRect>
+#include <QtCore/QVector>
+
+#include "binaryheap.h"
+
+namespace EvilTemple {
+
+class TileInfo;
+class TileSearch;
+struct OccupantExclusion;
+
+/**
+  The abstract graph used for hierarchical pathfinding (HPA*) by actors of one size.
+
+  The map is divided into square clusters that are aligned with the sectors of the map. Wherever
+  two neighbouring clusters are connected, a pair of entrance nodes is placed on both sides of
+  their shared border, and the cost of moving between the entrances of a cluster is precomputed.
+  A search only has to explore these entrances, and only the route it finds is refined into tiles,
+  using searches that never leave a single cluster.
+
+  The whole abstract route is refined right away rather than segment by segment while the actor
+  walks. Paths are cached, smoothed and handed to the scripts as complete lists of positions, and
+  since every refinement stays within one cluster, refining the full route costs time linear in the
+  number of clusters it crosses.
+
+  Clusters are built on first use. Clusters whose tiles change are rebuilt before the next search,
+  together with the entrances on their borders.
+  */
+class ClusterGraph
+{
+public:
+    enum {
+        ClusterSize = 64 // A sector is three clusters wide
+    };
+
+    ClusterGraph(const TileInfo *tileInfo, int radius);
+
+    /**
+      Marks all clusters as changed that may contain tiles whose passability is affected by
+      blocked tiles changing in the given area.
+      */
+    void invalidate(const QRect &area);
+
+    /**
+      Finds a path between two tiles, which the actor has to be able to stand on.
+
+      @param exclusion If given, the searches within clusters ignore this occupant. The abstract graph
+                       still treats it as an obstacle.
+      @return The tiles along the path (both inclusive) or an empty vector if the goal is unreachable.
+      */
+    QVector<QPoint> findPath(const QPoint &start, const QPoint &goal, TileSearch *search,
+                             const OccupantExclusion *exclusion = NULL);
+
+    /**
+      The number of entrance nodes in the graph.
+      */
+    int nodeCount() const;
+
+private:
+    static const uint NoNode = 0xFFFFFFFF;
+
+    struct Edge {
+        uint target;
+        uint cost;
+    };
+
+    struct Node {
+        QPoint tile;
+        int cluster; // -1 if this node is unused
+        uint partner; // The entrance on the other side of the border
+        QVector<Edge> edges; // The other entrances of the same cluster
+    };
+
+    enum ClusterState {
+        Valid,
+        EdgesChanged, // Only the entrances of the cluster changed
+        TilesChanged
+    };
+
+    struct Cluster {
+        QRect area;
+        ClusterState state;
+        QVector<uint> nodes;
+        QVector<uint> eastEntrances; // Nodes of this cluster that lead to the eastern neighbour
+        QVector<uint> southEntrances; // Nodes of this cluster that lead to the southern neighbour
+    };
+
+    void update(TileSearch *search);
+    void buildEastBorder(int cluster);
+    void buildSouthBorder(int cluster);
+    void clearEntrances(QVector<uint> &entrances);
+    void scanBorder(int cluster, int neighbour, const QPoint &first, const QPoint &step,
+                    const QPoint &across, int length, QVector<uint> &entrances);
+    void addEntrance(int cluster, int neighbour, const QPoint &tile, const QPoint &across,
+                     QVector<uint> &entrances);
+    uint createNode(int cluster, const QPoint &tile);
+    void removeNode(uint node);
+    void markChanged(int cluster, ClusterState state);
+    void buildEdges(int cluster, TileSearch *search);
+    void relax(uint node, uint parent, uint cost, const QPoint &tile, const QPoint &goal);
+    QVector<Edge> connect(const QPoint &tile, int cluster, TileSearch *search,
+                          const OccupantExclusion *exclusion) const;
+    bool refine(const QPoint &from, const QPoint &to, int cluster, TileSearch *search,
+                const OccupantExclusion *exclusion, QVector<QPoint> &tiles) const;
+    int clusterAt(const QPoint &tile) const;
+    bool isPassable(int x, int y) const;
+
+    const TileInfo *mTileInfo;
+    int mRadius;
+
+    QPoint mOrigin;
+    int mClustersX;
+    int mClustersY;
+    QVector<Cluster> mClusters;
+    QVector<int> mChangedClusters;
+
+    QVector<Node> mNodes;
+    QVector<uint> mFreeNodes;
+
+    // State of the abstract search, indexed by node. The start and goal of a query are appended.
+    QVector<uint> mCosts;
+    QVector<uint> mParents;
+    QVector<uint> mVisited; // The search that last visited a node
+    uint mSearchCount;
+    IndexedBinaryHeap<quint64> mOpenSet;
+};
+
+inline int ClusterGraph::nodeCount() const
+{
+    return mNodes.size() - mFreeNodes.size();
+}
+
+}
+
+#endif // CLUSTERGRAPH_H
@@ -0,0 +1,315 @@
+
+#include <QtCore/QHash>
+
+#include "componentmap.h"
+#include "tileinfo.h"
+
+namespace EvilTemple {
+
+// Components are connected the same way searches move, including diagonals
+static const int offsetX[8] = { -1, 1, 1, -1, 0, 0, 1, -1 };
+static const int offsetY[8] = { -1, -1, 1, 1, -1, 1, 0, 0 };
+
+ComponentMap::ComponentMap(const TileInfo *tileInfo, int radius)
+    : mTileInfo(tileInfo), mRadius(radius), mVisitBase(0)
+{
+    mExtent = tileInfo->clearanceMap().extent();
+    build();
+}
+
+bool ComponentMap::isPassable(int x, int y) const
+{
+    return mTileInfo->canStandOnTile(x, y, mRadius);
+}
+
+quint16 ComponentMap::createLabel()
+{
+    if (mParents.size() > 0xFFFF)
+        return 0;
+
+    quint16 label = mParents.size();
+    mParents.append(label);
+    mRanks.append(0);
+    return label;
+}
+
+quint16 ComponentMap::unite(quint16 a, quint16 b)
+{
+    a = find(a);
+    b = find(b);
+
+    if (a == b)
+        return a;
+
+    if (mRanks[a] < mRanks[b])
+        qSwap(a, b);
+    else if (mRanks[a] == mRanks[b])
+        mRanks[a]++;
+
+    mParents[b] = a;
+    return a;
+}
+
+void ComponentMap::build()
+{
+    mLabels.fill(0, mExtent.width() * mExtent.height());
+    mVisited.fill(0, mLabels.size());
+    mVisitBase = 0;
+
+    // Label 0 marks tiles that can't be stood on
+    mParents.resize(1);
+    mParents[0] = 0;
+    mRanks.resize(1);
+    mRanks[0] = 0;
+
+    for (int y = mExtent.top(); y <= mExtent.bottom(); ++y) {
+        for (int x = mExtent.left(); x <= mExtent.right(); ++x) {
+            int index = indexOf(x, y);
+
+            if (mLabels[index] || !isPassable(x, y))
+                continue;
+
+            quint16 label = createLabel();
+
+            if (!label) {
+                qWarning("The map has too many separate walkable areas to label them all.");
+                return;
+            }
+
+            flood(index, label);
+        }
+    }
+}
+
+void ComponentMap::flood(int index, quint16 label)
+{
+    QVector<int> stack;
+    stack.append(index);
+    mLabels[index] = label;
+
+    while (!stack.isEmpty()) {
+        QPoint tile = tileAt(stack.last());
+        stack.resize(stack.size() - 1);
+
+        for (int i = 0; i < 8; ++i) {
+            int x = tile.x() + offsetX[i];
+            int y = tile.y() + offsetY[i];
+
+            if (!mExtent.contains(x, y))
+                continue;
+
+            int neighbour = indexOf(x, y);
+
+            if (mLabels[neighbour] || !isPassable(x, y))
+                continue;
+
+            mLabels[neighbour] = label;
+            stack.append(neighbour);
+        }
+    }
+}
+
+void ComponentMap::update(const QRect &area)
+{
+    // Only tiles within the actor's radius of a changed tile can change their passability
+    QRect window = area.adjusted(-mRadius, -mRadius, mRadius, mRadius).intersected(mExtent);
+
+    if (window.isEmpty())
+        return;
+
+    /*
+      The ring of unchanged tiles around the window connects the window to the rest of its
+      components. Parts of the window are labelled by flooding them, and the labels of the ring
+      tiles they touch tell which components they belong to.
+     */
+    QRect region = window.adjusted(-1, -1, 1, 1).intersected(mExtent);
+    int width = region.width();
+
+    QVector<uchar> passable(width * region.height());
+    QVector<int> pieces(passable.size(), -1);
+
+    for (int y = region.top(); y <= region.bottom(); ++y) {
+        for (int x = region.left(); x <= region.right(); ++x) {
+            int local = (y - region.top()) * width + (x - region.left());
+            if (window.contains(x, y))
+                passable[local] = isPassable(x, y);
+            else
+                passable[local] = mLabels[indexOf(x, y)] != 0;
+        }
+    }
+
+    QVector<quint16> pieceLabels;
+    QVector<int> pieceSeeds; // A ring tile of every piece or -1
+    QVector<int> stack;
+
+    for (int start = 0; start < passable.size(); ++start) {
+        if (!passable[start] || pieces[start] != -1)
+            continue;
+
+        int piece = pieceLabels.size();
+        quint16 label = 0;
+        int seed = -1;
+
+        pieces[start] = piece;
+        stack.append(start);
+
+        while (!stack.isEmpty()) {
+            int local = stack.last();
+            stack.resize(stack.size() - 1);
+
+            int x = region.left() + local % width;
+            int y = region.top() + local / width;
+
+            if (!window.contains(x, y)) {
+                // A ring tile, so the piece belongs to the ring tile's component
+                int index = indexOf(x, y);
+                label = label ? unite(label, mLabels[index]) : find(mLabels[index]);
+                if (seed == -1)
+                    seed = index;
+            }
+
+            for (int i = 0; i < 8; ++i) {
+                int nx = x + offsetX[i];
+                int ny = y + offsetY[i];
+
+                if (!region.contains(nx, ny))
+                    continue;
+
+                int neighbour = (ny - region.top()) * width + (nx - region.left());
+
+                if (passable[neighbour] && pieces[neighbour] == -1) {
+                    pieces[neighbour] = piece;
+                    stack.append(neighbour);
+                }
+            }
+        }
+
+        // Pieces that don't touch the ring are cut off from everything else
+        if (!label) {
+            label = createLabel();
+            if (!label) {
+                build();
+                return;
+            }
+        }
+
+        pieceLabels.append(label);
+        pieceSeeds.append(seed);
+    }
+
+    for (int y = window.top(); y <= window.bottom(); ++y) {
+        for (int x = window.left(); x <= window.right(); ++x) {
+            int piece = pieces[(y - region.top()) * width + (x - region.left())];
+            mLabels[indexOf(x, y)] = (piece == -1) ? 0 : find(pieceLabels[piece]);
+        }
+    }
+
+    // A component that is touched by more than one piece may have been split by the change
+    QHash<quint16, QVector<int> > seedsByComponent;
+
+    for (int i = 0; i < pieceLabels.size(); ++i) {
+        if (pieceSeeds[i] != -1)
+            seedsByComponent[find(pieceLabels[i])].append(pieceSeeds[i]);
+    }
+
+    foreach (const QVector<int> &seeds, seedsByComponent) {
+        if (seeds.size() > 1 && !split(seeds)) {
+            build();
+            return;
+        }
+    }
+}
+
+/**
+  Floods a component from several tiles at once, one tile per part and round, until the parts
+  have either met or run out of tiles. Parts that run out of tiles are cut off from the rest and
+  receive a new label. The last remaining part keeps the label it has, which means the largest part
+  is never flooded entirely.
+  */
+bool ComponentMap::split(const QVector<int> &seeds)
+{
+    int parts = seeds.size();
+
+    if (mVisitBase > 0xFFFFFFFF - parts) {
+        mVisited.fill(0);
+        mVisitBase = 0;
+    }
+
+    // Tiles visited by this check are marked with base + 1 + part
+    uint base = mVisitBase;
+    mVisitBase += parts;
+
+    QVector<int> mergedInto(parts);
+    QVector<QVector<int> > queues(parts);
+    QVector<int> heads(parts);
+
+    for (int i = 0; i < parts; ++i) {
+        mergedInto[i] = i;
+        heads[i] = 0;
+        queues[i].append(seeds[i]);
+        mVisited[seeds[i]] = base + 1 + i;
+    }
+
+    int active = parts;
+
+    while (active > 1) {
+        for (int part = 0; part < parts && active > 1; ++part) {
+            if (mergedInto[part] != part || heads[part] == -1)
+                continue;
+
+            QVector<int> &queue = queues[part];
+
+            if (heads[part] == queue.size()) {
+                quint16 label = createLabel();
+                if (!label)
+                    return false;
+
+                foreach (int index, queue)
+                    mLabels[index] = label;
+
+                queue.clear();
+                heads[part] = -1;
+                active--;
+                continue;
+            }
+
+            QPoint tile = tileAt(queue[heads[part]++]);
+
+            for (int i = 0; i < 8; ++i) {
+                int x = tile.x() + offsetX[i];
+                int y = tile.y() + offsetY[i];
+
+                if (!mExtent.contains(x, y))
+                    continue;
+
+                int neighbour = indexOf(x, y);
+
+                if (!mLabels[neighbour])
+                    continue;
+
+                if (mVisited[neighbour] <= base) {
+                    mVisited[neighbour] = base + 1 + part;
+                    queue.append(neighbour);
+                    continue;
+                }
+
+                int other = mVisited[neighbour] - base - 1;
+                while (mergedInto[other] != other)
+                    other = mergedInto[other];
+
+                if (other == part)
+                    continue;
+
+                // The parts met, continue flooding them as one
+                queue += queues[other];
+                queues[other].clear();
+                mergedInto[other] = part;
+                active--;
+            }
+        }
+    }
+
+    return true;
+}
+
+}
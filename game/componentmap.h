@@ -0,0 +1,99 @@
+#ifndef COMPONENTMAP_H
+#define COMPONENTMAP_H
+
+#include <QtCore/QPoint>
+#include <QtCore/QRect>
+#include <QtCore/QVector>
+
+namespace EvilTemple {
+
+class TileInfo;
+
+/**
+  Labels the connected areas of a map that an actor of a given size can move in.
+
+  Two tiles with the same label are connected, so a path request between tiles with different
+  labels can be rejected without searching. Labels are merged using union-find when tiles become
+  passable. When tiles become blocked, only the components around the change are checked for
+  splits, by flooding all parts of a component at the same time until they meet again. Only the
+  parts that are actually cut off are relabelled.
+  */
+class ComponentMap
+{
+public:
+    ComponentMap(const TileInfo *tileInfo, int radius);
+
+    /**
+      Returns the component of a tile or 0 if the actor can't stand on the tile.
+      */
+    uint component(const QPoint &tile) const;
+
+    /**
+      Checks whether an actor can move from one tile to another.
+      */
+    bool isConnected(const QPoint &from, const QPoint &to) const;
+
+    /**
+      Updates the components after blocked tiles changed in the given area.
+      */
+    void update(const QRect &area);
+
+private:
+    void build();
+    void flood(int index, quint16 label);
+    bool split(const QVector<int> &seeds);
+    quint16 createLabel();
+    quint16 find(quint16 label) const;
+    quint16 unite(quint16 a, quint16 b);
+
+    bool isPassable(int x, int y) const;
+    int indexOf(int x, int y) const;
+    QPoint tileAt(int index) const;
+
+    const TileInfo *mTileInfo;
+    int mRadius;
+
+    QRect mExtent;
+    QVector<quint16> mLabels; // Raw label of every tile, resolve using find()
+    QVector<quint16> mParents; // Union-find forest over the labels
+    QVector<uchar> mRanks;
+
+    // Marks the tiles visited by split checks, see split()
+    QVector<uint> mVisited;
+    uint mVisitBase;
+};
+
+inline int ComponentMap::indexOf(int x, int y) const
+{
+    return (y - mExtent.top()) * mExtent.width() + (x - mExtent.left());
+}
+
+inline QPoint ComponentMap::tileAt(int index) const
+{
+    return QPoint(mExtent.left() + index % mExtent.width(), mExtent.top() + index / mExtent.width());
+}
+
+inline quint16 ComponentMap::find(quint16 label) const
+{
+    while (mParents[label] != label)
+        label = mParents[label];
+    return label;
+}
+
+inline uint ComponentMap::component(const QPoint &tile) const
+{
+    if (!mExtent.contains(tile))
+        return 0;
+
+    return find(mLabels[indexOf(tile.x(), tile.y())]);
+}
+
+inline bool ComponentMap::isConnected(const QPoint &from, const QPoint &to) const
+{
+    uint component = this->component(from);
+    return component != 0 && component == this->component(to);
+}
+
+}
+
+#endif // COMPONENTMAP_H
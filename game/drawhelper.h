@@ -5,6 +5,7 @@
 #include "materialstate.h"
 #include "renderstates.h"
 #include "util.h"
+#include "glstate.h"
 
 #include "lighting.h"
 
@@ -48,29 +49,32 @@ public:
             }
 
             // Bind attributes
+            uint attributeMask = 0;
             for (int j = 0; j < pass.attributes.size(); ++j) {
                 MaterialPassAttributeState &attribute = pass.attributes[j];
 
                 GLint bufferId = bufferSource.buffer(attribute);
 
-                SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, bufferId));
-
-                // Assign the attribute
-                SAFE_GL(glEnableVertexAttribArray(attribute.location));
-                SAFE_GL(glVertexAttribPointer(attribute.location,
-                                                attribute.binding.components(),
-                                                attribute.binding.type(),
-                                                attribute.binding.normalized(),
-                                                attribute.binding.stride(),
-                                                (GLvoid*)attribute.binding.offset()));
-
+                GLState::vertexAttribPointer(attribute.location,
+                                             bufferId,
+                                             attribute.binding.components(),
+                                             attribute.binding.type(),
+                                             attribute.binding.normalized(),
+                                             attribute.binding.stride(),
+                                             attribute.binding.offset());
+                attributeMask |= 1 << attribute.location;
             }
-            SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, 0)); // Unbind any previously bound buffers
+            GLState::enableVertexAttribArrays(attributeMask);
+
+            // Unbind any previously bound buffers
+            if (!GLState::isCaching())
+                GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
 
             // Set render states
             foreach (const SharedMaterialRenderState &state, pass.renderStates) {
                 state->enable();
             }
+            GLState::flush();
 
             // Draw the actual model
             drawer.draw(renderStates, pass);
@@ -80,16 +84,17 @@ public:
                 state->disable();
             }
 
+            // While caching, the bindings are kept for the next draw and reset by GLState::endCaching()
+            if (GLState::isCaching())
+                continue;
+
             // Unbind textures
             for (int j = 0; j < pass.textureSamplers.size(); ++j) {
                 pass.textureSamplers[j].unbind();
             }
 
             // Unbind attributes
-            for (int j = 0; j < pass.attributes.size(); ++j) {
-                MaterialPassAttributeState &attribute = pass.attributes[j];
-                SAFE_GL(glDisableVertexAttribArray(attribute.location));
-            }
+            GLState::disableVertexAttribArrays(attributeMask);
 
             pass.program->unbind();
         }
@@ -147,7 +152,7 @@ struct ModelDrawStrategy : public DrawStrategy {
         // Render once without diffuse/specular, then render again without ambient
         int typePos = state.program->uniformLocation("lightSourceType");
         if (!renderStates.activeLights().isEmpty() && typePos != -1) {
-            SAFE_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mBufferId));
+            GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mBufferId);
 
             typePos = state.program->uniformLocation("lightSourceType");
             int colorPos = state.program->uniformLocation("lightSourceColor");
@@ -189,25 +194,27 @@ struct ModelDrawStrategy : public DrawStrategy {
                 SAFE_GL(glUniform4fv(positionPos, MaxLightsPerPass, (GLfloat*)position));
                 SAFE_GL(glUniform1fv(attenuationPos, MaxLightsPerPass, (GLfloat*)attenuation));
 
+                GLState::flush();
                 SAFE_GL(glDrawElements(GL_TRIANGLES, mElementCount, GL_UNSIGNED_SHORT, 0));
 
                 if (first && i + 1 < renderStates.activeLights().size()) {
-                    SAFE_GL(glDepthFunc(GL_LEQUAL));
-                    SAFE_GL(glEnable(GL_CULL_FACE));
+                    GLState::depthFunc(GL_LEQUAL);
+                    GLState::enable(GL_CULL_FACE);
 
-                    SAFE_GL(glEnable(GL_BLEND));
-                    SAFE_GL(glBlendFunc(GL_SRC_ALPHA, GL_ONE));
+                    GLState::enable(GL_BLEND);
+                    GLState::blendFunc(GL_SRC_ALPHA, GL_ONE);
                 }
                 first = false;
             }
 
-            SAFE_GL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+            GLState::blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-            SAFE_GL(glDepthFunc(GL_LESS));
+            GLState::depthFunc(GL_LESS);
         } else {
-            SAFE_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mBufferId));
+            GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mBufferId);
             SAFE_GL(glDrawElements(GL_TRIANGLES, mElementCount, GL_UNSIGNED_SHORT, 0));
-            SAFE_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+            if (!GLState::isCaching())
+                GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
         }
     }
 
@@ -0,0 +1,159 @@
+
+#include "flowfield.h"
+#include "tileinfo.h"
+#include "tilesearch.h"
+#include "binaryheap.h"
+
+namespace EvilTemple {
+
+// Neighbours in the same order as searches use them, diagonals first
+static const int offsetX[8] = { -1, 1, 1, -1, 0, 0, 1, -1 };
+static const int offsetY[8] = { -1, -1, 1, 1, -1, 1, 0, 0 };
+static const uchar opposite[8] = { 2, 3, 0, 1, 5, 4, 7, 6 };
+
+const uint FlowField::NoCost;
+
+FlowField::FlowField(const TileInfo *tileInfo, int radius, const QVector<QPoint> &goals, int range, uint maxCost)
+    : mTileInfo(tileInfo), mRadius(radius), mGoals(goals), mRange(range), mMaxCost(maxCost),
+    mExcludedRadius(-1), mOutdated(true)
+{
+    const QRect &extent = tileInfo->clearanceMap().extent();
+
+    if (maxCost && !goals.isEmpty()) {
+        QRect goalBounds(goals.first(), QSize(1, 1));
+        foreach (const QPoint &goal, goals)
+            goalBounds |= QRect(goal, QSize(1, 1));
+
+        // A straight step is the cheapest way to move away from the goals
+        int reach = range + maxCost / TileSearch::StraightCost;
+        mBounds = goalBounds.adjusted(-reach, -reach, reach, reach).intersected(extent);
+    } else {
+        mBounds = extent;
+    }
+}
+
+void FlowField::excludeOccupant(const QPoint &center, int occupantRadius)
+{
+    mExcludedCenter = center;
+    mExcludedRadius = occupantRadius;
+    mOutdated = true;
+}
+
+void FlowField::invalidate(const QRect &area)
+{
+    // Blocked tiles change whether actors can stand on the tiles within their radius
+    if (!mOutdated && area.adjusted(-mRadius, -mRadius, mRadius, mRadius).intersects(mBounds))
+        mOutdated = true;
+}
+
+void FlowField::update()
+{
+    if (mOutdated) {
+        build();
+        mOutdated = false;
+    }
+}
+
+bool FlowField::isPassable(int x, int y, const OccupantExclusion &exclusion) const
+{
+    if (exclusion.contains(x, y))
+        return exclusion.canStand(x, y);
+    return mTileInfo->canStandOnTile(x, y, mRadius);
+}
+
+void FlowField::build()
+{
+    mCosts.fill(NoCost, mBounds.width() * mBounds.height());
+    mDirections.fill(NoDirection, mCosts.size());
+
+    if (mCosts.isEmpty())
+        return;
+
+    // The standability around the excluded occupant has to be as up to date as the rest of the field
+    OccupantExclusion exclusion;
+    if (mExcludedRadius >= 0)
+        exclusion = mTileInfo->excludeOccupant(mExcludedCenter, mExcludedRadius, mRadius);
+
+    IndexedBinaryHeap<uint> openSet;
+    int sqrange = mRange * mRange;
+
+    // Every tile in range of a goal is a goal itself
+    foreach (const QPoint &goal, mGoals) {
+        for (int y = -mRange; y <= mRange; ++y) {
+            for (int x = -mRange; x <= mRange; ++x) {
+                QPoint tile = goal + QPoint(x, y);
+
+                if (x * x + y * y > sqrange || !mBounds.contains(tile) || !isPassable(tile.x(), tile.y(), exclusion))
+                    continue;
+
+                int index = indexOf(tile.x(), tile.y());
+
+                if (mCosts[index] != 0) {
+                    mCosts[index] = 0;
+                    mDirections[index] = GoalDirection;
+                    openSet.push(index, 0);
+                }
+            }
+        }
+    }
+
+    int width = mBounds.width();
+
+    while (!openSet.isEmpty()) {
+        uint current = openSet.pop();
+        int x = mBounds.left() + current % width;
+        int y = mBounds.top() + current / width;
+        uint currentCost = mCosts[current];
+
+        for (int i = 0; i < 8; ++i) {
+            int nx = x + offsetX[i];
+            int ny = y + offsetY[i];
+
+            uint cost = currentCost + ((i < 4) ? TileSearch::DiagonalCost : TileSearch::StraightCost);
+
+            if ((mMaxCost && cost > mMaxCost) || !mBounds.contains(nx, ny))
+                continue;
+
+            int neighbour = indexOf(nx, ny);
+
+            if (mCosts[neighbour] <= cost || mDirections[neighbour] == BlockedDirection)
+                continue;
+
+            // Tiles are only checked for passability the first time they are reached
+            if (mDirections[neighbour] == NoDirection && !isPassable(nx, ny, exclusion)) {
+                mDirections[neighbour] = BlockedDirection;
+                continue;
+            }
+
+            // Moving along the opposite offset leads back to the current tile
+            mCosts[neighbour] = cost;
+            mDirections[neighbour] = opposite[i];
+            openSet.push(neighbour, cost);
+        }
+    }
+}
+
+QVector<QPoint> FlowField::trace(const QPoint &tile) const
+{
+    QVector<QPoint> result;
+
+    if (cost(tile) == NoCost)
+        return result;
+
+    QPoint current = tile;
+
+    forever {
+        result.append(current);
+
+        uchar direction = mDirections[indexOf(current.x(), current.y())];
+
+        if (direction == GoalDirection)
+            break;
+
+        current += QPoint(offsetX[direction], offsetY[direction]);
+    }
+
+    return result;
+}
+
+}
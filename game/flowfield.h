@@ -0,0 +1,148 @@
+#ifndef FLOWFIELD_H
+#define FLOWFIELD_H
+
+#include <QtCore/QPoint>
+#include <QtCore/QRect>
+#include <QtCore/QVector>
+
+namespace EvilTemple {
+
+class TileInfo;
+struct OccupantExclusion;
+
+/**
+  The cost of reaching the closest of several goals from every tile around them, together with the
+  direction to move in to get there. Any number of actors of the same size can follow the field to
+  the goals, using the result of a single search.
+
+  The field is computed by a Dijkstra expansion from all tiles in range of the goals, which stops
+  at the maximum cost. Since moving is equally expensive in both directions, the field of a single
+  goal also tells which tiles an actor standing on the goal can reach within the maximum cost.
+
+  The field is computed by the first call to update(). It becomes outdated when blocked tiles change
+  within its bounds, and is only recomputed when it is updated again.
+  */
+class FlowField
+{
+public:
+    static const uint NoCost = 0xFFFFFFFF;
+
+    /**
+      @param goals The tiles to move to.
+      @param range Tiles within this distance (in tiles) of a goal are goals as well.
+      @param maxCost The expansion stops at tiles with a higher cost (see TileSearch for the cost of
+                     a step). 0 expands over the entire map.
+      */
+    FlowField(const TileInfo *tileInfo, int radius, const QVector<QPoint> &goals, int range, uint maxCost);
+
+    const QVector<QPoint> &goals() const;
+    int radius() const;
+    int range() const;
+    uint maxCost() const;
+
+    /**
+      Makes the field ignore an occupant, usually the actor standing on the goal. Otherwise the actor
+      would block itself in.
+      */
+    void excludeOccupant(const QPoint &center, int occupantRadius);
+
+    /**
+      The radius of the excluded occupant or -1 if no occupant is excluded.
+      */
+    int excludedRadius() const;
+    const QPoint &excludedCenter() const;
+
+    /**
+      Marks the field as outdated if blocked tiles in the given area may change it.
+      */
+    void invalidate(const QRect &area);
+
+    /**
+      Recomputes the field if it is outdated.
+      */
+    void update();
+
+    /**
+      Returns the cost of moving from a tile to the closest goal or NoCost if the tile wasn't reached.
+      */
+    uint cost(const QPoint &tile) const;
+
+    /**
+      Returns the tiles from a tile to the closest goal (both inclusive) by following the field.
+      The result is empty if the tile wasn't reached.
+      */
+    QVector<QPoint> trace(const QPoint &tile) const;
+
+private:
+    enum {
+        GoalDirection = 8,
+        BlockedDirection = 9,
+        NoDirection = 0xFF
+    };
+
+    void build();
+    bool isPassable(int x, int y, const OccupantExclusion &exclusion) const;
+    int indexOf(int x, int y) const;
+
+    const TileInfo *mTileInfo;
+    int mRadius;
+    QVector<QPoint> mGoals;
+    int mRange;
+    uint mMaxCost;
+
+    QPoint mExcludedCenter;
+    int mExcludedRadius;
+
+    QRect mBounds; // No tile outside of these can be reached within the maximum cost
+    bool mOutdated;
+
+    QVector<uint> mCosts;
+    QVector<uchar> mDirections; // The neighbour to move to next, see offsetX/offsetY
+};
+
+inline const QVector<QPoint> &FlowField::goals() const
+{
+    return mGoals;
+}
+
+inline int FlowField::radius() const
+{
+    return mRadius;
+}
+
+inline int FlowField::range() const
+{
+    return mRange;
+}
+
+inline uint FlowField::maxCost() const
+{
+    return mMaxCost;
+}
+
+inline int FlowField::excludedRadius() const
+{
+    return mExcludedRadius;
+}
+
+inline const QPoint &FlowField::excludedCenter() const
+{
+    return mExcludedCenter;
+}
+
+inline int FlowField::indexOf(int x, int y) const
+{
+    return (y - mBounds.top()) * mBounds.width() + (x - mBounds.left());
+}
+
+inline uint FlowField::cost(const QPoint &tile) const
+{
+    if (!mBounds.contains(tile))
+        return NoCost;
+
+    return mCosts[indexOf(tile.x(), tile.y())];
+}
+
+}
+
+#endif // FLOWFIELD_H
@@ -5,7 +5,16 @@
 #include "fogofwar.h"
 #include "pathfinder.h"
 
+#include <common/fieldofview.h>
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QHash>
 #include <QPointer>
+#include <QVector>
+#include <qmath.h>
+
+#include <algorithm>
 
 namespace EvilTemple {
 
@@ -14,40 +23,153 @@ const uint SectorSidelength = 192;
 const uint SectorsPerAxis = 15;
 const float TileSidelength = 28.2842703f / 3.0f;
 
+const uint TextureSidelength = 256;
+
+/**
+  The fog of a sector. Every tile has two bits: whether it has ever been seen (explored) and
+  whether it was seen since the visible tiles were last faded. The texture is only updated
+  within the rectangle of tiles that changed since the last upload.
+  */
 struct FogSectorBitmap {
 
-    unsigned char bitfield[256*256];
+    enum {
+        Explored = 1,
+        Visible = 2
+    };
+
+    // The fog drawn over the tiles by state
+    static const uchar UnexploredFog = 0xFF;
+    static const uchar ExploredFog = 0x80;
+    static const uchar VisibleFog = 0;
+
+    uchar bitfield[TextureSidelength * TextureSidelength / 4];
+
+    QRect dirtyRect;
 
-    bool textureDirty;
+    QRect visibleRect; // Bounds of the tiles that are visible
 
     uint texture;
 
+    uint state(int x, int y) const {
+        int index = y * TextureSidelength + x;
+        return (bitfield[index >> 2] >> ((index & 3) * 2)) & 3;
+    }
+
+    void setState(int x, int y, uint state) {
+        int index = y * TextureSidelength + x;
+        int shift = (index & 3) * 2;
+        uchar &bits = bitfield[index >> 2];
+
+        if (((bits >> shift) & 3) != state) {
+            bits = (bits & ~(3 << shift)) | (state << shift);
+            dirtyRect |= QRect(x, y, 1, 1);
+        }
+    }
+
     void fogAll() {
-        memset(bitfield, 0xFF, sizeof(bitfield));
-        textureDirty = true;
+        memset(bitfield, 0, sizeof(bitfield));
+        dirtyRect = QRect(0, 0, TextureSidelength, TextureSidelength);
+        visibleRect = QRect();
     }
 
     void revealAll() {
-        memset(bitfield, 0, sizeof(bitfield));
-        textureDirty = true;
+        memset(bitfield, 0xFF, sizeof(bitfield));
+        dirtyRect = QRect(0, 0, TextureSidelength, TextureSidelength);
+        visibleRect = dirtyRect;
     }
 
-    bool isRevealed(int x, int y) {
-        return bitfield[y * 256 + x] == 0;
+    /**
+      Turns the visible tiles into explored tiles.
+      */
+    void fadeVisible() {
+        for (int y = visibleRect.top(); y <= visibleRect.bottom(); ++y)
+            for (int x = visibleRect.left(); x <= visibleRect.right(); ++x)
+                if (state(x, y) & Visible)
+                    setState(x, y, Explored);
+
+        visibleRect = QRect();
+    }
+
+    bool isRevealed(int x, int y) const {
+        return (state(x, y) & Explored) != 0;
+    }
+
+    bool isVisible(int x, int y) const {
+        return (state(x, y) & Visible) != 0;
     }
 
     void unreveal(int x, int y) {
-        if (!bitfield[y * 256 + x]) {
-            bitfield[y * 256 + x] = 0xFF;
-            textureDirty = true;
-        }
+        setState(x, y, 0);
     }
 
     void reveal(int x, int y) {
-        if (bitfield[y * 256 + x]) {
-            bitfield[y * 256 + x] = 0;
-            textureDirty = true;
+        setState(x, y, Explored | Visible);
+        visibleRect |= QRect(x, y, 1, 1);
+    }
+
+    void hide(int x, int y) {
+        if (isVisible(x, y))
+            setState(x, y, Explored);
+    }
+
+    /**
+      Writes which tiles are explored, run-length encoded per row. Every row alternates between
+      runs of unexplored and explored tiles, starting with unexplored ones. Runs are at most 255
+      tiles long, longer runs are split by an empty run of the other kind.
+      */
+    void saveExplored(QDataStream &stream) const {
+        for (int y = 0; y < TextureSidelength; ++y) {
+            bool explored = false;
+            int x = 0;
+
+            while (x < TextureSidelength) {
+                int run = 0;
+                while (x + run < TextureSidelength && run < 255 && isRevealed(x + run, y) == explored)
+                    ++run;
+
+                stream << (quint8)run;
+                x += run;
+                explored = !explored;
+            }
+        }
+    }
+
+    /**
+      Reads the explored tiles written by saveExplored. Visible tiles become unexplored or explored.
+      @param apply If false, the runs are only checked, without changing the fog.
+      @return False if the runs don't describe the sector.
+      */
+    bool loadExplored(QDataStream &stream, bool apply) {
+        if (apply)
+            memset(bitfield, 0, sizeof(bitfield));
+
+        for (int y = 0; y < TextureSidelength; ++y) {
+            bool explored = false;
+            int x = 0;
+
+            while (x < TextureSidelength) {
+                quint8 run;
+                stream >> run;
+
+                if (stream.status() != QDataStream::Ok || x + run > TextureSidelength)
+                    return false;
+
+                if (apply && explored) {
+                    for (int i = y * TextureSidelength + x; i < y * TextureSidelength + x + run; ++i)
+                        bitfield[i >> 2] |= Explored << ((i & 3) * 2);
+                }
+
+                x += run;
+                explored = !explored;
+            }
         }
+
+        if (apply) {
+            dirtyRect = QRect(0, 0, TextureSidelength, TextureSidelength);
+            visibleRect = QRect();
+        }
+
+        return true;
     }
 
     void makeTexture() {
@@ -57,16 +179,49 @@ struct FogSectorBitmap {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // Allocate the texture, its content is uploaded by the first update
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, TextureSidelength, TextureSidelength, 0, GL_LUMINANCE,
+                     GL_UNSIGNED_BYTE, NULL);
+        dirtyRect = QRect(0, 0, TextureSidelength, TextureSidelength);
     }
 
-    void updateTexture() {
-        // Upload texture
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, 256, 256, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE,
-                           bitfield);
-        textureDirty = false;
+    bool isTextureDirty() const {
+        return !dirtyRect.isEmpty();
     }
 
+    /**
+      Uploads the tiles that changed since the last update to the bound texture.
+      @param buffer Used for converting the tiles to texels.
+      */
+    void updateTexture(QVector<uchar> &buffer) {
+        static const uchar fog[4] = { UnexploredFog, ExploredFog, VisibleFog, VisibleFog };
+
+        buffer.resize(dirtyRect.width() * dirtyRect.height());
+        uchar *texel = buffer.data();
+
+        for (int y = dirtyRect.top(); y <= dirtyRect.bottom(); ++y)
+            for (int x = dirtyRect.left(); x <= dirtyRect.right(); ++x)
+                *(texel++) = fog[state(x, y)];
+
+        // Rows of the rectangle are tightly packed
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, dirtyRect.x(), dirtyRect.y(), dirtyRect.width(), dirtyRect.height(),
+                        GL_LUMINANCE, GL_UNSIGNED_BYTE, buffer.constData());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        dirtyRect = QRect();
+    }
+
+};
 
+/**
+  Something that keeps the tiles in its sight visible, like a party member.
+  */
+struct FogObserver {
+    QPoint tile;
+    int radius;
+    QVector<uint> visibleTiles; // Sorted keys of the visible tiles, see FogOfWarData::tileKey
 };
 
 class FogOfWarData : public AlignedAllocation
@@ -80,7 +235,9 @@ public:
     Box3d boundingBox;
     SharedMaterialState material;
     bool initialized;
+    FogOfWar::RevealMode revealMode;
     FogSectorBitmap bitmap[SectorsPerAxis][SectorsPerAxis];
+    QVector<uchar> uploadBuffer;
 
     GLuint textureHandle;
 
@@ -88,18 +245,56 @@ public:
 
     FogSectorBitmap *getSector(int x, int y);
 
-    bool hasLineOfSight(const Vector4 &from, const Vector4 &to) const;
+    QHash<uint, FogObserver> observers;
+    uint nextObserverId;
+    QHash<uint, ushort> observerCounts; // How many observers see a tile
 
+    static uint tileKey(int x, int y);
+
+    void findVisibleTiles(const QPoint &tile, int radius, QVector<uint> &result) const;
+    void updateObserver(FogObserver &observer);
+    void showObserved();
+    void observe(uint key);
+    void unobserve(uint key);
+
+};
+
+/**
+  Tiles marked as vision end block the sight.
+  */
+struct FogVisionEnd {
+    FogVisionEnd(const TileInfo *_tileInfo) : tileInfo(_tileInfo) {}
+
+    bool operator()(int x, int y) const
+    {
+        return tileInfo->isVisionEnd(x, y);
+    }
+
+    const TileInfo *tileInfo;
+};
+
+struct FogReveal {
+    FogReveal(FogOfWarData *_d) : d(_d) {}
+
+    void operator()(int x, int y)
+    {
+        // Tiles outside of the map are never shown, so they don't need a warning
+        FogSectorBitmap *bitmap = d->getSector(x, y);
+
+        if (bitmap)
+            bitmap->reveal(x % SectorSidelength, y % SectorSidelength);
+    }
+
+    FogOfWarData *d;
 };
 
-FogOfWarData::FogOfWarData() : initialized(false)
+FogOfWarData::FogOfWarData() : initialized(false), revealMode(FogOfWar::ShadowcastReveal), nextObserverId(1)
 {
     glGenTextures(1, &textureHandle);
 
     for (int x = 0; x < SectorsPerAxis; x++) {
         for (int y = 0; y < SectorsPerAxis; y++) {
             bitmap[x][y].texture = 0;
-            bitmap[x][y].textureDirty = true;
             bitmap[x][y].fogAll();
         }
     }
@@ -107,6 +302,10 @@ FogOfWarData::FogOfWarData() : initialized(false)
 
 FogSectorBitmap *FogOfWarData::getSector(int x, int y)
 {
+    // Division rounds towards zero, which would map tiles left of the map into the first sector
+    if (x < 0 || y < 0)
+        return NULL;
+
     int sectorX = x / SectorSidelength;
     int sectorY = y / SectorSidelength;
 
@@ -119,72 +318,114 @@ FogSectorBitmap *FogOfWarData::getSector(int x, int y)
     return &bitmap[sectorX][sectorY];
 }
 
-void FogOfWarData::initialize(RenderStates &renderStates)
+inline uint FogOfWarData::tileKey(int x, int y)
 {
-    if (initialized)
+    return y * Sidelength + x;
+}
+
+/**
+  Collects the keys of visible tiles within the map.
+  */
+struct FogCollect {
+    FogCollect(QVector<uint> &_keys) : keys(_keys) {}
+
+    void operator()(int x, int y)
+    {
+        if (x >= 0 && y >= 0 && x < Sidelength && y < Sidelength)
+            keys.append(FogOfWarData::tileKey(x, y));
+    }
+
+    QVector<uint> &keys;
+};
+
+void FogOfWarData::findVisibleTiles(const QPoint &tile, int radius, QVector<uint> &result) const
+{
+    result.clear();
+
+    if (!tileInfo)
         return;
 
-    initialized = true;
-    material = SharedMaterialState::create();
+    FogVisionEnd visionEnd(tileInfo);
+    FogCollect collect(result);
+    FieldOfView::castShadows(tile.x(), tile.y(), radius, visionEnd, collect);
 
-    if (!material->createFromFile(":/material/fog_material.xml", renderStates)) {
-        qFatal("Unable to load fog of war material: %s", qPrintable(material->error()));
+    // Tiles on the axes and diagonals are found twice
+    qSort(result);
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+}
+
+void FogOfWarData::observe(uint key)
+{
+    ushort &count = observerCounts[key];
+
+    if (count++ == 0) {
+        int x = key % Sidelength;
+        int y = key / Sidelength;
+        getSector(x, y)->reveal(x % SectorSidelength, y % SectorSidelength);
     }
 }
 
-bool FogOfWarData::hasLineOfSight(const Vector4 &from, const Vector4 &to) const
+void FogOfWarData::unobserve(uint key)
 {
-    if (!tileInfo) {
-        return false;
+    QHash<uint, ushort>::iterator it = observerCounts.find(key);
+
+    Q_ASSERT(it != observerCounts.end());
+
+    if (--it.value() == 0) {
+        observerCounts.erase(it);
+        int x = key % Sidelength;
+        int y = key / Sidelength;
+        getSector(x, y)->hide(x % SectorSidelength, y % SectorSidelength);
     }
+}
 
-    QPoint startTile(from.x() / TileInfo::UnitsPerTile, from.z() / TileInfo::UnitsPerTile);
-    QPoint endTile(to.x() / TileInfo::UnitsPerTile, to.z() / TileInfo::UnitsPerTile);
-
-    int x0 = startTile.x();
-    int y0 = startTile.y();
-    int x1 = endTile.x();
-    int y1 = endTile.y();
-
-    bool steep = abs(y1 - y0) > abs(x1 - x0);
-    if (steep) {
-        std::swap(x0, y0);
-        std::swap(x1, y1);
-    }
-    if (x0 > x1) {
-        std::swap(x0, x1);
-        std::swap(y0, y1);
-    }
-    int deltax = x1 - x0;
-    int deltay = abs(y1 - y0);
-    float error = 0;
-    float deltaerr = 0;
-    if (deltax != 0)
-        deltaerr = deltay / deltax;
-    int ystep;
-    int y = y0;
-    if (y0 < y1)
-        ystep = 1;
-    else
-        ystep = -1;
-
-    for (int x = x0; x <= x1; ++x) {
-        if (steep) {
-            if (tileInfo->isVisionEnd(y, x))
-                return false;
+/**
+  Recomputes the sight of an observer and only changes the tiles that it started or stopped seeing.
+  */
+void FogOfWarData::updateObserver(FogObserver &observer)
+{
+    QVector<uint> visibleTiles;
+    findVisibleTiles(observer.tile, observer.radius, visibleTiles);
+
+    const QVector<uint> &previousTiles = observer.visibleTiles;
+
+    // Both are sorted, so the difference is found by merging them
+    int i = 0, j = 0;
+    while (i < previousTiles.size() || j < visibleTiles.size()) {
+        if (j >= visibleTiles.size() || (i < previousTiles.size() && previousTiles[i] < visibleTiles[j])) {
+            unobserve(previousTiles[i++]);
+        } else if (i >= previousTiles.size() || visibleTiles[j] < previousTiles[i]) {
+            observe(visibleTiles[j++]);
         } else {
-            if (tileInfo->isVisionEnd(x, y))
-                return false;
+            ++i;
+            ++j;
         }
+    }
 
-        error += deltaerr;
-        if (error >= 0.5) {
-            y = y + ystep;
-            error = error - 1.0;
-        }
+    observer.visibleTiles = visibleTiles;
+}
+
+void FogOfWarData::showObserved()
+{
+    QHash<uint, ushort>::const_iterator it;
+    for (it = observerCounts.constBegin(); it != observerCounts.constEnd(); ++it) {
+        int x = it.key() % Sidelength;
+        int y = it.key() / Sidelength;
+        getSector(x, y)->reveal(x % SectorSidelength, y % SectorSidelength);
     }
+}
 
-    return true;
+void FogOfWarData::initialize(RenderStates &renderStates)
+{
+    if (initialized)
+        return;
+
+    initialized = true;
+    material = SharedMaterialState::create();
+
+    if (!material->createFromFile(":/material/fog_material.xml", renderStates)) {
+        qFatal("Unable to load fog of war material: %s", qPrintable(material->error()));
+    }
 }
 
 FogOfWar::FogOfWar() : d(new FogOfWarData)
@@ -200,35 +441,149 @@ FogOfWar::~FogOfWar()
 {
 }
 
-static QPoint vectorToTile(const Vector4 &center)
+void FogOfWar::revealAll()
 {
-    int tileX = center.x() / TileSidelength;
-    int tileY = center.x() / TileSidelength;
-    return QPoint(tileX, tileY);
+    for (int x = 0; x < SectorsPerAxis; ++x) {
+        for (int y = 0; y < SectorsPerAxis; ++y) {
+            d->bitmap[x][y].revealAll();
+        }
+    }
 }
 
-static Vector4 tileToVector(int x, int y)
+void FogOfWar::fadeVisible()
 {
-    x *= TileSidelength;
-    y *= TileSidelength;
-    return Vector4(x, 0, y, 1);
+    for (int x = 0; x < SectorsPerAxis; ++x) {
+        for (int y = 0; y < SectorsPerAxis; ++y) {
+            d->bitmap[x][y].fadeVisible();
+        }
+    }
+
+    // Observers still see their tiles
+    d->showObserved();
 }
 
-void FogOfWar::revealAll()
+static const quint32 SnapshotMagic = 0x464F4731; // "FOG1"
+
+QByteArray FogOfWar::saveSnapshot() const
 {
+    QByteArray result;
+    QDataStream stream(&result, QIODevice::WriteOnly);
+
+    stream << SnapshotMagic << (quint16)SectorsPerAxis << (quint16)TextureSidelength;
+
     for (int x = 0; x < SectorsPerAxis; ++x) {
         for (int y = 0; y < SectorsPerAxis; ++y) {
-            d->bitmap[x][y].revealAll();
+            d->bitmap[x][y].saveExplored(stream);
+        }
+    }
+
+    return result;
+}
+
+bool FogOfWar::loadSnapshot(const QByteArray &snapshot)
+{
+    // Savegames from before snapshots existed have none
+    if (snapshot.isEmpty())
+        return false;
+
+    // The snapshot is checked completely before anything is changed
+    for (int pass = 0; pass < 2; ++pass) {
+        bool apply = (pass == 1);
+
+        QDataStream stream(snapshot);
+        quint32 magic;
+        quint16 sectorsPerAxis, sidelength;
+        stream >> magic >> sectorsPerAxis >> sidelength;
+
+        if (magic != SnapshotMagic || sectorsPerAxis != SectorsPerAxis || sidelength != TextureSidelength) {
+            qWarning("Fog of war snapshot has an unknown format.");
+            return false;
+        }
+
+        for (int x = 0; x < SectorsPerAxis; ++x) {
+            for (int y = 0; y < SectorsPerAxis; ++y) {
+                if (!d->bitmap[x][y].loadExplored(stream, apply)) {
+                    qWarning("Fog of war snapshot is corrupted.");
+                    return false;
+                }
+            }
         }
     }
+
+    d->showObserved();
+    return true;
+}
+
+uint FogOfWar::addObserver(const Vector4 &position, float radius)
+{
+    uint id = d->nextObserverId++;
+    if (!d->nextObserverId)
+        d->nextObserverId = 1;
+
+    FogObserver &observer = d->observers[id];
+    observer.tile = QPoint(position.x() / TileSidelength, position.z() / TileSidelength);
+    observer.radius = qCeil(radius);
+    d->updateObserver(observer);
+
+    return id;
+}
+
+void FogOfWar::moveObserver(uint id, const Vector4 &position)
+{
+    QHash<uint, FogObserver>::iterator it = d->observers.find(id);
+
+    if (it == d->observers.end()) {
+        qWarning("Unknown fog of war observer: %u", id);
+        return;
+    }
+
+    QPoint tile(position.x() / TileSidelength, position.z() / TileSidelength);
+
+    // Moving within a tile doesn't change what is visible
+    if (it->tile == tile)
+        return;
+
+    it->tile = tile;
+    d->updateObserver(it.value());
+}
+
+void FogOfWar::removeObserver(uint id)
+{
+    QHash<uint, FogObserver>::iterator it = d->observers.find(id);
+
+    if (it == d->observers.end())
+        return;
+
+    foreach (uint key, it->visibleTiles)
+        d->unobserve(key);
+
+    d->observers.erase(it);
+}
+
+void FogOfWar::updateVision()
+{
+    QHash<uint, FogObserver>::iterator it;
+    for (it = d->observers.begin(); it != d->observers.end(); ++it)
+        d->updateObserver(it.value());
 }
 
 void FogOfWar::reveal(const Vector4 &center, float radius)
 {
-    // Find center sector
+    if (!d->tileInfo)
+        return;
+
+    // Find center tile
     int centerX = center.x() / TileSidelength;
     int centerY = center.z() / TileSidelength;
 
+    FogVisionEnd visionEnd(d->tileInfo);
+
+    if (d->revealMode == ShadowcastReveal) {
+        FogReveal reveal(d.data());
+        FieldOfView::castShadows(centerX, centerY, (int)radius, visionEnd, reveal);
+        return;
+    }
+
     int radiusSquare = radius * radius;
 
     for (int tileX = centerX - radius; tileX <= centerX + radius; ++tileX) {
@@ -250,12 +605,12 @@ void FogOfWar::reveal(const Vector4 &center, float radius)
                 int subtileX = tileX % SectorSidelength;
                 int subtileY = tileY % SectorSidelength;
 
-                // The LoS check is very expensive, skip it, if the tile is already revealed
-                if (bitmap->isRevealed(subtileX, subtileY))
+                // The LoS check is very expensive, skip it, if the tile is already visible
+                if (bitmap->isVisible(subtileX, subtileY))
                     continue;
 
-                // Check for line of sight from center (TODO: Naive approach)
-                if (!d->hasLineOfSight(center, tileToVector(tileX, tileY)))
+                // Check for line of sight from center
+                if (!FieldOfView::isVisible(centerX, centerY, tileX, tileY, visionEnd))
                     continue;
 
                 bitmap->reveal(subtileX, subtileY);
@@ -292,8 +647,8 @@ struct FogOfWarDrawStrategy : public DrawStrategy {
 
                 glBindTexture(GL_TEXTURE_2D, bitmap.texture);
 
-                if (bitmap.textureDirty)
-                    bitmap.updateTexture();
+                if (bitmap.isTextureDirty())
+                    bitmap.updateTexture(d->uploadBuffer);
 
                 bindUniform<int>(samplerLoc, 0);
 
@@ -342,6 +697,17 @@ void FogOfWar::setTileInfo(TileInfo *tileInfo)
 {
     d->tileInfo = tileInfo;
     d->pathfinder.setTileInfo(tileInfo);
+    updateVision();
+}
+
+FogOfWar::RevealMode FogOfWar::revealMode() const
+{
+    return d->revealMode;
+}
+
+void FogOfWar::setRevealMode(RevealMode mode)
+{
+    d->revealMode = mode;
 }
 
 }
@@ -1,6 +1,7 @@
 #ifndef FOGOFWAR_H
 #define FOGOFWAR_H
 
+#include <QByteArray>
 #include <QScopedPointer>
 
 #include "renderable.h"
@@ -15,8 +16,27 @@ class FogOfWar : public Renderable
 {
     Q_OBJECT
     Q_PROPERTY(EvilTemple::TileInfo *tileInfo READ tileInfo WRITE setTileInfo)
+    Q_PROPERTY(RevealMode revealMode READ revealMode WRITE setRevealMode)
+    Q_ENUMS(RevealMode)
 public:
 
+    /**
+      The algorithm used to find the tiles that are visible from the center of a reveal.
+      Both reveal the same tiles (see common/fieldofview.h), they only differ in speed.
+      */
+    enum RevealMode {
+        /**
+          Checks the lines of sight to every tile within the radius separately, skipping tiles that
+          are already revealed. This is O(radius^3) in the worst case.
+          */
+        LineOfSightReveal = 0,
+        /**
+          Recursive symmetric shadowcasting, which checks every tile within the radius only
+          a constant number of times. This is the default.
+          */
+        ShadowcastReveal
+    };
+
     FogOfWar();
     ~FogOfWar();
 
@@ -27,6 +47,9 @@ public:
     TileInfo *tileInfo() const;
     void setTileInfo(TileInfo *tileinfo);
 
+    RevealMode revealMode() const;
+    void setRevealMode(RevealMode mode);
+
 signals:
 
 public slots:
@@ -35,6 +58,52 @@ public slots:
 
     void revealAll();
 
+    /**
+      Covers all tiles that were revealed since the last call with the lighter fog of explored tiles.
+      Call this before revealing what is currently in sight to only show that without fog.
+      */
+    void fadeVisible();
+
+    /**
+      Adds an observer, which keeps the tiles it can see from its position visible until it moves
+      away or is removed. Observers always use shadowcasting.
+
+      Unlike reveal, tiles an observer no longer sees fall back to the fog of explored tiles, so
+      the area the party has left is shown greyed out instead of staying revealed.
+      @param radius The distance the observer can see, in tiles. Fractions are rounded up.
+      @return The identifier of the observer. Never 0.
+      */
+    uint addObserver(const Vector4 &position, float radius);
+
+    /**
+      Moves an observer. Its sight is only recomputed if it moved onto another tile, and only the
+      tiles it started or stopped seeing are changed.
+      */
+    void moveObserver(uint id, const Vector4 &position);
+
+    /**
+      Removes an observer. The tiles it saw stay explored.
+      */
+    void removeObserver(uint id);
+
+    /**
+      Recomputes the sight of all observers. Call this when the vision layers of the tile info change.
+      */
+    void updateVision();
+
+    /**
+      Returns which tiles are explored, in a compact binary format suitable for save games.
+      The tiles that are visible are not part of the snapshot, since observers restore them.
+      */
+    QByteArray saveSnapshot() const;
+
+    /**
+      Restores the explored tiles from a snapshot created by saveSnapshot. The tiles seen by
+      observers stay visible.
+      @return False if the snapshot is empty or invalid, in which case the fog is unchanged.
+      */
+    bool loadSnapshot(const QByteArray &snapshot);
+
 private:
     QScopedPointer<FogOfWarData> d;
 
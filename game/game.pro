@@ -35,13 +35,18 @@ SOURCES += \
     modelinstance.cpp \
     scenenode.cpp \
     scene.cpp \
+    scenequadtree.cpp \
+    trianglebvh.cpp \
     entity.cpp \
     renderable.cpp \
+    renderqueue.cpp \
     boxrenderable.cpp \
     texturesource.cpp \
     lighting.cpp \
+    lightgrid.cpp \
     lighting_debug.cpp \
     profiler.cpp \
+    glstate.cpp \
     profilerdialog.cpp \
     scriptables.cpp \
     materials.cpp \
@@ -63,7 +68,13 @@ SOURCES += \
     charactervault.cpp \
     geometryrenderables.cpp \
     tileinfo.cpp \
-    pathfinder.cpp
+    pathfinder.cpp \
+    tilesearch.cpp \
+    clustergraph.cpp \
+    componentmap.cpp \
+    pathcache.cpp \
+    pathrequests.cpp \
+    flowfield.cpp
 HEADERS += \
     mainwindow.h \
     game.h \
@@ -85,14 +96,18 @@ HEADERS += \
     modelinstance.h \
     scenenode.h \
     scene.h \
+    scenequadtree.h \
+    trianglebvh.h \
     renderqueue.h \
     entity.h \
     renderable.h \
     boxrenderable.h \
     lighting.h \
+    lightgrid.h \
     lighting_debug.h \
     drawhelper.h \
     profiler.h \
+    glstate.h \
     profilerdialog.h \
     scriptables.h \
     materials.h \
@@ -116,7 +131,14 @@ HEADERS += \
     charactervault.h \
     geometryrenderables.h \
     tileinfo.h \
-    pathfinder.h
+    pathfinder.h \
+    binaryheap.h \
+    tilesearch.h \
+    clustergraph.h \
+    componentmap.h \
+    pathcache.h \
+    pathrequests.h \
+    flowfield.h
 OTHER_FILES += \
     resources/schema/materialfile.xsd \
     resources/materials/map_material.xml \
@@ -24,6 +24,7 @@
 #include "scene.h"
 #include "boxrenderable.h"
 #include "profiler.h"
+#include "glstate.h"
 #include "materials.h"
 #include "audioengine.h"
 #include "models.h"
@@ -535,6 +536,7 @@ namespace EvilTemple {
         Q_UNUSED(rect);
 
         Profiler::newFrame();
+        GLState::newFrame();
 
         ProfileScope<Profiler::FrameRender> profiler;
 
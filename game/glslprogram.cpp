@@ -3,6 +3,7 @@
 #include <QtCore/QFile>
 
 #include "glslprogram.h"
+#include "glstate.h"
 #include "util.h"
 
 #include <stdio.h>
@@ -23,13 +24,13 @@ namespace EvilTemple {
 
     bool GLSLProgram::bind()
     {
-        SAFE_GL(glUseProgram(mProgramId));
+        GLState::useProgram(mProgramId);
         return true;
     }
 
     void GLSLProgram::unbind()
     {
-        glUseProgram(0);
+        GLState::useProgram(0);
     }
 
     bool GLSLProgram::loadFromFile(const QString &vertexShaderFile, const QString &fragmentShaderFile)
@@ -0,0 +1,557 @@
+
+#include <string.h>
+
+#include <QtCore/QHash>
+
+#include "glstate.h"
+
+namespace EvilTemple {
+
+static const int MaxTextureUnits = 8;
+static const int MaxVertexAttributes = 16;
+static const int MaxCapabilities = 8;
+static const int MaxUniformSize = 16 * sizeof(double);
+
+struct VertexAttribute {
+    GLuint buffer;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride;
+    GLintptr offset;
+};
+
+struct TextureWrap {
+    GLenum s, t;
+};
+
+struct UniformValue {
+    int size;
+    char data[MaxUniformSize];
+};
+
+/**
+  A state that is set by a material, but only applied before the next draw.
+  */
+template<typename T> struct DeferredState {
+    T desired;
+    T applied;
+    bool requested; // Whether the state was set while caching
+    bool known; // Whether applied is the actual state
+};
+
+struct Capability {
+    GLenum capability;
+    DeferredState<bool> state;
+};
+
+class GLStateData {
+public:
+    GLStateData() : caching(false), issued(0), elided(0)
+    {
+        lastFrame.issued = 0;
+        lastFrame.elided = 0;
+        forget();
+    }
+
+    void forget();
+
+    template<typename T> bool apply(DeferredState<T> &state);
+
+    bool caching;
+
+    bool programKnown;
+    GLuint program;
+
+    bool activeUnitKnown;
+    int activeUnit;
+
+    bool textureKnown[MaxTextureUnits];
+    GLuint textures[MaxTextureUnits];
+
+    // Wrap modes of textures that have been bound while caching
+    QHash<GLuint, TextureWrap> textureWraps;
+
+    bool arrayBufferKnown;
+    GLuint arrayBuffer;
+    bool elementBufferKnown;
+    GLuint elementBuffer;
+
+    uint attributesKnown;
+    uint attributesEnabled;
+    VertexAttribute attributes[MaxVertexAttributes];
+
+    // Uniform values by program (high 32 bits) and location (low 32 bits)
+    QHash<quint64, UniformValue> uniforms;
+
+    DeferredState<GLenum> blendSrcFactor;
+    DeferredState<GLenum> blendDestFactor;
+    DeferredState<bool> depthMask;
+    DeferredState<GLenum> depthFunc;
+
+    Capability capabilities[MaxCapabilities];
+    int capabilityCount;
+
+    bool stateDirty;
+    uint pendingStateChanges;
+
+    uint issued;
+    uint elided;
+    GLState::Counters lastFrame;
+};
+
+template<typename T> static void forgetState(DeferredState<T> &state)
+{
+    state.requested = false;
+    state.known = false;
+}
+
+void GLStateData::forget()
+{
+    programKnown = false;
+    activeUnitKnown = false;
+    for (int i = 0; i < MaxTextureUnits; ++i)
+        textureKnown[i] = false;
+    textureWraps.clear();
+
+    arrayBufferKnown = false;
+    elementBufferKnown = false;
+
+    attributesKnown = 0;
+    attributesEnabled = 0;
+
+    uniforms.clear();
+
+    forgetState(blendSrcFactor);
+    forgetState(blendDestFactor);
+    forgetState(depthMask);
+    forgetState(depthFunc);
+    capabilityCount = 0;
+
+    stateDirty = false;
+    pendingStateChanges = 0;
+}
+
+/**
+  Returns true if the desired state differs from the one last applied, and marks it as applied.
+  */
+template<typename T> inline bool GLStateData::apply(DeferredState<T> &state)
+{
+    if (!state.requested || (state.known && state.applied == state.desired))
+        return false;
+
+    state.applied = state.desired;
+    state.known = true;
+    return true;
+}
+
+void GLState::beginCaching()
+{
+    d->forget();
+    d->caching = true;
+}
+
+void GLState::endCaching()
+{
+    if (!d->caching)
+        return;
+
+    flush();
+
+    disableVertexAttribArrays(d->attributesEnabled);
+
+    if (d->arrayBufferKnown && d->arrayBuffer)
+        bindBuffer(GL_ARRAY_BUFFER, 0);
+    if (d->elementBufferKnown && d->elementBuffer)
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    // Textures used by other code expect to be repeated
+    const QHash<GLuint, TextureWrap> textureWraps = d->textureWraps;
+    QHash<GLuint, TextureWrap>::const_iterator it;
+    for (it = textureWraps.constBegin(); it != textureWraps.constEnd(); ++it) {
+        if (it.value().s == GL_REPEAT && it.value().t == GL_REPEAT)
+            continue;
+
+        activeTexture(GL_TEXTURE0);
+        bindTexture(it.key());
+        setTextureWrap(GL_REPEAT, GL_REPEAT);
+    }
+
+    for (int i = 0; i < MaxTextureUnits; ++i) {
+        if (d->textureKnown[i] && d->textures[i]) {
+            activeTexture(GL_TEXTURE0 + i);
+            bindTexture(0);
+        }
+    }
+
+    if (d->activeUnitKnown && d->activeUnit)
+        activeTexture(GL_TEXTURE0);
+
+    if (d->programKnown && d->program)
+        useProgram(0);
+
+    d->caching = false;
+}
+
+bool GLState::isCaching()
+{
+    return d->caching;
+}
+
+void GLState::useProgram(GLuint program)
+{
+    if (d->caching && d->programKnown && d->program == program) {
+        d->elided++;
+        return;
+    }
+
+    glUseProgram(program);
+    d->issued++;
+
+    d->programKnown = d->caching;
+    d->program = program;
+}
+
+void GLState::activeTexture(GLenum unit)
+{
+    int index = unit - GL_TEXTURE0;
+
+    if (d->caching && d->activeUnitKnown && d->activeUnit == index) {
+        d->elided++;
+        return;
+    }
+
+    glActiveTexture(unit);
+    d->issued++;
+
+    d->activeUnitKnown = d->caching;
+    d->activeUnit = index;
+}
+
+void GLState::bindTexture(GLuint texture)
+{
+    int unit = d->activeUnit;
+    bool tracked = d->caching && d->activeUnitKnown && unit >= 0 && unit < MaxTextureUnits;
+
+    if (tracked && d->textureKnown[unit] && d->textures[unit] == texture) {
+        d->elided++;
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    d->issued++;
+
+    if (tracked) {
+        d->textureKnown[unit] = true;
+        d->textures[unit] = texture;
+    }
+}
+
+void GLState::setTextureWrap(GLenum wrapS, GLenum wrapT)
+{
+    int unit = d->activeUnit;
+    bool tracked = d->caching && d->activeUnitKnown && unit >= 0 && unit < MaxTextureUnits
+                   && d->textureKnown[unit] && d->textures[unit];
+
+    TextureWrap current;
+    current.s = GL_REPEAT;
+    current.t = GL_REPEAT;
+
+    if (tracked)
+        current = d->textureWraps.value(d->textures[unit], current);
+
+    // Without the cache, only modes other than the default are set
+    if (current.s != wrapS) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+        d->issued++;
+    } else if (wrapS != GL_REPEAT) {
+        d->elided++;
+    }
+
+    if (current.t != wrapT) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+        d->issued++;
+    } else if (wrapT != GL_REPEAT) {
+        d->elided++;
+    }
+
+    if (tracked) {
+        current.s = wrapS;
+        current.t = wrapT;
+        d->textureWraps[d->textures[unit]] = current;
+    }
+}
+
+void GLState::bindBuffer(GLenum target, GLuint buffer)
+{
+    bool *known;
+    GLuint *bound;
+
+    if (target == GL_ARRAY_BUFFER) {
+        known = &d->arrayBufferKnown;
+        bound = &d->arrayBuffer;
+    } else if (target == GL_ELEMENT_ARRAY_BUFFER) {
+        known = &d->elementBufferKnown;
+        bound = &d->elementBuffer;
+    } else {
+        glBindBuffer(target, buffer);
+        d->issued++;
+        return;
+    }
+
+    if (d->caching && *known && *bound == buffer) {
+        d->elided++;
+        return;
+    }
+
+    glBindBuffer(target, buffer);
+    d->issued++;
+
+    *known = d->caching;
+    *bound = buffer;
+}
+
+void GLState::vertexAttribPointer(GLuint location, GLuint buffer, GLint size, GLenum type,
+                                  GLboolean normalized, GLsizei stride, GLintptr offset)
+{
+    bool tracked = d->caching && location < MaxVertexAttributes;
+
+    if (tracked && (d->attributesKnown & (1 << location))) {
+        const VertexAttribute &attribute = d->attributes[location];
+
+        if (attribute.buffer == buffer && attribute.size == size && attribute.type == type
+            && attribute.normalized == normalized && attribute.stride == stride
+            && attribute.offset == offset) {
+            // Neither the buffer nor the pointer have to be set
+            d->elided += 2;
+            return;
+        }
+    }
+
+    bindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(location, size, type, normalized, stride, (GLvoid*)offset);
+    d->issued++;
+
+    if (tracked) {
+        VertexAttribute &attribute = d->attributes[location];
+        attribute.buffer = buffer;
+        attribute.size = size;
+        attribute.type = type;
+        attribute.normalized = normalized;
+        attribute.stride = stride;
+        attribute.offset = offset;
+
+        // The enabled state is tracked separately
+        d->attributesKnown |= 1 << location;
+    }
+}
+
+void GLState::enableVertexAttribArrays(uint mask)
+{
+    for (GLuint i = 0; i < 32 && (mask >> i); ++i) {
+        if (!(mask & (1 << i)))
+            continue;
+
+        if (d->caching && i < MaxVertexAttributes && (d->attributesEnabled & (1 << i))) {
+            d->elided++;
+            continue;
+        }
+
+        glEnableVertexAttribArray(i);
+        d->issued++;
+
+        if (d->caching && i < MaxVertexAttributes)
+            d->attributesEnabled |= 1 << i;
+    }
+
+    // Arrays left enabled by a previous draw would be read by this one
+    if (d->caching)
+        disableVertexAttribArrays(d->attributesEnabled & ~mask);
+}
+
+void GLState::disableVertexAttribArrays(uint mask)
+{
+    for (GLuint i = 0; i < 32 && (mask >> i); ++i) {
+        if (!(mask & (1 << i)))
+            continue;
+
+        glDisableVertexAttribArray(i);
+        d->issued++;
+
+        d->attributesEnabled &= ~(1 << i);
+    }
+}
+
+bool GLState::uniformChanged(GLint location, const void *value, int size)
+{
+    if (!d->caching || !d->programKnown || location < 0 || size > MaxUniformSize) {
+        d->issued++;
+        return true;
+    }
+
+    quint64 key = ((quint64)d->program << 32) | (quint32)location;
+
+    QHash<quint64, UniformValue>::iterator it = d->uniforms.find(key);
+
+    if (it != d->uniforms.end() && it.value().size == size && !memcmp(it.value().data, value, size)) {
+        d->elided++;
+        return false;
+    }
+
+    if (it == d->uniforms.end())
+        it = d->uniforms.insert(key, UniformValue());
+
+    it.value().size = size;
+    memcpy(it.value().data, value, size);
+
+    d->issued++;
+    return true;
+}
+
+template<typename T> static inline void request(DeferredState<T> &state, T value)
+{
+    state.desired = value;
+    state.requested = true;
+}
+
+void GLState::blendFunc(GLenum srcFactor, GLenum destFactor)
+{
+    if (!d->caching) {
+        glBlendFunc(srcFactor, destFactor);
+        d->issued++;
+        return;
+    }
+
+    request(d->blendSrcFactor, srcFactor);
+    request(d->blendDestFactor, destFactor);
+    d->pendingStateChanges++;
+    d->stateDirty = true;
+}
+
+void GLState::depthMask(bool enabled)
+{
+    if (!d->caching) {
+        glDepthMask(enabled);
+        d->issued++;
+        return;
+    }
+
+    request(d->depthMask, enabled);
+    d->pendingStateChanges++;
+    d->stateDirty = true;
+}
+
+void GLState::depthFunc(GLenum func)
+{
+    if (!d->caching) {
+        glDepthFunc(func);
+        d->issued++;
+        return;
+    }
+
+    request(d->depthFunc, func);
+    d->pendingStateChanges++;
+    d->stateDirty = true;
+}
+
+void GLState::enable(GLenum capability)
+{
+    setEnabled(capability, true);
+}
+
+void GLState::disable(GLenum capability)
+{
+    setEnabled(capability, false);
+}
+
+void GLState::setEnabled(GLenum capability, bool enabled)
+{
+    Capability *entry = NULL;
+
+    if (d->caching) {
+        for (int i = 0; i < d->capabilityCount; ++i) {
+            if (d->capabilities[i].capability == capability) {
+                entry = d->capabilities + i;
+                break;
+            }
+        }
+
+        if (!entry && d->capabilityCount < MaxCapabilities) {
+            entry = d->capabilities + d->capabilityCount++;
+            entry->capability = capability;
+            forgetState(entry->state);
+        }
+    }
+
+    if (!entry) {
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+        d->issued++;
+        return;
+    }
+
+    request(entry->state, enabled);
+    d->pendingStateChanges++;
+    d->stateDirty = true;
+}
+
+void GLState::flush()
+{
+    if (!d->stateDirty)
+        return;
+
+    uint issued = 0;
+
+    bool srcChanged = d->apply(d->blendSrcFactor);
+    bool destChanged = d->apply(d->blendDestFactor);
+    if (srcChanged || destChanged) {
+        glBlendFunc(d->blendSrcFactor.applied, d->blendDestFactor.applied);
+        issued++;
+    }
+
+    if (d->apply(d->depthMask)) {
+        glDepthMask(d->depthMask.applied);
+        issued++;
+    }
+
+    if (d->apply(d->depthFunc)) {
+        glDepthFunc(d->depthFunc.applied);
+        issued++;
+    }
+
+    for (int i = 0; i < d->capabilityCount; ++i) {
+        Capability &entry = d->capabilities[i];
+        if (d->apply(entry.state)) {
+            if (entry.state.applied)
+                glEnable(entry.capability);
+            else
+                glDisable(entry.capability);
+            issued++;
+        }
+    }
+
+    d->issued += issued;
+    d->elided += qMax(d->pendingStateChanges, issued) - issued;
+
+    d->pendingStateChanges = 0;
+    d->stateDirty = false;
+}
+
+GLState::Counters GLState::lastFrame()
+{
+    return d->lastFrame;
+}
+
+void GLState::newFrame()
+{
+    d->lastFrame.issued = d->issued;
+    d->lastFrame.elided = d->elided;
+    d->issued = 0;
+    d->elided = 0;
+}
+
+QScopedPointer<GLStateData> GLState::d(new GLStateData);
+
+}
@@ -0,0 +1,117 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <GL/glew.h>
+
+#include <QtCore/QScopedPointer>
+
+namespace EvilTemple {
+
+class GLStateData;
+
+/**
+  Keeps a copy of the OpenGL state that is changed while drawing materials, so changes that
+  wouldn't have any effect are not sent to the driver.
+
+  The copy is only used between beginCaching() and endCaching(). Everything drawn in between has
+  to change the program, texture, buffer, vertex attribute, blend and depth state and uniform
+  values through this class. Outside of such a section, every call is passed on to OpenGL.
+
+  While caching, bindings are left in place after a draw, so the next draw using the same state
+  doesn't have to bind it again. Blend and depth state is only applied by flush(), which has to be
+  called before drawing, so a pass that resets a state to its default and a following pass that
+  changes it again only cause a single call. endCaching() restores the default state that code
+  outside of the section expects.
+  */
+class GLState {
+public:
+    /**
+      The number of state changes requested through this class.
+      */
+    struct Counters {
+        uint issued; // Passed on to OpenGL
+        uint elided; // Skipped since they wouldn't have changed the state
+    };
+
+    /**
+      Forgets the state known from previous sections, since it may have been changed by
+      other code in the meantime, and starts filtering state changes.
+      */
+    static void beginCaching();
+
+    /**
+      Restores the default state and stops filtering state changes.
+      */
+    static void endCaching();
+
+    static bool isCaching();
+
+    static void useProgram(GLuint program);
+
+    static void activeTexture(GLenum unit);
+
+    /**
+      Binds a 2D texture to the active texture unit.
+      */
+    static void bindTexture(GLuint texture);
+
+    /**
+      Sets the wrap modes of the texture bound to the active texture unit. Textures are expected
+      to use GL_REPEAT unless they are bound by a material that says otherwise.
+      */
+    static void setTextureWrap(GLenum wrapS, GLenum wrapT);
+
+    static void bindBuffer(GLenum target, GLuint buffer);
+
+    /**
+      Binds the buffer and points the vertex attribute at the given location to it.
+      */
+    static void vertexAttribPointer(GLuint location, GLuint buffer, GLint size, GLenum type,
+                                    GLboolean normalized, GLsizei stride, GLintptr offset);
+
+    /**
+      Enables the vertex attribute arrays whose bit is set in the mask. While caching,
+      all other arrays are disabled.
+      */
+    static void enableVertexAttribArrays(uint mask);
+
+    static void disableVertexAttribArrays(uint mask);
+
+    /**
+      Checks whether a value differs from the one last set for a uniform of the current program.
+      The value is remembered if this returns true, so the caller has to set it afterwards.
+      */
+    static bool uniformChanged(GLint location, const void *value, int size);
+
+    static void blendFunc(GLenum srcFactor, GLenum destFactor);
+
+    static void depthMask(bool enabled);
+
+    static void depthFunc(GLenum func);
+
+    static void enable(GLenum capability);
+
+    static void disable(GLenum capability);
+
+    /**
+      Applies the blend and depth state set since the last call. This has to be called before
+      drawing while caching.
+      */
+    static void flush();
+
+    /**
+      Returns the counters of the last complete frame.
+      */
+    static Counters lastFrame();
+
+    static void newFrame();
+
+private:
+    static void setEnabled(GLenum capability, bool enabled);
+
+    static QScopedPointer<GLStateData> d;
+};
+
+}
+
+#endif // GLSTATE_H
@@ -0,0 +1,181 @@
+
+
+#include "lightgrid.h"
+#include "lighting.h"
+#include "renderstates.h"
+
+namespace EvilTemple {
+
+LightGrid::LightGrid() : mQuery(0), mMinX(0), mMinZ(0), mMaxX(0), mMaxZ(0), mCellWidth(1), mCellDepth(1)
+{
+}
+
+inline int LightGrid::cellX(float x) const
+{
+    return qBound(0, (int)((x - mMinX) / mCellWidth), Resolution - 1);
+}
+
+inline int LightGrid::cellZ(float z) const
+{
+    return qBound(0, (int)((z - mMinZ) / mCellDepth), Resolution - 1);
+}
+
+void LightGrid::build(const QList<const Light*> &lights, const Box3d &area)
+{
+    mLights.resize(lights.size());
+    mGlobalLights.clear();
+    mQueries.fill(0, lights.size());
+    mQuery = 0;
+
+    mMinX = area.minimum().x();
+    mMinZ = area.minimum().z();
+    mMaxX = area.maximum().x();
+    mMaxZ = area.maximum().z();
+
+    mCellWidth = qMax(1.0f, (mMaxX - mMinX) / Resolution);
+    mCellDepth = qMax(1.0f, (mMaxZ - mMinZ) / Resolution);
+
+    // Count the lights per cell first, so all cells can share one array
+    mCellStart.fill(0, Resolution * Resolution + 1);
+
+    for (int i = 0; i < lights.size(); ++i) {
+        const Light *light = lights.at(i);
+        Vector4 position = light->position();
+
+        LightInfo &info = mLights[i];
+        info.light = light;
+        info.x = position.x();
+        info.y = position.y();
+        info.z = position.z();
+        info.range = light->range();
+        info.directional = light->type() == Light::Directional;
+
+        if (info.directional || (info.x - info.range <= mMinX && info.x + info.range >= mMaxX
+                                 && info.z - info.range <= mMinZ && info.z + info.range >= mMaxZ)) {
+            mGlobalLights.append(i);
+            continue;
+        }
+
+        for (int z = cellZ(info.z - info.range); z <= cellZ(info.z + info.range); ++z)
+            for (int x = cellX(info.x - info.range); x <= cellX(info.x + info.range); ++x)
+                mCellStart[z * Resolution + x + 1]++;
+    }
+
+    for (int i = 1; i < mCellStart.size(); ++i)
+        mCellStart[i] += mCellStart[i - 1];
+
+    mCellLights.resize(mCellStart.last());
+
+    QVector<int> cellEnd = mCellStart;
+    int nextGlobal = 0;
+
+    for (int i = 0; i < mLights.size(); ++i) {
+        if (nextGlobal < mGlobalLights.size() && mGlobalLights.at(nextGlobal) == i) {
+            nextGlobal++;
+            continue;
+        }
+
+        const LightInfo &info = mLights.at(i);
+
+        for (int z = cellZ(info.z - info.range); z <= cellZ(info.z + info.range); ++z)
+            for (int x = cellX(info.x - info.range); x <= cellX(info.x + info.range); ++x)
+                mCellLights[cellEnd[z * Resolution + x]++] = i;
+    }
+}
+
+inline bool LightGrid::reaches(const LightInfo &info, float x, float y, float z, float extent, float *distance) const
+{
+    float dx = info.x - x;
+    float dy = info.y - y;
+    float dz = info.z - z;
+    *distance = dx * dx + dy * dy + dz * dz;
+
+    return info.directional || *distance <= info.range * info.range + extent * extent;
+}
+
+void LightGrid::findLights(const Vector4 &position, float extent, ActiveLights &result)
+{
+    result.clear();
+
+    if (mLights.isEmpty())
+        return;
+
+    float x = position.x();
+    float y = position.y();
+    float z = position.z();
+
+    int found[ActiveLights::Capacity];
+    float distances[ActiveLights::Capacity];
+    int count = 0;
+
+    foreach (int index, mGlobalLights) {
+        if (count == ActiveLights::Capacity)
+            break;
+
+        float distance;
+        if (reaches(mLights.at(index), x, y, z, extent, &distance))
+            found[count++] = index;
+    }
+
+    // Only the lights found in the cells are replaced by nearer ones
+    int kept = count;
+
+    if (++mQuery == 0) {
+        mQueries.fill(0);
+        mQuery = 1;
+    }
+
+    /*
+      A light that reaches the object is at most its range plus the extent away along each axis,
+      so the object's square overlaps the range of the light in some cell.
+      */
+    int startX = cellX(x - extent), endX = cellX(x + extent);
+    int startZ = cellZ(z - extent), endZ = cellZ(z + extent);
+
+    for (int row = startZ; row <= endZ; ++row) {
+        for (int column = startX; column <= endX; ++column) {
+            int cell = row * Resolution + column;
+
+            for (int i = mCellStart.at(cell); i < mCellStart.at(cell + 1); ++i) {
+                int index = mCellLights.at(i);
+
+                if (mQueries.at(index) == mQuery)
+                    continue;
+                mQueries[index] = mQuery;
+
+                float distance;
+                if (!reaches(mLights.at(index), x, y, z, extent, &distance))
+                    continue;
+
+                if (count < ActiveLights::Capacity) {
+                    found[count] = index;
+                    distances[count] = distance;
+                    count++;
+                    continue;
+                }
+
+                // The list is full, replace the farthest light if this one is closer
+                if (kept == count)
+                    continue;
+
+                int farthest = kept;
+                for (int j = kept + 1; j < count; ++j) {
+                    if (distances[j] > distances[farthest])
+                        farthest = j;
+                }
+
+                if (distance < distances[farthest]) {
+                    found[farthest] = index;
+                    distances[farthest] = distance;
+                }
+            }
+        }
+    }
+
+    qSort(found, found + count);
+
+    for (int i = 0; i < count; ++i)
+        result.append(mLights.at(found[i]).light);
+}
+
+}
@@ -0,0 +1,86 @@
+#ifndef LIGHTGRID_H
+#define LIGHTGRID_H
+
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+#include <gamemath.h>
+using namespace GameMath;
+
+namespace EvilTemple {
+
+class Light;
+class ActiveLights;
+
+/**
+  Assigns the visible lights of a frame to the cells of a grid over the XZ plane, so the lights
+  affecting an object can be found without testing every light for every object drawn.
+
+  The grid covers the area of the visible objects and is divided into the same number of cells
+  along both axes, however large that area is. Every light is stored in the cells its range
+  overlaps, lights outside of the area in the cells along its border.
+
+  Directional lights and lights whose range covers the entire area would be stored in every cell,
+  and their huge ranges would stretch the cells of the other lights. They are kept in a separate
+  list instead, and are always checked before the lights of the cells.
+  */
+class LightGrid
+{
+public:
+    LightGrid();
+
+    /**
+      The number of cells along each axis.
+      */
+    static const int Resolution = 16;
+
+    /**
+      Assigns lights to the grid, replacing the lights of the previous frame.
+      @param area The bounds of the objects that lights will be looked up for.
+      */
+    void build(const QList<const Light*> &lights, const Box3d &area);
+
+    /**
+      Finds the lights whose range reaches an object. A light affects the object if its distance
+      to the object's position is at most the square root of its squared range plus the object's
+      squared extent. Directional lights affect every object. If more lights affect the object than
+      fit into the list, the nearest lights are kept, but lights covering the entire area are never
+      dropped. Lights are listed in the order they were given to build().
+      */
+    void findLights(const Vector4 &position, float extent, ActiveLights &result);
+
+private:
+    struct LightInfo {
+        const Light *light;
+        float x, y, z;
+        float range;
+        bool directional;
+    };
+
+    bool reaches(const LightInfo &info, float x, float y, float z, float extent, float *distance) const;
+
+    int cellX(float x) const;
+    int cellZ(float z) const;
+
+    QVector<LightInfo> mLights;
+
+    // Directional lights and lights covering the entire area, which are not stored in the cells
+    QVector<int> mGlobalLights;
+
+    // The lights of cell i are mCellLights[mCellStart[i]] up to mCellLights[mCellStart[i + 1]]
+    QVector<int> mCellStart;
+    QVector<int> mCellLights;
+
+    // Lights found by the current query are marked with its number, so they're only tested once
+    QVector<uint> mQueries;
+    uint mQuery;
+
+    float mMinX, mMinZ, mMaxX, mMaxZ;
+    float mCellWidth, mCellDepth;
+
+    Q_DISABLE_COPY(LightGrid)
+};
+
+}
+
+#endif // LIGHTGRID_H
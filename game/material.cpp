@@ -156,6 +156,10 @@ static GLenum parseBlendFunction(const QStringRef &stringRef, bool *ok)
     return GL_ZERO;
 }
 
+MaterialPass::MaterialPass() : mBlended(false)
+{
+}
+
 bool MaterialPass::load(QXmlStreamReader *reader)
 {
     Q_ASSERT(reader->name() == "pass");
@@ -391,9 +395,13 @@ bool MaterialPass::load(QXmlStreamReader *reader)
             if (text == "true") {
                 SharedMaterialRenderState renderState(new MaterialEnableState(state));
                 mRenderStates.append(renderState);
+                if (state == GL_BLEND)
+                    mBlended = true;
             } else if (text == "false") {
                 SharedMaterialRenderState renderState(new MaterialDisableState(state));
                 mRenderStates.append(renderState);
+                if (state == GL_BLEND)
+                    mBlended = false;
             } else {
                 reader->raiseError("Boolean (true/false) expected.");
                 return false;
@@ -669,12 +677,12 @@ MaterialRenderState::~MaterialRenderState()
 
 void MaterialBlendFunction::enable()
 {
-    glBlendFunc(mSrcFactor, mDestFactor);
+    GLState::blendFunc(mSrcFactor, mDestFactor);
 }
 
 void MaterialBlendFunction::disable()
 {
-    glBlendFunc(GL_ONE, GL_ZERO);
+    GLState::blendFunc(GL_ONE, GL_ZERO);
 }
 
 }
@@ -17,6 +17,7 @@
 #include <QtGui/QVector4D>
 
 #include "util.h"
+#include "glstate.h"
 
 #include <gamemath.h>
 using namespace GameMath;
@@ -52,11 +53,11 @@ public:
     }
 
     void enable() {
-        glDepthMask(mEnableDepthWrite);
+        GLState::depthMask(mEnableDepthWrite);
     }
 
     void disable() {
-        glDepthMask(true);
+        GLState::depthMask(true);
     }
 private:
     bool mEnableDepthWrite;
@@ -69,10 +70,10 @@ public:
     }
 
     void enable() {
-        glDisable(mState);
+        GLState::disable(mState);
     }
     void disable() {
-        glEnable(mState);
+        GLState::enable(mState);
     }
 private:
     GLenum mState;
@@ -86,11 +87,11 @@ public:
     }
 
     void enable() {
-        glEnable(mState);
+        GLState::enable(mState);
 
     }
     void disable() {
-        glDisable(mState);
+        GLState::disable(mState);
     }
 private:
     GLenum mState;
@@ -453,6 +454,7 @@ inline MaterialTextureSampler::WrapMode MaterialTextureSampler::wrapV() const
 
 class MaterialPass {
 public:
+    MaterialPass();
 
     bool load(QXmlStreamReader *reader);
 
@@ -466,6 +468,11 @@ public:
     const QList<MaterialTextureSampler> &textureSamplers() const;
 
     const QList<SharedMaterialRenderState> &renderStates() const;
+
+    /**
+      Checks whether this pass enables blending, so it has to be drawn after what is behind it.
+      */
+    bool isBlended() const;
 private:
     MaterialShader mVertexShader;
     MaterialShader mFragmentShader;
@@ -473,6 +480,7 @@ private:
     QList<MaterialUniformBinding> mUniformBindings;
     QList<MaterialTextureSampler> mTextureSamplers;
     QList<SharedMaterialRenderState> mRenderStates;
+    bool mBlended;
 };
 
 inline const QList<SharedMaterialRenderState> &MaterialPass::renderStates() const
@@ -480,6 +488,11 @@ inline const QList<SharedMaterialRenderState> &MaterialPass::renderStates() cons
     return mRenderStates;
 }
 
+inline bool MaterialPass::isBlended() const
+{
+    return mBlended;
+}
+
 inline const MaterialShader &MaterialPass::vertexShader() const
 {
     return mVertexShader;
@@ -39,7 +39,7 @@ UniformBinder::~UniformBinder()
 {
 }
 
-MaterialState::MaterialState() : passes((MaterialPassState*)NULL)
+MaterialState::MaterialState() : passes((MaterialPassState*)NULL), blended(false)
 {
     activeMaterialStates++;
 }
@@ -135,6 +135,7 @@ bool MaterialState::createFrom(const Material &material, const RenderStates &sta
 {
     passCount = material.passes().size();
     passes.reset(new MaterialPassState[passCount]);
+    blended = false;
 
     for (int i = 0; i < passCount; ++i) {
         MaterialPassState &passState = passes[i];
@@ -142,6 +143,8 @@ bool MaterialState::createFrom(const Material &material, const RenderStates &sta
         const MaterialPass *pass = material.passes()[i];
 
         passState.renderStates = pass->renderStates();
+        if (pass->isBlended())
+            blended = true;
 
         QByteArray vertexShaderCode = getFullCode(pass->vertexShader());
         QByteArray fragmentShaderCode = getFullCode(pass->fragmentShader());
@@ -17,6 +17,7 @@ using namespace GameMath;
 #include "texture.h"
 #include "texturesource.h"
 #include "glslprogram.h"
+#include "glstate.h"
 
 namespace EvilTemple {
 
@@ -45,35 +46,43 @@ template<typename T> inline void bindUniform(GLint location, const T &uniform) {
 }
 
 template<> inline void bindUniform<Matrix4>(GLint location, const Matrix4 &matrix) {
-    glUniformMatrix4fv(location, 1, false, matrix.data());
+    if (GLState::uniformChanged(location, matrix.data(), 16 * sizeof(float)))
+        glUniformMatrix4fv(location, 1, false, matrix.data());
 }
 
 template<> inline void bindUniform<int>(GLint location, const int &value) {
-    glUniform1i(location, value);
+    if (GLState::uniformChanged(location, &value, sizeof(value)))
+        glUniform1i(location, value);
 }
 
 template<> inline void bindUniform<uint>(GLint location, const uint &value) {
-    glUniform1i(location, value);
+    if (GLState::uniformChanged(location, &value, sizeof(value)))
+        glUniform1i(location, value);
 }
 
 template<> inline void bindUniform<float>(GLint location, const float &value) {
-    glUniform1f(location, value);
+    if (GLState::uniformChanged(location, &value, sizeof(value)))
+        glUniform1f(location, value);
 }
 
 template<> inline void bindUniform<QVector2D>(GLint location, const QVector2D &value) {
-    glUniform2f(location, value.x(), value.y());
+    if (GLState::uniformChanged(location, &value, sizeof(value)))
+        glUniform2f(location, value.x(), value.y());
 }
 
 template<> inline void bindUniform<QVector3D>(GLint location, const QVector3D &value) {
-    glUniform3f(location, value.x(), value.y(), value.z());
+    if (GLState::uniformChanged(location, &value, sizeof(value)))
+        glUniform3f(location, value.x(), value.y(), value.z());
 }
 
 template<> inline void bindUniform<QVector4D>(GLint location, const QVector4D &value) {
-    glUniform4f(location, value.x(), value.y(), value.z(), value.w());
+    if (GLState::uniformChanged(location, &value, sizeof(value)))
+        glUniform4f(location, value.x(), value.y(), value.z(), value.w());
 }
 
 template<> inline void bindUniform<Vector4>(GLint location, const Vector4 &value) {
-    glUniform4fv(location, 1, value.data());
+    if (GLState::uniformChanged(location, value.data(), 4 * sizeof(float)))
+        glUniform4fv(location, 1, value.data());
 }
 
 /**
@@ -92,10 +101,13 @@ public:
     {
         bindUniform<T>(location, mValue);
 
+#if !defined(QT_NO_DEBUG)
+        // Checking for errors waits for the driver, so it's only done in debug builds
         GLenum error = glGetError();
         if (error != GL_NO_ERROR) {
             qWarning("Unable to bind value to uniform location %d: %s.", location, gluErrorString(error));
         }
+#endif
     }
 
 private:
@@ -116,10 +128,12 @@ public:
     {
         bindUniform<T>(location, mRef);
 
+#if !defined(QT_NO_DEBUG)
         GLenum error = glGetError();
         if (error != GL_NO_ERROR) {
             qWarning("Unable to bind ref value to uniform location %d: %s.", location, gluErrorString(error));
         }
+#endif
     }
 private:
     const T &mRef;
@@ -194,12 +208,9 @@ inline void MaterialTextureSamplerState::setWrapMode(GLenum wrapU, GLenum wrapV)
 
 inline void MaterialTextureSamplerState::bind()
 {
-        glActiveTexture(GL_TEXTURE0 + mSamplerId);
-        mTexture->bind();
-        if (mWrapU != GL_REPEAT)
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, mWrapU);
-        if (mWrapV != GL_REPEAT)
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, mWrapV);
+        GLState::activeTexture(GL_TEXTURE0 + mSamplerId);
+        GLState::bindTexture(mTexture->handle());
+        GLState::setTextureWrap(mWrapU, mWrapV);
         // TODO: Set sampler states (wrap+clam+filtering+etc)
 }
 
@@ -256,6 +267,7 @@ public:
 
     int passCount;
     QScopedArrayPointer<MaterialPassState> passes;
+    bool blended; // Any pass enables blending, so objects using this material are drawn back to front
     bool createFrom(const Material &material, const RenderStates &renderState, TextureSource *textureSource = FileTextureSource::instance());
     bool createFromFile(const QString &filename, const RenderStates &renderState, TextureSource *textureSource = FileTextureSource::instance());
     const QString &error() const;
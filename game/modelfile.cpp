@@ -21,7 +21,7 @@ namespace EvilTemple {
     Model::Model()
         : mAnimations((Animation*)0), positions(0), normals(0), texCoords(0), vertices(0), textureData(0), faces(0),
         mRadius(std::numeric_limits<float>::infinity()), mRadiusSquared(std::numeric_limits<float>::infinity()),
-        faceGroups((FaceGroup*)NULL), mNeedsNormalsRecalculated(false),
+        faceGroups((FaceGroup*)NULL), mNeedsNormalsRecalculated(false), mHasBlendedFaces(false),
         mSkeleton(NULL), mBindingPose(NULL)
     {
         activeModels++;
@@ -239,6 +239,9 @@ namespace EvilTemple {
             }
         }
 
+        if (positions)
+            mTriangleBvh.build(positions, faceGroups.data(), faces);
+
         return true;
     }
 
@@ -310,6 +313,7 @@ namespace EvilTemple {
 
         faces = header->groups;
         faceGroups.reset(new FaceGroup[faces]);
+        mHasBlendedFaces = false;
 
         char *currentDataPointer = faceData.data() + sizeof(FacesHeader);
 
@@ -324,6 +328,8 @@ namespace EvilTemple {
             } else {
                 faceGroup->material = mMaterialState[groupHeader->materialId].data();
                 faceGroup->placeholderId = -1;
+                if (faceGroup->material && faceGroup->material->blended)
+                    mHasBlendedFaces = true;
             }
 
             uint groupSize = groupHeader->elementCount * groupHeader->elementSize;
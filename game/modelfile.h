@@ -17,6 +17,7 @@
 #include "animation.h"
 #include "skeleton.h"
 #include "bindingpose.h"
+#include "trianglebvh.h"
 
 #include <gamemath.h>
 using namespace GameMath;
@@ -68,6 +69,11 @@ namespace EvilTemple {
         float radiusSquared() const;
         const Box3d &boundingBox() const;
 
+        /**
+          The hierarchy of this model's triangles in their unanimated positions, used for picking.
+          */
+        const TriangleBvh &triangleBvh() const;
+
         const QString &error() const;
 
         const Skeleton *skeleton() const;
@@ -93,6 +99,12 @@ namespace EvilTemple {
           */
         bool needsNormalsRecalculated() const;
 
+        /**
+          Checks whether any face group is drawn with a blended material. Face groups using a
+          placeholder are not included, since their material is chosen by the instance.
+          */
+        bool hasBlendedFaces() const;
+
     private:
         typedef QHash<QByteArray, const Animation*> AnimationMap;
 
@@ -108,6 +120,8 @@ namespace EvilTemple {
 
         bool mNeedsNormalsRecalculated;
 
+        bool mHasBlendedFaces;
+
         Skeleton *mSkeleton;
 
         BindingPose *mBindingPose;
@@ -123,6 +137,8 @@ namespace EvilTemple {
         float mRadiusSquared;
         Box3d mBoundingBox;
 
+        TriangleBvh mTriangleBvh;
+
         QString mError;
     };
 
@@ -131,6 +147,11 @@ namespace EvilTemple {
         return mNeedsNormalsRecalculated;
     }
 
+    inline bool Model::hasBlendedFaces() const
+    {
+        return mHasBlendedFaces;
+    }
+
     inline const QVector<QByteArray> &Model::placeholders() const
     {
         return mPlaceholders;
@@ -151,6 +172,11 @@ namespace EvilTemple {
         return mBoundingBox;
     }
 
+    inline const TriangleBvh &Model::triangleBvh() const
+    {
+        return mTriangleBvh;
+    }
+
     inline const Skeleton *Model::skeleton() const
     {
         return mSkeleton;
@@ -5,6 +5,7 @@
 #include "modelinstance.h"
 #include "util.h"
 #include "drawhelper.h"
+#include "glstate.h"
 #include "particlesystem.h"
 #include "scenenode.h"
 #include "profiler.h"
@@ -20,7 +21,7 @@ namespace EvilTemple {
         mTransformedPositions(NULL), mTransformedNormals(NULL),
         mCurrentFrameChanged(true), mIdling(true), mLooping(false),
         mDrawsBehindWalls(false), mTimeSinceLastRender(std::numeric_limits<float>::infinity()),
-        mSkeleton(NULL)
+        mSkeleton(NULL), mAnimatedBvhInvalid(true)
     {
     }
 
@@ -45,6 +46,8 @@ namespace EvilTemple {
         mSkeleton = NULL;
 
         mModel = model;
+        mAnimatedBvh = mModel->triangleBvh();
+        mAnimatedBvhInvalid = true;
         mReplacementMaterials.clear();
         mReplacementMaterials.resize(mModel->placeholders().size());
 
@@ -264,7 +267,7 @@ namespace EvilTemple {
             }
         }
 
-        glBindBuffer(GL_ARRAY_BUFFER, positionBuffer->bufferId());
+        GLState::bindBuffer(GL_ARRAY_BUFFER, positionBuffer->bufferId());
         glBufferData(GL_ARRAY_BUFFER, sizeof(Vector4) * model->vertices, transformedPositions, GL_STATIC_DRAW);
 
         // This is extremely costly. Accurately recomputing the normals for each vertex
@@ -297,7 +300,7 @@ namespace EvilTemple {
             }
         }
 
-        glBindBuffer(GL_ARRAY_BUFFER, normalBuffer->bufferId());
+        GLState::bindBuffer(GL_ARRAY_BUFFER, normalBuffer->bufferId());
         glBufferData(GL_ARRAY_BUFFER, sizeof(Vector4) * model->vertices, transformedNormals, GL_STATIC_DRAW);
     }
 
@@ -337,6 +340,7 @@ namespace EvilTemple {
         QVector<uint> mapping = createBoneMapping(mModel->bindingPose(), mModel->skeleton());
 
         animateVertices(mModel, mTransformedPositions, mTransformedNormals, &mPositionBuffer, &mNormalBuffer, mapping);
+        mAnimatedBvhInvalid = true;
 
         for (int i = 0; i < mAddMeshes.size(); ++i) {
             animateVertices(mAddMeshes[i], mTransformedPositionsAddMeshes[i], mTransformedNormalsAddMeshes[i], mPositionBufferAddMeshes[i], mNormalBufferAddMeshes[i],
@@ -630,71 +634,6 @@ namespace EvilTemple {
         return mParentNode->fullTransform();
     }
 
-    /**
-      Intersects the ray with a triangle.
-
-      This algorithm is equivalent to the algorithm presented in Realtime Rendering p.750
-      as RayTriIntersect.
-
-      @param uOut If not null, this pointer receives the barycentric weight of
-                    p1 for the point of intersection. But only if there is an intersection.
-      @param vOut If not null, this pointer receives the barycentric weight of
-                    p2 for the point of intersection. But only if there is an intersection.
-
-      @returns True if the ray shoots through the triangle.
-      */
-    inline bool intersectRay(const Ray3d &ray,
-                           const Vector4 &p0,
-                           const Vector4 &p1,
-                           const Vector4 &p2,
-                           float &distance,
-                           float *uOut = 0,
-                           float *vOut = 0) {
-
-        Vector4 e1 = p1 - p0;
-        Vector4 e2 = p2 - p0;
-
-        Vector4 q = ray.direction().cross(e2);
-        float determinant = e1.dot(q);
-
-        /**
-          If the determinant is close to zero, the ray lies in the plane of the triangle and thus
-          is very unlikely to intersect it.
-          */
-        if (qFuzzyIsNull(determinant))
-            return false;
-
-        float invertedDeterminant = 1 / determinant;
-
-        // Distance from vertex 0 to ray origin
-        Vector4 s = ray.origin() - p0;
-
-        // Calculate the first barycentric coordinate
-        float u = invertedDeterminant * s.dot(q);
-
-        if (u < 0)
-            return false; // Definetly outside the triangle
-
-        Vector4 r = s.cross(e1);
-
-        // Calcaulate the second barycentric coordinate
-        float v = invertedDeterminant * ray.direction().dot(r);
-
-        if (v < 0 || u + v > 1)
-            return false; // Definetly outside the triangle
-
-        // Store u + v for further use
-        if (uOut)
-            *uOut = u;
-        if (vOut)
-            *vOut = v;
-
-        // Calculate the exact point of intersection and then the distance to the ray's origin
-        Vector4 point = (1 - u - v) * p0 + u * p1 + v * p2;
-        distance = (ray.origin() - point).length();
-        return true;
-    }
-
     /*
         Intersects the given ray with this models geometry
      */
@@ -709,28 +648,55 @@ namespace EvilTemple {
             return result;
         }
 
-        Vector4 *positions = mCurrentAnimation ? mTransformedPositions : mModel->positions;
+        if (!mCurrentAnimation) {
+            result.intersects = mModel->triangleBvh().intersect(ray, mModel->positions, result.distance);
+            return result;
+        }
 
-        // Do it per-face
-        for (int i = 0; i < mModel->faces; ++i) {
-            const FaceGroup &group = mModel->faceGroups[i];
+        // The hierarchy is only refit when the instance is picked after it was animated
+        if (mAnimatedBvhInvalid) {
+            mAnimatedBvh.refit(mTransformedPositions);
+            mAnimatedBvhInvalid = false;
+        }
 
-            const QVector<ushort> &indices = group.indices;
+        result.intersects = mAnimatedBvh.intersect(ray, mTransformedPositions, result.distance);
+        return result;
+    }
 
-            for (int j = 0; j < indices.size(); j += 3) {
-                const Vector4 &va = positions[indices[j]];
-                const Vector4 &vb = positions[indices[j+1]];
-                const Vector4 &vc = positions[indices[j+2]];
+    bool ModelInstance::isOpaque() const
+    {
+        if (mModel && mModel->hasBlendedFaces())
+            return false;
 
-                float distance;
-                if (intersectRay(ray, va, vb, vc, distance) && distance < result.distance) {
-                    result.distance = distance;
-                    result.intersects = true;
-                }
-            }
-        }
+        foreach (const SharedModel &addMesh, mAddMeshes)
+            if (addMesh->hasBlendedFaces())
+                return false;
 
-        return result;
+        foreach (const SharedMaterialState &material, mReplacementMaterials)
+            if (material && material->blended)
+                return false;
+
+        return true;
+    }
+
+    /*
+        Instances of the same model share their materials and most of their buffers
+     */
+    void ModelInstance::sortState(uint &program, uint &material) const
+    {
+        program = 0;
+        material = (uint)((quintptr)mModel.data() >> 4); // Models are aligned to 16 bytes
+
+        if (!mModel || !mModel->faces)
+            return;
+
+        const FaceGroup &faceGroup = mModel->faceGroups[0];
+        const MaterialState *state = faceGroup.placeholderId >= 0
+                                     ? mReplacementMaterials[faceGroup.placeholderId].data()
+                                     : faceGroup.material;
+
+        if (state && state->passCount > 0 && state->passes[0].program)
+            program = state->passes[0].program->handle();
     }
 
     bool ModelInstance::overrideMaterial(const QByteArray &name, const SharedMaterialState &state)
@@ -54,6 +54,9 @@ public:
 
     IntersectionResult intersect(const Ray3d &ray) const;
 
+    bool isOpaque() const;
+    void sortState(uint &program, uint &material) const;
+
     const Box3d &boundingBox();
 
     const Matrix4 &worldTransform() const;
@@ -145,6 +148,10 @@ private:
     VertexBufferObject mPositionBuffer;
     VertexBufferObject mNormalBuffer;
 
+    // The model's triangle hierarchy, refit to the animated positions when picking
+    mutable TriangleBvh mAnimatedBvh;
+    mutable bool mAnimatedBvhInvalid;
+
     QList<SharedModel> mAddMeshes;
 
     // These relate to mModel->placeholders()
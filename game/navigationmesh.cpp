@@ -4,13 +4,17 @@
 using namespace GameMath;
 
 #include <vector>
+#include <algorithm>
 #include <limits.h>
 
 #include <QRect>
 #include <QHash>
 #include <QElapsedTimer>
+#include <QThreadStorage>
 
 #include "util.h"
+#include "pathrequests.h"
+#include "binaryheap.h"
 
 namespace EvilTemple {
 
@@ -22,86 +26,132 @@ enum BspNodeType {
     Bsp_Leaf
 };
 
+/**
+  A node of the BSP tree. Nodes refer to each other by index, so the tree can be stored as is.
+  */
 struct BspNode {
-
-    BspNodeType type;
-
-    union {
-        struct {
-            // Leaf node
-            int startIndex;
-            int count;
-        };
-
-        struct {
-            // Splitter node
-            int boundary;
-            BspNode *ltNode; // Node for the less-than part
-            BspNode *geNode; // Node for the greater-than-or-equal part
-        };
-    };
-
+    quint32 type;
+    qint32 boundary; // Splitter nodes only
+    quint32 first; // The less-than child of splitters (followed by the greater-or-equal child) or the first item of leafs
+    quint32 count; // Leaf nodes only
 };
 
 /**
   Allows faster access to rectangles via a BSP tree.
+
+  The nodes are stored in a flat array, with the root first and the two children of a splitter
+  next to each other, and the leafs refer to rectangles by index.
   */
 class RectangleBspTree {
+friend QDataStream &operator <<(QDataStream&, const RectangleBspTree&);
+friend QDataStream &operator >>(QDataStream&, RectangleBspTree&);
 public:
-    RectangleBspTree();
-    ~RectangleBspTree();
-
     void build(const QVector<NavMeshRect> &rectangles);
 
-    const NavMeshRect *find(int x, int y) const;
+    /**
+      Checks that a tree that was read from a file only refers to existing nodes and rectangles.
+      */
+    bool isValid(int rectangleCount) const;
+
+    const NavMeshRect *find(const NavMeshRect *rectangles, int x, int y) const;
+
+    /**
+      Adds the indices of all rectangles that overlap an area (all bounds inclusive) to the result.
+      Rectangles in several leafs may be added more than once.
+      */
+    void findOverlapping(const NavMeshRect *rectangles, int left, int top, int right, int bottom,
+                         QVector<quint32> &result) const;
 
 private:
-    QVector<BspNode*> mNodes;
-    QVector<const NavMeshRect*> mItems;
+    QVector<BspNode> mNodes;
+    QVector<quint32> mItems;
 };
 
-RectangleBspTree::RectangleBspTree()
+const NavMeshRect *RectangleBspTree::find(const NavMeshRect *rectangles, int x, int y) const
 {
-}
+    if (mNodes.isEmpty())
+        return NULL;
 
-RectangleBspTree::~RectangleBspTree()
-{
+    const BspNode *nodes = mNodes.constData();
+    const BspNode *currentNode = nodes;
+
+    while (currentNode->type != Bsp_Leaf) {
+        int coordinate = (currentNode->type == Bsp_HorizontalSplit) ? x : y;
+        currentNode = nodes + currentNode->first + (coordinate >= currentNode->boundary);
+    }
+
+    const quint32 *items = mItems.constData() + currentNode->first;
+
+    for (uint i = 0; i < currentNode->count; ++i) {
+        const NavMeshRect *rect = rectangles + items[i];
+        if (rect->left <= x && rect->top <= y
+            && rect->right >= x && rect->bottom >= y)
+            return rect;
+    }
+
+    return NULL;
 }
 
-const NavMeshRect *RectangleBspTree::find(int x, int y) const
+void RectangleBspTree::findOverlapping(const NavMeshRect *rectangles, int left, int top, int right, int bottom,
+                                       QVector<quint32> &result) const
 {
-    const BspNode *currentNode = mNodes.first();
+    if (mNodes.isEmpty())
+        return;
 
-    int depth = 0;
+    QVector<quint32> pending;
+    pending.append(0);
 
-    forever {
-        switch (currentNode->type) {
-        case Bsp_HorizontalSplit:
-            depth++;
-            if (x < currentNode->boundary)
-                currentNode = currentNode->ltNode;
-            else
-                currentNode = currentNode->geNode;
-            break;
-        case Bsp_VerticalSplit:
-            depth++;
-            if (y < currentNode->boundary)
-                currentNode = currentNode->ltNode;
-            else
-                currentNode = currentNode->geNode;
-            break;
-        case Bsp_Leaf:
-            for (int i = currentNode->startIndex; i < currentNode->startIndex + currentNode->count; ++i) {
-                const NavMeshRect *rect = mItems[i];
-                if (rect->left <= x && rect->top <= y
-                    && rect->right >= x && rect->bottom >= y)
-                    return rect;
+    while (!pending.isEmpty()) {
+        const BspNode &node = mNodes[pending.last()];
+        pending.removeLast();
+
+        if (node.type == Bsp_Leaf) {
+            for (uint i = node.first; i < node.first + node.count; ++i) {
+                const NavMeshRect *rect = rectangles + mItems[i];
+                if (rect->left <= right && rect->right >= left && rect->top <= bottom && rect->bottom >= top)
+                    result.append(mItems[i]);
             }
-            return NULL;
+            continue;
         }
+
+        int low = (node.type == Bsp_HorizontalSplit) ? left : top;
+        int high = (node.type == Bsp_HorizontalSplit) ? right : bottom;
+
+        if (low < node.boundary)
+            pending.append(node.first);
+        if (high >= node.boundary)
+            pending.append(node.first + 1);
     }
 }
 
+bool RectangleBspTree::isValid(int rectangleCount) const
+{
+    if (mNodes.isEmpty())
+        return false;
+
+    for (int i = 0; i < mNodes.size(); ++i) {
+        const BspNode &node = mNodes[i];
+
+        if (node.type == Bsp_Leaf) {
+            if (node.first > (uint)mItems.size() || node.count > mItems.size() - node.first)
+                return false;
+        } else if (node.type == Bsp_HorizontalSplit || node.type == Bsp_VerticalSplit) {
+            // Children always come after their parent, which also rules out cycles
+            if (node.first <= (uint)i || node.first + 1 >= (uint)mNodes.size())
+                return false;
+        } else {
+            return false;
+        }
+    }
+
+    foreach (quint32 item, mItems) {
+        if (item >= (uint)rectangleCount)
+            return false;
+    }
+
+    return true;
+}
+
 /**
   Splits a list of retangles given a horizontal boundary.
   All rectangles that intersect the left half-space are added
@@ -110,19 +160,18 @@ const NavMeshRect *RectangleBspTree::find(int x, int y) const
   be added to both sets if it intersects the boundary.
   */
 static void splitHorizontally(int boundary,
-                const QList<const NavMeshRect*> &rectangles,
-                QList<const NavMeshRect*> &lessThan,
-                QList<const NavMeshRect*> &greaterEqual)
+                const NavMeshRect *rectangles,
+                const QVector<quint32> &items,
+                QVector<quint32> &lessThan,
+                QVector<quint32> &greaterEqual)
 {
-    QList<const NavMeshRect*>::const_iterator it;
-
-    for (it = rectangles.begin(); it != rectangles.end(); ++it) {
-        const NavMeshRect *rect = *it;
+    foreach (quint32 item, items) {
+        const NavMeshRect *rect = rectangles + item;
 
         if (rect->right >= boundary)
-            greaterEqual.append(rect);
+            greaterEqual.append(item);
         if (rect->left < boundary)
-            lessThan.append(rect);
+            lessThan.append(item);
     }
 }
 
@@ -130,65 +179,39 @@ static void splitHorizontally(int boundary,
   This function operates like splitHorizontally, but it interprets the boundary as a positio on the y-axis.
   */
 static void splitVertically(int boundary,
-                const QList<const NavMeshRect*> &rectangles,
-                QList<const NavMeshRect*> &lessThan,
-                QList<const NavMeshRect*> &greaterEqual)
+                const NavMeshRect *rectangles,
+                const QVector<quint32> &items,
+                QVector<quint32> &lessThan,
+                QVector<quint32> &greaterEqual)
 {
-    QList<const NavMeshRect*>::const_iterator it;
-
-    for (it = rectangles.begin(); it != rectangles.end(); ++it) {
-        const NavMeshRect *rect = *it;
+    foreach (quint32 item, items) {
+        const NavMeshRect *rect = rectangles + item;
 
         if (rect->bottom >= boundary)
-            greaterEqual.append(rect);
+            greaterEqual.append(item);
         if (rect->top < boundary)
-            lessThan.append(rect);
+            lessThan.append(item);
     }
 }
 
 struct BspWorkItem {
     int left, right, top, bottom; // Extent of the region to be processed
-    QList<const NavMeshRect*> items; // The items for this work item.
-    BspNode *node; // The node this work item operates on
+    QVector<quint32> items; // The items for this work item.
+    int node; // The node this work item operates on
     bool horizontal; // Indicates splitting direction
 };
 
-static void setBoundingRect(BspWorkItem &item, const QList<const NavMeshRect*> &rectangles)
-{
-    item.left = INT_MAX;
-    item.top = INT_MAX;
-    item.right = INT_MIN;
-    item.bottom = INT_MIN;
-
-    QList<const NavMeshRect*>::const_iterator it;
-
-    for (it = rectangles.begin(); it != rectangles.end(); ++it) {
-        const NavMeshRect *rect = *it;
-
-        if (rect->left < item.left)
-            item.left = rect->left;
-        if (rect->top < item.top)
-            item.top = rect->top;
-        if (rect->right > item.right)
-            item.right = rect->right;
-        if (rect->bottom > item.bottom)
-            item.bottom = rect->bottom;
-    }
-
-    Q_ASSERT(item.left <= item.right);
-    Q_ASSERT(item.top <= item.bottom);
-}
-
 /**
   Tries to find a near-optimal split boundary on the x axis for a list of rectangles.
   It attempts to distribute the rectangles evenly among the two resulting sets.
   */
-static int findHorizontalBoundary(const BspWorkItem &workItem)
+static int findHorizontalBoundary(const NavMeshRect *rectangles, const BspWorkItem &workItem)
 {
     // Create a set of all the X coordinates that may be used as boundaries
     QSet<int> canidates;
 
-    foreach (const NavMeshRect *rect, workItem.items) {
+    foreach (quint32 item, workItem.items) {
+        const NavMeshRect *rect = rectangles + item;
         if (rect->left < workItem.left)
             canidates << workItem.left;
         else
@@ -203,8 +226,8 @@ static int findHorizontalBoundary(const BspWorkItem &workItem)
         uint lessThan = 0;
         uint greaterThan = 0;
 
-        foreach (const NavMeshRect *rect, workItem.items) {
-            if (rect->right >= canidate)
+        foreach (quint32 item, workItem.items) {
+            if (rectangles[item].right >= canidate)
                 greaterThan++;
             else
                 lessThan++;
@@ -223,12 +246,13 @@ static int findHorizontalBoundary(const BspWorkItem &workItem)
 /**
   Tries to find a near-optimal split boundary on the y axis for a list of work items.
   */
-static int findVerticalBoundary(const BspWorkItem &workItem)
+static int findVerticalBoundary(const NavMeshRect *rectangles, const BspWorkItem &workItem)
 {
     // Create a set of all the X coordinates that may be used as boundaries
     QSet<int> canidates;
 
-    foreach (const NavMeshRect *rect, workItem.items) {
+    foreach (quint32 item, workItem.items) {
+        const NavMeshRect *rect = rectangles + item;
         if (rect->top < workItem.top)
             canidates << workItem.top;
         else
@@ -243,8 +267,8 @@ static int findVerticalBoundary(const BspWorkItem &workItem)
         uint lessThan = 0;
         uint greaterThan = 0;
 
-        foreach (const NavMeshRect *rect, workItem.items) {
-            if (rect->bottom >= canidate)
+        foreach (quint32 item, workItem.items) {
+            if (rectangles[item].bottom >= canidate)
                 greaterThan++;
             else
                 lessThan++;
@@ -260,128 +284,133 @@ static int findVerticalBoundary(const BspWorkItem &workItem)
     return solution;
 }
 
-const uint LeafThreshold = 10; // At most 10 items in a leaf
+const int LeafThreshold = 10; // At most 10 items in a leaf
 
 void RectangleBspTree::build(const QVector<NavMeshRect> &rectangles)
 {
+    const NavMeshRect *rects = rectangles.constData();
+
+    mNodes.clear();
+    mItems.clear();
+
     QList<BspWorkItem> workQueue;
 
     BspWorkItem rootItem;
-    for (int i = 0; i < rectangles.size(); ++i)
-        rootItem.items.append(rectangles.data() + i);
-    setBoundingRect(rootItem, rootItem.items);
-    rootItem.node = new BspNode;
+    rootItem.left = rootItem.top = INT_MAX;
+    rootItem.right = rootItem.bottom = INT_MIN;
+    for (int i = 0; i < rectangles.size(); ++i) {
+        const NavMeshRect &rect = rectangles[i];
+        rootItem.items.append(i);
+        rootItem.left = qMin(rootItem.left, rect.left);
+        rootItem.top = qMin(rootItem.top, rect.top);
+        rootItem.right = qMax(rootItem.right, rect.right);
+        rootItem.bottom = qMax(rootItem.bottom, rect.bottom);
+    }
+    rootItem.node = 0;
     rootItem.horizontal = true;
-    mNodes.append(rootItem.node);
 
+    mNodes.resize(1);
     workQueue << rootItem;
 
-    QList<const NavMeshRect*> lessSet, greaterEqualSet;
+    QVector<quint32> lessSet, greaterEqualSet;
 
     while (!workQueue.isEmpty()) {
         BspWorkItem workItem = workQueue.takeFirst();
-
-        // Handle leafs
-        if (workItem.items.size() <= LeafThreshold) {
-            workItem.node->type = Bsp_Leaf;
-            workItem.node->startIndex = mItems.size();
-            workItem.node->count = workItem.items.size();
-            for (int i = 0; i < workItem.items.size(); ++i)
-                mItems.append(workItem.items[i]);
-            continue;
-        }
+        BspNode node;
 
         lessSet.clear();
         greaterEqualSet.clear();
 
-        // Handle horizontals
-        if (workItem.horizontal) {
-            int boundary = findHorizontalBoundary(workItem);
-            splitHorizontally(boundary, workItem.items, lessSet, greaterEqualSet);
-
-            // TODO: This could be improved to use a vertical split instead.
-            if (lessSet.isEmpty() || greaterEqualSet.isEmpty()) {
-                workItem.node->type = Bsp_Leaf;
-                workItem.node->startIndex = mItems.size();
-                workItem.node->count = workItem.items.size();
-                for (int i = 0; i < workItem.items.size(); ++i)
-                    mItems.append(workItem.items[i]);
-                continue;
-            }
-
-            BspWorkItem lesserItem;
-            lesserItem.horizontal = false;
-            lesserItem.items = lessSet;
-            lesserItem.node = new BspNode;
-            mNodes.append(lesserItem.node);
-            lesserItem.top = workItem.top;
-            lesserItem.bottom = workItem.bottom;
-            lesserItem.left = workItem.left;
-            lesserItem.right = boundary - 1;
-
-            BspWorkItem greaterItem;
-            greaterItem.horizontal = false;
-            greaterItem.items = greaterEqualSet;
-            greaterItem.node = new BspNode;
-            mNodes.append(greaterItem.node);
-            greaterItem.top = workItem.top;
-            greaterItem.bottom = workItem.bottom;
-            greaterItem.left = boundary;
-            greaterItem.right = workItem.right;
-
-            workQueue << lesserItem << greaterItem;
+        int boundary = 0;
 
-            workItem.node->type = Bsp_HorizontalSplit;
-            workItem.node->ltNode = lesserItem.node;
-            workItem.node->geNode = greaterItem.node;
-            workItem.node->boundary = boundary;
-            continue;
+        if (workItem.items.size() > LeafThreshold) {
+            if (workItem.horizontal) {
+                boundary = findHorizontalBoundary(rects, workItem);
+                splitHorizontally(boundary, rects, workItem.items, lessSet, greaterEqualSet);
+            } else {
+                boundary = findVerticalBoundary(rects, workItem);
+                splitVertically(boundary, rects, workItem.items, lessSet, greaterEqualSet);
+            }
         }
 
-        // Must be a vertical split here
-        int boundary = findVerticalBoundary(workItem);
-        splitVertically(boundary, workItem.items, lessSet, greaterEqualSet);
-
-        // TODO: This could be improved to use a horizontal split instead.
+        // Handle leafs
+        // TODO: Splits that don't separate anything could be retried on the other axis.
         if (lessSet.isEmpty() || greaterEqualSet.isEmpty()) {
-            workItem.node->type = Bsp_Leaf;
-            workItem.node->startIndex = mItems.size();
-            workItem.node->count = workItem.items.size();
-            for (int i = 0; i < workItem.items.size(); ++i)
-                mItems.append(workItem.items[i]);
+            node.type = Bsp_Leaf;
+            node.boundary = 0;
+            node.first = mItems.size();
+            node.count = workItem.items.size();
+            mItems += workItem.items;
+            mNodes[workItem.node] = node;
             continue;
         }
 
-        BspWorkItem lesserItem;
-        lesserItem.horizontal = true;
+        // The children are added next to each other
+        int firstChild = mNodes.size();
+        mNodes.resize(firstChild + 2);
+
+        BspWorkItem lesserItem = workItem;
+        lesserItem.horizontal = !workItem.horizontal;
         lesserItem.items = lessSet;
-        lesserItem.node = new BspNode;
-        mNodes.append(lesserItem.node);
-        lesserItem.top = workItem.top;
-        lesserItem.bottom = boundary - 1;
-        lesserItem.left = workItem.left;
-        lesserItem.right = workItem.right;
-
-        BspWorkItem greaterItem;
-        greaterItem.horizontal = true;
+        lesserItem.node = firstChild;
+
+        BspWorkItem greaterItem = workItem;
+        greaterItem.horizontal = !workItem.horizontal;
         greaterItem.items = greaterEqualSet;
-        greaterItem.node = new BspNode;
-        mNodes.append(greaterItem.node);
-        greaterItem.top = boundary;
-        greaterItem.bottom = workItem.bottom;
-        greaterItem.left = workItem.left;
-        greaterItem.right = workItem.right;
+        greaterItem.node = firstChild + 1;
+
+        if (workItem.horizontal) {
+            lesserItem.right = boundary - 1;
+            greaterItem.left = boundary;
+            node.type = Bsp_HorizontalSplit;
+        } else {
+            lesserItem.bottom = boundary - 1;
+            greaterItem.top = boundary;
+            node.type = Bsp_VerticalSplit;
+        }
 
         workQueue << lesserItem << greaterItem;
 
-        workItem.node->type = Bsp_VerticalSplit;
-        workItem.node->ltNode = lesserItem.node;
-        workItem.node->geNode = greaterItem.node;
-        workItem.node->boundary = boundary;
+        node.boundary = boundary;
+        node.first = firstChild;
+        node.count = 0;
+        mNodes[workItem.node] = node;
     }
 
 }
 
+QDataStream &operator <<(QDataStream &stream, const RectangleBspTree &tree)
+{
+    stream << (uint)tree.mNodes.size();
+    foreach (const BspNode &node, tree.mNodes)
+        stream << node.type << node.boundary << node.first << node.count;
+
+    stream << (uint)tree.mItems.size();
+    foreach (quint32 item, tree.mItems)
+        stream << item;
+
+    return stream;
+}
+
+QDataStream &operator >>(QDataStream &stream, RectangleBspTree &tree)
+{
+    uint count;
+
+    stream >> count;
+    tree.mNodes.resize(count);
+    for (uint i = 0; i < count; ++i) {
+        BspNode &node = tree.mNodes[i];
+        stream >> node.type >> node.boundary >> node.first >> node.count;
+    }
+
+    stream >> count;
+    tree.mItems.resize(count);
+    for (uint i = 0; i < count; ++i)
+        stream >> tree.mItems[i];
+
+    return stream;
+}
+
 inline static bool westeast_intersect(float z, int left, int right, float xascent, const Vector4 &from, const Vector4 &to, uint minX, uint maxX, Vector4 &intersection)
 {
     // Parallel to the axis -> reject
@@ -442,32 +471,136 @@ inline Vector4 vectorFromPoint(uint x, uint y)
 }
 
 /**
-  Node markings used by AStar
+  State of the portal search, indexed by rectangle. Entries are only valid if they were visited by the
+  current search, so nothing has to be cleared between searches. Every thread keeps its own state,
+  since meshes are searched by the pathfinding workers as well.
   */
-struct AStarNode {
-    const NavMeshRect *rect;
-    AStarNode *parent;
-    const NavMeshPortal *comingFrom;
+struct NavMeshSearch {
+    NavMeshSearch() : searchCount(0)
+    {
+    }
 
-    uint costFromStart;
-    uint costToGoal;
-    uint totalCost;
+    void reset(int rectCount)
+    {
+        if (visited.size() < rectCount) {
+            costs.resize(rectCount);
+            parents.resize(rectCount);
+            portals.resize(rectCount);
+            visited.resize(rectCount);
+        }
 
-    bool inClosedSet;
-    bool inOpenSet;
+        // Stamps of the previous searches would become valid again once the counter wraps
+        if (++searchCount == 0) {
+            visited.fill(0);
+            searchCount = 1;
+        }
+
+        openSet.clear();
+    }
+
+    bool isVisited(int rect) const
+    {
+        return visited[rect] == searchCount;
+    }
+
+    QVector<uint> costs;
+    QVector<int> parents;
+    QVector<const NavMeshPortal*> portals; // The portal the rectangle was entered through
+    QVector<uint> visited;
+    uint searchCount;
+    IndexedBinaryHeap<uint> openSet;
 };
 
-inline uint getDistanceHeuristic(const AStarNode *node, const Vector4 &point) {
-    return (node->comingFrom->center - point).length();
+static QThreadStorage<NavMeshSearch*> navMeshSearches;
+
+inline uint getDistanceHeuristic(const Vector4 &from, const Vector4 &point) {
+    return (from - point).length();
 }
 
-inline uint getTraversalCost(const NavMeshPortal *from, const NavMeshPortal *to) {
-    return (to->center - from->center).length();
+inline uint getTraversalCost(const Vector4 &from, const NavMeshPortal *to) {
+    return (to->center - from).length();
 }
 
-bool compareAStarNodes(const AStarNode *a, const AStarNode *b)
+/**
+  Twice the signed area of the triangle a, b, c on the ground plane.
+  */
+inline static float triangleArea2(const Vector4 &a, const Vector4 &b, const Vector4 &c)
+{
+    float abx = b.x() - a.x();
+    float abz = b.z() - a.z();
+    float acx = c.x() - a.x();
+    float acz = c.z() - a.z();
+    return acx * abz - abx * acz;
+}
+
+inline static bool isSamePoint(const Vector4 &a, const Vector4 &b)
+{
+    return a.x() == b.x() && a.z() == b.z();
+}
+
+/**
+  Finds the shortest path through a corridor of portals (the simple stupid funnel algorithm).
+  The funnel starting at the last corner of the path is narrowed portal by portal. Once one side
+  of the funnel crosses over the other, that side's corner is added to the path and becomes the apex
+  of the next funnel.
+
+  @param lefts The left ends of the portals. The first entry is the start and the last is the end.
+  @param rights The right ends of the portals, which must start and end like lefts.
+  */
+static QVector<Vector4> pullString(const QVector<Vector4> &lefts, const QVector<Vector4> &rights)
 {
-    return a->totalCost < b->totalCost;
+    QVector<Vector4> result;
+
+    Vector4 apex = lefts.first();
+    Vector4 left = lefts.first();
+    Vector4 right = rights.first();
+    int apexIndex = 0, leftIndex = 0, rightIndex = 0;
+
+    result.append(apex);
+
+    for (int i = 1; i < lefts.size(); ++i) {
+        const Vector4 &portalLeft = lefts[i];
+        const Vector4 &portalRight = rights[i];
+
+        // Narrow the right side of the funnel
+        if (triangleArea2(apex, right, portalRight) <= 0) {
+            if (isSamePoint(apex, right) || triangleArea2(apex, left, portalRight) > 0) {
+                right = portalRight;
+                rightIndex = i;
+            } else {
+                // The right side crossed the left side, so the path bends around the left corner
+                result.append(left);
+                apex = left;
+                apexIndex = leftIndex;
+                right = apex;
+                rightIndex = apexIndex;
+                i = apexIndex;
+                continue;
+            }
+        }
+
+        // Narrow the left side of the funnel
+        if (triangleArea2(apex, left, portalLeft) >= 0) {
+            if (isSamePoint(apex, left) || triangleArea2(apex, right, portalLeft) < 0) {
+                left = portalLeft;
+                leftIndex = i;
+            } else {
+                result.append(right);
+                apex = right;
+                apexIndex = rightIndex;
+                left = apex;
+                leftIndex = apexIndex;
+                i = apexIndex;
+                continue;
+            }
+        }
+    }
+
+    // The end may already have become the apex of the last funnel
+    if (!isSamePoint(result.last(), lefts.last()))
+        result.append(lefts.last());
+
+    return result;
 }
 
 bool checkLos(const NavMeshRect *losStartRect, const Vector4 &start, const Vector4 &end)
@@ -528,7 +661,16 @@ bool checkLos(const NavMeshRect *losStartRect, const Vector4 &start, const Vecto
     }
 }
 
-QVector<Vector4> NavigationMesh::findPath(const Vector4 &start, const Vector4 &end) const
+QVector<Vector4> NavigationMesh::findPath(const Vector4 &start, const Vector4 &end,
+                                          const QString &excludedObstacle) const
+{
+    QHash<QString, DynamicObstacle>::const_iterator it = mObstacles.constFind(excludedObstacle);
+
+    return findPath(start, end, (it != mObstacles.constEnd()) ? &it.value() : NULL);
+}
+
+QVector<Vector4> NavigationMesh::findPath(const Vector4 &start, const Vector4 &end,
+                                          const DynamicObstacle *excluded) const
 {
     // Find first and last navmesh tiles
     const NavMeshRect *startRect = findRect(start);
@@ -548,125 +690,148 @@ QVector<Vector4> NavigationMesh::findPath(const Vector4 &start, const Vector4 &e
         return result;
     }
 
-    int touchedNodes = 0;
-
-    QList<AStarNode*> openSet;
-    QHash<const NavMeshRect*, AStarNode*> rectState;
+    if (!navMeshSearches.hasLocalData())
+        navMeshSearches.setLocalData(new NavMeshSearch);
 
-    NavMeshPortal fauxStartPortal;
-    fauxStartPortal.center = start;
-    fauxStartPortal.sideA = NULL;
-    fauxStartPortal.sideB = NULL;
+    NavMeshSearch &search = *navMeshSearches.localData();
+    search.reset(mRectangles.size());
 
-    // Add all the portals accessible from the start position with correct cost
-    AStarNode *startNode = new AStarNode;
-    startNode->rect = startRect;
-    startNode->comingFrom = &fauxStartPortal;
-    startNode->parent = NULL;
-    startNode->inOpenSet = true;
-    startNode->inClosedSet = false;
-    startNode->costFromStart = 0;
-    startNode->costToGoal = getDistanceHeuristic(startNode, end);
-    startNode->totalCost = startNode->costToGoal;
-
-    // Map portal to node
-    rectState[startRect] = startNode;
-    openSet.append(startNode);
+    const NavMeshRect * const rects = mRectangles.constData();
+    int startIndex = startRect - rects;
+    int endIndex = endRect - rects;
 
-    AStarNode *lastNode = NULL;
+    search.costs[startIndex] = 0;
+    search.parents[startIndex] = -1;
+    search.portals[startIndex] = NULL;
+    search.visited[startIndex] = search.searchCount;
+    search.openSet.push(startIndex, getDistanceHeuristic(start, end));
 
-    while (!openSet.isEmpty()) {
-        AStarNode *node = openSet.takeFirst();
-        node->inOpenSet = false;
+    bool found = false;
 
-        touchedNodes++;
+    while (!search.openSet.isEmpty()) {
+        int current = search.openSet.pop();
 
-        if (node->rect == endRect) {
-            lastNode = node;
+        if (current == endIndex) {
+            found = true;
             break; // Reached end successfully.
         }
 
-        uint currentCost = node->costFromStart;
+        const NavMeshRect *rect = rects + current;
+        const NavMeshPortal *comingFrom = search.portals[current];
+        const Vector4 &position = comingFrom ? comingFrom->center : start;
+        uint currentCost = search.costs[current];
 
-        for (int i = 0; i < node->rect->portals.size(); ++i) {
-            const NavMeshPortal *portal = node->rect->portals[i];
+        for (int i = 0; i < rect->portals.size(); ++i) {
+            const NavMeshPortal *portal = rect->portals[i];
 
-            if (portal == node->comingFrom)
+            if (portal == comingFrom || isBlocked(portal, excluded))
                 continue;
 
-            const NavMeshRect *neighbourRect = (portal->sideA == node->rect) ? portal->sideB : portal->sideA;
+            const NavMeshRect *neighbourRect = (portal->sideA == rect) ? portal->sideB : portal->sideA;
+            int neighbour = neighbourRect - rects;
 
-            uint neighbourCost = currentCost + getTraversalCost(node->comingFrom, portal);
+            if (isBlocked(neighbourRect, excluded))
+                continue;
 
-            QHash<const NavMeshRect*,AStarNode*>::iterator it = rectState.find(neighbourRect);
+            uint neighbourCost = currentCost + getTraversalCost(position, portal);
 
-            AStarNode *otherNode;
+            if (search.isVisited(neighbour) && search.costs[neighbour] <= neighbourCost)
+                continue; // Skip, we have already a better path to this node
 
-            if (it != rectState.end()) {
-                otherNode = it.value();
+            search.costs[neighbour] = neighbourCost;
+            search.parents[neighbour] = current;
+            search.portals[neighbour] = portal;
+            search.visited[neighbour] = search.searchCount;
+            search.openSet.push(neighbour, neighbourCost + getDistanceHeuristic(portal->center, end));
+        }
+    }
 
-                if ((otherNode->inClosedSet || otherNode->inOpenSet)
-                    && otherNode->costFromStart <= neighbourCost)
-                    continue; // Skip, we have already a better path to this node
-            } else {
-                otherNode = new AStarNode;
-                rectState[neighbourRect] = otherNode;
-            }
+    if (!found)
+        return result;
 
-            otherNode->comingFrom = portal;
-            otherNode->rect = neighbourRect;
-            otherNode->parent = node;
-            otherNode->costFromStart = neighbourCost;
-            otherNode->costToGoal = getDistanceHeuristic(otherNode, end);
-            otherNode->totalCost = otherNode->costFromStart + otherNode->costToGoal;
-            otherNode->inOpenSet = true;
-            otherNode->inClosedSet = false;
-
-            openSet.append(otherNode);
-            qSort(openSet.begin(), openSet.end(), compareAStarNodes);
+    // Collect the portals along the way, with their ends sorted into left and right in walking direction
+    QVector<Vector4> lefts, rights;
+    lefts.append(end);
+    rights.append(end);
+
+    for (int current = endIndex; current != startIndex; current = search.parents[current]) {
+        const NavMeshPortal *portal = search.portals[current];
+
+        Vector4 first, second;
+        if (portal->axis == NorthSouth) {
+            first = vectorFromPoint(portal->center.x(), portal->start);
+            second = vectorFromPoint(portal->center.x(), portal->end);
+        } else {
+            first = vectorFromPoint(portal->start, portal->center.z());
+            second = vectorFromPoint(portal->end, portal->center.z());
         }
 
-        node->inClosedSet = true;
-    }
+        const Vector4 &from = rects[search.parents[current]].center;
+        if (triangleArea2(from, first, second) < 0)
+            qSwap(first, second);
 
-    if (lastNode) {
-        QVector<const NavMeshRect*> rects;
+        lefts.append(first);
+        rights.append(second);
+    }
 
-        result.append(end);
-        rects.append(endRect);
+    lefts.append(start);
+    rights.append(start);
 
-        AStarNode *node = lastNode;
-        while (node && node->rect != startRect) {
-            const NavMeshPortal *portal = node->comingFrom;
-            result.prepend(portal->center);
-            rects.prepend(node->rect);
-            node = node->parent;
-        }
+    std::reverse(lefts.begin(), lefts.end());
+    std::reverse(rights.begin(), rights.end());
 
-        result.prepend(start);
-        rects.prepend(startRect);
+    return pullString(lefts, rights);
+}
 
-        // Try compressing the path through LOS checks
-        for (int i = 0; i < result.size() - 1; ++i) {
-            const Vector4 &losStart = result.at(i);
-            const NavMeshRect *losStartRect = rects.at(i);
+/**
+  A request made using NavigationMesh::findPathAsync.
+  */
+class NavigationMeshPathJob : public PathJob, public AlignedAllocation
+{
+public:
+    NavigationMeshPathJob(const SharedNavigationMesh &mesh, const Vector4 &start, const Vector4 &end,
+                          const DynamicObstacle *excluded)
+        : mMesh(mesh), mStart(start), mEnd(end), mHasExcluded(excluded != NULL)
+    {
+        // The obstacles of the mesh change on the main thread, so the excluded one is copied
+        if (excluded)
+            mExcluded = *excluded;
+    }
 
-            for (int j = result.size() - 1; j > i + 1; --j) {
-                const Vector4 &losEnd = result.at(j);
+    void run(const PathRequestToken &token)
+    {
+        Q_UNUSED(token); // Searches on the mesh are short, so they're not interrupted
+        if (mMesh)
+            mPath = mMesh->findPath(mStart, mEnd, mHasExcluded ? &mExcluded : NULL);
+    }
 
-                if (checkLos(losStartRect, losStart, losEnd)) {
-                    // Remove all nodes between losStart and losEnd from the intermediate path
-                    result.remove(i + 1, j - (i + 1));
-                    rects.remove(i + 1, j - (i + 1));
-                    break;
-                }
-            }
-        }
+    QVector<Vector4> result()
+    {
+        return mPath;
     }
 
-    qDeleteAll(rectState.values());
+private:
+    SharedNavigationMesh mMesh;
+    Vector4 mStart;
+    Vector4 mEnd;
+    bool mHasExcluded;
+    DynamicObstacle mExcluded;
+    QVector<Vector4> mPath;
+};
 
-    return result;
+uint NavigationMesh::findPathAsync(const SharedNavigationMesh &mesh, const Vector4 &start, const Vector4 &end,
+                                   PathRequests *requests, const QScriptValue &callback,
+                                   const QString &excludedObstacle)
+{
+    const DynamicObstacle *excluded = NULL;
+
+    if (mesh) {
+        QHash<QString, DynamicObstacle>::const_iterator it = mesh->mObstacles.constFind(excludedObstacle);
+        if (it != mesh->mObstacles.constEnd())
+            excluded = &it.value();
+    }
+
+    return requests->submit(new NavigationMeshPathJob(mesh, start, end, excluded), callback);
 }
 
 bool NavigationMesh::hasLineOfSight(const Vector4 &from, const Vector4 &to) const
@@ -681,25 +846,11 @@ bool NavigationMesh::hasLineOfSight(const Vector4 &from, const Vector4 &to) cons
 
 const NavMeshRect *NavigationMesh::findRect(const Vector4 &position) const
 {
-    /*uint x = position.x();
-    uint z = position.z();
-
-    const NavMeshRect * const rects = mRectangles.constData();
-
-    for (int i = 0; i < mRectangles.size(); ++i) {
-        const NavMeshRect *rect = rects + i;
-
-        if (x >= rect->left && x <= rect->right
-            && z >= rect->top && z <= rect->bottom) {
-            return rect;
-        }
-    }
-
-    return NULL;*/
-
-    return mRectangleBspTree->find(position.x(), position.z());
+    return mRectangleBspTree->find(mRectangles.constData(), position.x(), position.z());
 }
 
+const char NavigationMesh::FileMagic[4] = { 'N', 'A', 'V', 'M' };
+
 inline QDataStream &operator >>(QDataStream &stream, NavMeshRect &rect)
 {
     stream >> rect.left >> rect.top >> rect.right >> rect.bottom >> rect.center;
@@ -707,15 +858,24 @@ inline QDataStream &operator >>(QDataStream &stream, NavMeshRect &rect)
     return stream;
 }
 
-QDataStream &operator >>(QDataStream &stream, NavigationMesh &mesh)
+void NavigationMesh::writeHeader(QDataStream &stream)
+{
+    stream.writeRawData(FileMagic, sizeof(FileMagic));
+    stream << (uint)FileVersion;
+}
+
+void NavigationMesh::load(QDataStream &stream, uint version)
 {
     uint count;
 
+    // The format stores single precision floats regardless of how the stream was set up
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
     stream >> count;
 
-    mesh.mRectangles.resize(count);
+    mRectangles.resize(count);
 
-    NavMeshRect * const rects = mesh.mRectangles.data();
+    NavMeshRect * const rects = mRectangles.data();
 
     for (int i = 0; i < count; ++i) {
          stream >> rects[i];
@@ -723,9 +883,9 @@ QDataStream &operator >>(QDataStream &stream, NavigationMesh &mesh)
 
     stream >> count;
 
-    mesh.mPortals.resize(count);
+    mPortals.resize(count);
 
-    NavMeshPortal * const portals = mesh.mPortals.data();
+    NavMeshPortal * const portals = mPortals.data();
 
     for (int i = 0; i < count; ++i) {
         NavMeshPortal *portal = portals + i;
@@ -735,8 +895,8 @@ QDataStream &operator >>(QDataStream &stream, NavigationMesh &mesh)
         stream >> portal->center >> sideAIndex >> sideBIndex
                 >> axis >> portal->start >> portal->end;
 
-        Q_ASSERT(sideAIndex < mesh.mRectangles.size());
-        Q_ASSERT(sideBIndex < mesh.mRectangles.size());
+        Q_ASSERT(sideAIndex < mRectangles.size());
+        Q_ASSERT(sideBIndex < mRectangles.size());
 
         portal->axis = (PortalAxis)axis;
         portal->sideA = rects + sideAIndex;
@@ -746,14 +906,45 @@ QDataStream &operator >>(QDataStream &stream, NavigationMesh &mesh)
         portal->sideB->portals.append(portal);
     }
 
-    // Build the BSP index of the rectangles in this navigation mesh
-    qDebug("Building BSP tree for %d rectangles.", mesh.mRectangles.size());
+    mPortalBlockers.fill(0, mPortals.size());
+    mRectBlockers.fill(0, mRectangles.size());
+
+    if (version >= 2) {
+        stream >> *mRectangleBspTree;
+
+        if (mRectangleBspTree->isValid(mRectangles.size()))
+            return;
+
+        qWarning("The stored BSP tree of the navigation mesh is invalid.");
+    }
+
+    // Older files don't contain the BSP index of the rectangles in this navigation mesh
+    qDebug("Building BSP tree for %d rectangles.", mRectangles.size());
     QElapsedTimer timer;
     timer.start();
-    mesh.mRectangleBspTree->build(mesh.mRectangles);
+    mRectangleBspTree->build(mRectangles);
     qDebug("Finished in %d milliseconds.", timer.elapsed());
+}
 
-    return stream;
+void NavigationMesh::save(QDataStream &stream) const
+{
+    const NavMeshRect * const rects = mRectangles.constData();
+
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    stream << (uint)mRectangles.size();
+
+    foreach (const NavMeshRect &rect, mRectangles)
+        stream << rect.left << rect.top << rect.right << rect.bottom << rect.center;
+
+    stream << (uint)mPortals.size();
+
+    foreach (const NavMeshPortal &portal, mPortals) {
+        stream << portal.center << (uint)(portal.sideA - rects) << (uint)(portal.sideB - rects)
+                << (uint)portal.axis << portal.start << portal.end;
+    }
+
+    stream << *mRectangleBspTree;
 }
 
 QDataStream &operator >>(QDataStream &stream, TaggedRegion &region)
@@ -768,29 +959,120 @@ uint getActiveNavigationMeshes()
     return activeNavigationMeshes;
 }
 
-void NavigationMesh::addDynamicObstacle(const QString &id, const Vector4 &position, uint radius, bool blocksVision)
+/**
+  Checks whether a circle covers a rectangle completely.
+  */
+static bool coversRect(const Vector4 &center, float radius, const NavMeshRect &rect)
 {
-    DynamicObstacle obstacle;
-    obstacle.id = id;
-    obstacle.position = position;
-    obstacle.radius = radius;
-    obstacle.blocksVision = blocksVision;
+    float dx = qMax(qAbs(rect.left - center.x()), qAbs(rect.right - center.x()));
+    float dz = qMax(qAbs(rect.top - center.z()), qAbs(rect.bottom - center.z()));
+    return dx * dx + dz * dz <= radius * radius;
+}
 
-    mObstacles[id] = obstacle;
+/**
+  Checks whether a circle leaves no gap in a portal that an actor as wide as the circle fits through.
+  */
+static bool blocksPortal(const Vector4 &center, float radius, const NavMeshPortal &portal)
+{
+    float across, along;
+
+    if (portal.axis == NorthSouth) {
+        across = center.x() - portal.center.x();
+        along = center.z();
+    } else {
+        across = center.z() - portal.center.z();
+        along = center.x();
+    }
+
+    if (qAbs(across) >= radius)
+        return false;
+
+    // The part of the portal within the circle
+    float halfChord = sqrt(radius * radius - across * across);
+    float coveredStart = along - halfChord;
+    float coveredEnd = along + halfChord;
+
+    if (coveredEnd < portal.start || coveredStart > portal.end)
+        return false;
+
+    float width = 2 * radius;
+    return coveredStart - portal.start < width && portal.end - coveredEnd < width;
 }
 
-void NavigationMesh::changeDynamicObstacle(const QString &id, const Vector4 &position, uint radius, bool blocksVision)
+void NavigationMesh::block(DynamicObstacle &obstacle)
+{
+    const Vector4 &center = obstacle.position;
+    float radius = obstacle.radius;
+
+    QVector<quint32> rects;
+    mRectangleBspTree->findOverlapping(mRectangles.constData(), floor(center.x() - radius), floor(center.z() - radius),
+                                       ceil(center.x() + radius), ceil(center.z() + radius), rects);
+
+    // Rectangles can be in several leafs of the tree
+    std::sort(rects.begin(), rects.end());
+    rects.erase(std::unique(rects.begin(), rects.end()), rects.end());
+
+    obstacle.blockedRects.clear();
+    obstacle.blockedPortals.clear();
+
+    foreach (quint32 index, rects) {
+        const NavMeshRect &rect = mRectangles[index];
+
+        if (coversRect(center, radius, rect)) {
+            obstacle.blockedRects.append(index);
+            mRectBlockers[index].ref();
+        }
+
+        foreach (const NavMeshPortal *portal, rect.portals) {
+            uint portalIndex = portal - mPortals.constData();
+
+            // Portals are shared by two rectangles, which may both overlap the obstacle
+            if (!obstacle.blockedPortals.contains(portalIndex) && blocksPortal(center, radius, *portal)) {
+                obstacle.blockedPortals.append(portalIndex);
+                mPortalBlockers[portalIndex].ref();
+            }
+        }
+    }
+}
+
+void NavigationMesh::unblock(DynamicObstacle &obstacle)
+{
+    foreach (uint index, obstacle.blockedRects)
+        mRectBlockers[index].deref();
+    foreach (uint index, obstacle.blockedPortals)
+        mPortalBlockers[index].deref();
+
+    obstacle.blockedRects.clear();
+    obstacle.blockedPortals.clear();
+}
+
+void NavigationMesh::addDynamicObstacle(const QString &id, const Vector4 &position, float radius, bool blocksVision)
+{
+    changeDynamicObstacle(id, position, radius, blocksVision);
+}
+
+void NavigationMesh::changeDynamicObstacle(const QString &id, const Vector4 &position, float radius, bool blocksVision)
 {
     DynamicObstacle &obstacle = mObstacles[id];
+    unblock(obstacle);
+
     obstacle.id = id;
     obstacle.position = position;
     obstacle.radius = radius;
     obstacle.blocksVision = blocksVision;
+
+    block(obstacle);
 }
 
 void NavigationMesh::removeDynamicObstacle(const QString &id)
 {
-    mObstacles.remove(id);
+    QHash<QString, DynamicObstacle>::iterator it = mObstacles.find(id);
+
+    if (it == mObstacles.end())
+        return;
+
+    unblock(*it);
+    mObstacles.erase(it);
 }
 
 }
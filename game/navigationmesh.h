@@ -10,9 +10,15 @@ using namespace GameMath;
 #include <QtGlobal>
 #include <QSharedPointer>
 #include <QVariant>
+#include <QScriptValue>
+#include <QAtomicInt>
+
+#include "gameglobal.h"
 
 namespace EvilTemple {
 
+class PathRequests;
+
 uint getActiveNavigationMeshes();
 
 struct NavMeshPortal;
@@ -58,39 +64,117 @@ class RectangleBspTree;
 struct DynamicObstacle : public AlignedAllocation
 {
     Vector4 position;
-    uint radius;
+    float radius;
     QString id;
     bool blocksVision;
+
+    // The indices of the portals and rectangles the obstacle blocks
+    QVector<uint> blockedPortals;
+    QVector<uint> blockedRects;
 };
 
-class NavigationMesh
+/**
+  A mesh of walkable rectangles that are connected by portals.
+
+  Meshes are stored in the regions file of a map, which starts with a header (see writeHeader),
+  followed by the walkable and the flyable mesh. Files without a header are from version 1, which
+  didn't store the BSP tree used to find the rectangle at a position. It is built while loading
+  these files instead.
+  */
+class GAME_EXPORT NavigationMesh
 {
-friend QDataStream &operator >>(QDataStream&, NavigationMesh&);
 public:
+    enum {
+        FileVersion = 2
+    };
+
+    static const char FileMagic[4];
+
     NavigationMesh();
     ~NavigationMesh();
 
+    /**
+      Reads a mesh in the format of the given file version.
+      */
+    void load(QDataStream &stream, uint version);
+
+    /**
+      Writes the mesh in the format of the current file version.
+      */
+    void save(QDataStream &stream) const;
+
+    /**
+      Writes the header of a regions file, which has to precede the meshes.
+      */
+    static void writeHeader(QDataStream &stream);
+
     const QVector<NavMeshRect> &rectangles() const;
     const QVector<NavMeshPortal> &portals() const;
 
-    QVector<Vector4> findPath(const Vector4 &start, const Vector4 &end) const;
+    /**
+      Finds a path that avoids blocked portals and rectangles (see addDynamicObstacle). Actors are
+      usually obstacles themselves, so the obstacle with the given id doesn't block anything for
+      this search, which lets the actor leave its position.
+      */
+    QVector<Vector4> findPath(const Vector4 &start, const Vector4 &end,
+                              const QString &excludedObstacle = QString()) const;
+
+    /**
+      Finds a path on a worker thread. The search keeps a reference to the mesh, so the mesh stays
+      valid even if the map is unloaded in the meantime. The rectangles and portals are immutable
+      after loading. The blocker counts of obstacles are atomic and change concurrently, so a
+      search running while obstacles move may see a stale snapshot of them, but every count it
+      reads is consistent.
+
+      @return The identifier of the request in the given queue.
+      */
+    static uint findPathAsync(const QSharedPointer<NavigationMesh> &mesh, const Vector4 &start, const Vector4 &end,
+                              PathRequests *requests, const QScriptValue &callback,
+                              const QString &excludedObstacle = QString());
 
     bool hasLineOfSight(const Vector4 &from, const Vector4 &to) const;
 
     const NavMeshRect *findRect(const Vector4 &position) const;
 
-    void addDynamicObstacle(const QString &id, const Vector4 &position, uint radius, bool blocksVision);
-    void changeDynamicObstacle(const QString &id, const Vector4 &position, uint radius, bool blocksVision);
+    /**
+      Adds an obstacle that paths have to go around. The obstacle blocks all portals it leaves no
+      gap in that is as wide as the obstacle itself, and all rectangles it covers completely.
+      Only the rectangles around the obstacle are checked, which are found using the BSP tree.
+      */
+    void addDynamicObstacle(const QString &id, const Vector4 &position, float radius, bool blocksVision);
+
+    /**
+      Moves or resizes an obstacle, or adds it if it doesn't exist yet. Only the portals and
+      rectangles around its old and new position are updated.
+      */
+    void changeDynamicObstacle(const QString &id, const Vector4 &position, float radius, bool blocksVision);
     void removeDynamicObstacle(const QString &id);
 
+    /**
+      Checks whether any obstacle blocks a portal or rectangle of this mesh.
+      */
+    bool isBlocked(const NavMeshPortal *portal) const;
+    bool isBlocked(const NavMeshRect *rect) const;
+
 private:
+    friend class NavigationMeshPathJob;
+
+    QVector<Vector4> findPath(const Vector4 &start, const Vector4 &end, const DynamicObstacle *excluded) const;
+    bool isBlocked(const NavMeshPortal *portal, const DynamicObstacle *excluded) const;
+    bool isBlocked(const NavMeshRect *rect, const DynamicObstacle *excluded) const;
+
+    void block(DynamicObstacle &obstacle);
+    void unblock(DynamicObstacle &obstacle);
+
     QHash<QString, DynamicObstacle> mObstacles;
     QVector<NavMeshRect> mRectangles;
     QVector<NavMeshPortal> mPortals;
     RectangleBspTree *mRectangleBspTree;
-};
 
-QDataStream &operator >>(QDataStream &stream, NavigationMesh &mesh);
+    // The number of obstacles blocking each portal and rectangle. Searches on worker threads read them.
+    QVector<QAtomicInt> mPortalBlockers;
+    QVector<QAtomicInt> mRectBlockers;
+};
 
 typedef QSharedPointer<NavigationMesh> SharedNavigationMesh;
 
@@ -104,6 +188,34 @@ inline const QVector<NavMeshPortal> &NavigationMesh::portals() const
     return mPortals;
 }
 
+inline bool NavigationMesh::isBlocked(const NavMeshPortal *portal) const
+{
+    return mPortalBlockers[portal - mPortals.constData()] != 0;
+}
+
+inline bool NavigationMesh::isBlocked(const NavMeshRect *rect) const
+{
+    return mRectBlockers[rect - mRectangles.constData()] != 0;
+}
+
+inline bool NavigationMesh::isBlocked(const NavMeshPortal *portal, const DynamicObstacle *excluded) const
+{
+    uint index = portal - mPortals.constData();
+    int blockers = mPortalBlockers[index];
+    if (excluded && excluded->blockedPortals.contains(index))
+        blockers--;
+    return blockers > 0;
+}
+
+inline bool NavigationMesh::isBlocked(const NavMeshRect *rect, const DynamicObstacle *excluded) const
+{
+    uint index = rect - mRectangles.constData();
+    int blockers = mRectBlockers[index];
+    if (excluded && excluded->blockedRects.contains(index))
+        blockers--;
+    return blockers > 0;
+}
+
 }
 
 #endif // NAVIGATIONMESH_H
@@ -0,0 +1,130 @@
+
+#include "pathcache.h"
+
+namespace EvilTemple {
+
+PathCache::PathCache(int capacity)
+    : mCapacity(capacity), mFirst(NULL), mLast(NULL), mHits(0), mMisses(0), mInvalidations(0)
+{
+}
+
+PathCache::~PathCache()
+{
+    clear();
+}
+
+void PathCache::link(Entry *entry)
+{
+    entry->previous = NULL;
+    entry->next = mFirst;
+
+    if (mFirst)
+        mFirst->previous = entry;
+    else
+        mLast = entry;
+
+    mFirst = entry;
+}
+
+void PathCache::unlink(Entry *entry)
+{
+    if (entry->previous)
+        entry->previous->next = entry->next;
+    else
+        mFirst = entry->next;
+
+    if (entry->next)
+        entry->next->previous = entry->previous;
+    else
+        mLast = entry->previous;
+}
+
+void PathCache::remove(Entry *entry)
+{
+    unlink(entry);
+    mEntries.remove(entry->key);
+    delete entry;
+}
+
+bool PathCache::find(const PathCacheKey &key, QVector<QPoint> &tiles)
+{
+    Entry *entry = mEntries.value(key, NULL);
+
+    if (!entry) {
+        mMisses++;
+        return false;
+    }
+
+    mHits++;
+
+    if (entry != mFirst) {
+        unlink(entry);
+        link(entry);
+    }
+
+    tiles = entry->tiles;
+    return true;
+}
+
+void PathCache::insert(const PathCacheKey &key, const QVector<QPoint> &tiles)
+{
+    if (mCapacity <= 0 || tiles.isEmpty())
+        return;
+
+    Entry *entry = mEntries.value(key, NULL);
+
+    if (entry) {
+        unlink(entry);
+    } else {
+        if (mEntries.size() >= mCapacity)
+            remove(mLast);
+
+        entry = new Entry(key);
+        mEntries.insert(key, entry);
+    }
+
+    entry->tiles = tiles;
+
+    QRect bounds(tiles.first(), QSize(1, 1));
+    foreach (const QPoint &tile, tiles)
+        bounds |= QRect(tile, QSize(1, 1));
+
+    // A blocked tile within the radius of the actor blocks the path
+    entry->bounds = bounds.adjusted(-key.radius, -key.radius, key.radius, key.radius);
+
+    link(entry);
+}
+
+void PathCache::invalidate(const QRect &area)
+{
+    Entry *entry = mFirst;
+
+    while (entry) {
+        Entry *next = entry->next;
+
+        if (entry->bounds.intersects(area)) {
+            int radius = entry->key.radius;
+            QRect blocking = area.adjusted(-radius, -radius, radius, radius);
+
+            foreach (const QPoint &tile, entry->tiles) {
+                if (blocking.contains(tile)) {
+                    remove(entry);
+                    mInvalidations++;
+                    break;
+                }
+            }
+        }
+
+        entry = next;
+    }
+}
+
+void PathCache::clear()
+{
+    qDeleteAll(mEntries);
+    mEntries.clear();
+    mFirst = NULL;
+    mLast = NULL;
+}
+
+}
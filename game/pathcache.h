@@ -0,0 +1,138 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <QtCore/QHash>
+#include <QtCore/QPoint>
+#include <QtCore/QRect>
+#include <QtCore/QVector>
+
+namespace EvilTemple {
+
+/**
+  Identifies a path request by the tiles involved and the parameters that influence the result.
+  */
+struct PathCacheKey {
+    PathCacheKey(const QPoint &start, const QPoint &goal, int radius, int range, int mode);
+
+    QPoint start;
+    QPoint goal;
+    int radius;
+    int range; // -1 for paths that have to reach the goal tile
+    int mode;
+
+    bool operator ==(const PathCacheKey &other) const;
+};
+
+uint qHash(const PathCacheKey &key);
+
+/**
+  A bounded cache of path search results that evicts the least recently used paths first.
+
+  The cache stores the tiles of successful searches. When the passability of tiles changes,
+  the paths that come close enough to the changed tiles to be blocked are removed. Paths that
+  may have become longer than necessary, because tiles elsewhere became passable, are kept.
+  */
+class PathCache
+{
+public:
+    explicit PathCache(int capacity = 256);
+    ~PathCache();
+
+    /**
+      Looks up the tiles of a cached path and marks it as recently used.
+      @return True if the path was cached.
+      */
+    bool find(const PathCacheKey &key, QVector<QPoint> &tiles);
+
+    /**
+      Adds a path to the cache, evicting the least recently used path if the cache is full.
+      */
+    void insert(const PathCacheKey &key, const QVector<QPoint> &tiles);
+
+    /**
+      Removes all paths that an actor can no longer walk along if tiles in the given area became blocked.
+      */
+    void invalidate(const QRect &area);
+
+    void clear();
+
+    int size() const;
+    int capacity() const;
+
+    uint hits() const;
+    uint misses() const;
+    uint invalidations() const;
+
+private:
+    struct Entry {
+        Entry(const PathCacheKey &_key) : key(_key) {}
+
+        PathCacheKey key;
+        QVector<QPoint> tiles;
+        QRect bounds; // The tiles that may block this path
+        Entry *previous; // Towards the most recently used entry
+        Entry *next;
+    };
+
+    void link(Entry *entry);
+    void unlink(Entry *entry);
+    void remove(Entry *entry);
+
+    int mCapacity;
+    QHash<PathCacheKey, Entry*> mEntries;
+    Entry *mFirst; // Most recently used
+    Entry *mLast; // Least recently used
+
+    uint mHits;
+    uint mMisses;
+    uint mInvalidations;
+
+    Q_DISABLE_COPY(PathCache)
+};
+
+inline PathCacheKey::PathCacheKey(const QPoint &_start, const QPoint &_goal, int _radius, int _range, int _mode)
+    : start(_start), goal(_goal), radius(_radius), range(_range), mode(_mode)
+{
+}
+
+inline bool PathCacheKey::operator ==(const PathCacheKey &other) const
+{
+    return start == other.start && goal == other.goal && radius == other.radius
+            && range == other.range && mode == other.mode;
+}
+
+inline uint qHash(const PathCacheKey &key)
+{
+    return ((key.start.x() << 16) ^ key.start.y()) * 31
+            + ((key.goal.x() << 16) ^ key.goal.y()) * 17
+            + (key.radius << 8) + (key.range << 2) + key.mode;
+}
+
+inline int PathCache::size() const
+{
+    return mEntries.size();
+}
+
+inline int PathCache::capacity() const
+{
+    return mCapacity;
+}
+
+inline uint PathCache::hits() const
+{
+    return mHits;
+}
+
+inline uint PathCache::misses() const
+{
+    return mMisses;
+}
+
+inline uint PathCache::invalidations() const
+{
+    return mInvalidations;
+}
+
+}
+
+#endif // PATHCACHE_H
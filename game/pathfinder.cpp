@@ -1,18 +1,42 @@
+#include <QElapsedTimer>
+#include <QThreadStorage>
+
 #include "pathfinder.h"
+#include "tilesearch.h"
+#include "clustergraph.h"
+#include "componentmap.h"
+#include "pathcache.h"
+#include "pathrequests.h"
+#include "flowfield.h"
+
+#include <common/gridline.h>
 
-inline static uint qHash(const QPoint &key)
+inline uint qHash(const QPoint &key)
 {
-    return ((key.x() << 16) & 0xFFFF0000)
-            | (key.y() & 0xFFFF);
+    return qHash((key.x() << 16) & 0xFFFF0000 | (key.y() & 0xFFFF));
 }
 
 namespace EvilTemple {
 
 Pathfinder::Pathfinder(QObject *parent) :
-    QObject(parent)
+    QObject(parent), mSearch(new TileSearch), mSearchMode(FlatSearch), mSmoothPaths(true),
+    mPathCache(new PathCache),
+    mNextFlowFieldId(1), mPathRequests(new PathRequests(this)), mGeneration(0)
+{
+}
+
+Pathfinder::~Pathfinder()
 {
+    qDeleteAll(mClusterGraphs);
+    qDeleteAll(mComponentMaps);
 }
 
+/*
+  The number of flow fields kept around. Fields cover large areas, and scripts usually only
+  move one group at a time.
+  */
+static const int MaxFlowFields = 8;
+
 static Vector4 tileToPosition(const QPoint &tile) {
     return Vector4(tile.x() * TileInfo::UnitsPerTile,
                    0,
@@ -26,126 +50,563 @@ static QPoint positionToTile(const Vector4 &position) {
 
 inline static bool canStandAtTile(const TileInfo *tileInfo, const QPoint &pos, int radius)
 {
-    int sqradius = radius * radius;
+    return tileInfo->canStandOnTile(pos.x(), pos.y(), radius);
+}
 
-    for (int cx = - radius; cx <= radius; ++cx) {
-        int cxs = cx * cx;
+/**
+  Passability functor for tile searches that checks whether an actor of a given size fits onto a tile.
+  If an exclusion is given, the occupant it excludes is ignored.
+  */
+struct StandableTile {
+    StandableTile(const TileInfo *_tileInfo, int _radius, const OccupantExclusion *_exclusion = NULL)
+        : tileInfo(_tileInfo), radius(_radius), exclusion(_exclusion)
+    {
+    }
 
-        for (int cy = - radius; cy <= radius; ++cy) {
-            int dist = cxs + cy * cy;
+    inline bool operator()(int x, int y) const
+    {
+        if (exclusion && exclusion->contains(x, y))
+            return exclusion->canStand(x, y);
+        return canStandAtTile(tileInfo, QPoint(x, y), radius);
+    }
 
-            if (dist <= sqradius && !tileInfo->isTileWalkable(pos.x() + cx, pos.y() + cy)) {
-                return false;
-            }
-        }
+    inline bool operator()(const QPoint &tile) const
+    {
+        return (*this)(tile.x(), tile.y());
     }
 
+    const TileInfo *tileInfo;
+    int radius;
+    const OccupantExclusion *exclusion;
+};
+
+/**
+  Passability functor for lines of sight, which are only blocked by tiles that can't be flown over.
+  */
+struct FlyableTile {
+    FlyableTile(const TileInfo *_tileInfo) : tileInfo(_tileInfo)
+    {
+    }
+
+    inline bool operator()(int x, int y) const
+    {
+        return tileInfo->isTileFlyable(x, y);
+    }
+
+    const TileInfo *tileInfo;
+};
+
+// Compares positions exactly, unlike the tile-based comparisons elsewhere
+static bool samePositions(const QVector<Vector4> &a, const QVector<Vector4> &b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (int i = 0; i < a.size(); ++i)
+        if (a[i].x() != b[i].x() || a[i].y() != b[i].y() || a[i].z() != b[i].z())
+            return false;
+
     return true;
 }
 
-struct AStarNodeFast {
-    QPoint tile;
-    const AStarNodeFast *comingFrom;
-    uint costFromStart;
-    uint costToGoal;
-    uint totalCost;
+/**
+  Converts the tiles of a path into positions. The exact start and end positions replace the first
+  and last tile.
+  */
+static QVector<Vector4> pathFromTiles(const QVector<QPoint> &tiles, const Vector4 &start, const Vector4 &end)
+{
+    QVector<Vector4> result;
+
+    if (!tiles.isEmpty()) {
+        result.reserve(tiles.size() + 1);
+        result.append(start);
+        for (int i = 1; i < tiles.size() - 1; ++i)
+            result.append(tileToPosition(tiles[i]));
+        result.append(end);
+    }
+
+    return result;
+}
+
+/**
+  Passability functor for searches on worker threads, which only have a copy of the clearance map.
+  Once the request is cancelled, every tile is treated as blocked, which ends the search quickly.
+  */
+struct ClearanceStandable {
+    ClearanceStandable(const ClearanceMap &_clearance, int _radius, const OccupantExclusion *_exclusion,
+                       const PathRequestToken &_token)
+        : clearance(_clearance), radius(_radius), exclusion(_exclusion), token(_token)
+    {
+    }
+
+    inline bool operator()(int x, int y) const
+    {
+        if (token.isCancelled())
+            return false;
+        if (exclusion && exclusion->contains(x, y))
+            return exclusion->canStand(x, y);
+        return clearance.canStand(x, y, radius);
+    }
 
-    bool inClosedSet;
-    bool inOpenSet;
+    const ClearanceMap &clearance;
+    int radius;
+    const OccupantExclusion *exclusion;
+    const PathRequestToken &token;
 };
 
-inline static uint getDistanceHeuristic(const QPoint &from, const QPoint &to) {
-    return (to - from).manhattanLength();
+// Every worker thread keeps its own search state around
+static QThreadStorage<TileSearch*> workerSearches;
+
+/**
+  A request made using Pathfinder::findPathAsync. Requests that can be answered right away
+  only carry their result.
+  */
+class TilePathJob : public PathJob, public AlignedAllocation
+{
+public:
+    TilePathJob(Pathfinder *pathfinder, const Vector4 &start, const Vector4 &end, const PathCacheKey &key)
+        : mPathfinder(pathfinder), mStart(start), mEnd(end), mKey(key), mHasMap(false),
+          mHasExclusion(false), mSearch(false), mSmooth(false), mGeneration(0)
+    {
+    }
+
+    void setTiles(const QVector<QPoint> &tiles)
+    {
+        mTiles = tiles;
+    }
+
+    /**
+      Gives the job a copy of the map, which is needed to search or smooth the path.
+      */
+    void setMap(const ClearanceMap &clearance, const OccupantExclusion *exclusion)
+    {
+        mHasMap = true;
+        mClearance = clearance;
+        mHasExclusion = (exclusion != NULL);
+        if (exclusion)
+            mExclusion = *exclusion;
+    }
+
+    void setSearch(uint generation)
+    {
+        mSearch = true;
+        mGeneration = generation;
+    }
+
+    void setSmooth(bool smooth)
+    {
+        mSmooth = smooth;
+    }
+
+    void run(const PathRequestToken &token)
+    {
+        mWaypoints = mTiles;
+
+        if (!mHasMap)
+            return;
+
+        ClearanceStandable passable(mClearance, mKey.radius, mHasExclusion ? &mExclusion : NULL, token);
+
+        if (mSearch) {
+            if (!workerSearches.hasLocalData())
+                workerSearches.setLocalData(new TileSearch);
+
+            TileSearch *search = workerSearches.localData();
+            uint lastNode;
+            if (mKey.mode == Pathfinder::JumpPointSearch)
+                lastNode = search->findJumpPath(mKey.start, passable, TileGoal(mKey.goal));
+            else
+                lastNode = search->findPath(mKey.start, passable, TileGoal(mKey.goal));
+
+            if (lastNode != TileSearch::NoNode && !token.isCancelled())
+                mTiles = search->tracePath(lastNode);
+        }
+
+        if (mSmooth)
+            mWaypoints = smoothPath(mTiles, passable);
+        else
+            mWaypoints = mTiles;
+    }
+
+    QVector<Vector4> result()
+    {
+        if (mSearch)
+            mPathfinder->pathSearched(mKey, mTiles, mGeneration);
+
+        return pathFromTiles(mWaypoints, mStart, mEnd);
+    }
+
+private:
+    Pathfinder *mPathfinder;
+    Vector4 mStart;
+    Vector4 mEnd;
+    PathCacheKey mKey;
+    QVector<QPoint> mTiles; // Every tile along the path, which is what the cache needs
+    QVector<QPoint> mWaypoints;
+
+    bool mHasMap;
+    ClearanceMap mClearance; // A copy, which isn't affected by later changes to the map
+    bool mHasExclusion;
+    OccupantExclusion mExclusion;
+
+    bool mSearch;
+    bool mSmooth;
+    uint mGeneration;
+};
+
+/**
+  Returns the components an actor can start moving in. If the actor is an obstacle itself, it
+  can leave the tiles it occupies into any of the components around them.
+  */
+static QVector<uint> startComponents(const ComponentMap *components, const QPoint &start,
+                                     const OccupantExclusion *exclusion)
+{
+    QVector<uint> result;
+
+    if (!exclusion) {
+        if (uint component = components->component(start))
+            result.append(component);
+        return result;
+    }
+
+    QRect ring = exclusion->area.adjusted(-1, -1, 1, 1);
+
+    for (int y = ring.top(); y <= ring.bottom(); ++y) {
+        for (int x = ring.left(); x <= ring.right(); ++x) {
+            if (exclusion->contains(x, y))
+                continue;
+
+            uint component = components->component(QPoint(x, y));
+            if (component && !result.contains(component))
+                result.append(component);
+        }
+    }
+
+    return result;
 }
 
-inline static bool compareAStarNodeFasts(const AStarNodeFast *a, const AStarNodeFast *b)
+/**
+  Checks whether any tile in range of a target is in one of the components the actor can start in.
+  Tiles around an excluded occupant can't be ruled out by their component.
+  */
+static bool isRangeConnected(const ComponentMap *components, const QPoint &start, const OccupantExclusion *exclusion,
+                             const QPoint &target, int range)
 {
-    return a->totalCost < b->totalCost;
+    QVector<uint> starts = startComponents(components, start, exclusion);
+
+    if (starts.isEmpty())
+        return false;
+
+    int sqrange = range * range;
+
+    for (int y = -range; y <= range; ++y) {
+        for (int x = -range; x <= range; ++x) {
+            if (x * x + y * y > sqrange)
+                continue;
+
+            QPoint tile = target + QPoint(x, y);
+
+            if ((exclusion && exclusion->contains(tile.x(), tile.y()))
+                || starts.contains(components->component(tile)))
+                return true;
+        }
+    }
+
+    return false;
 }
 
-void addNeighbourNodes(const AStarNodeFast *node,
-                       const TileInfo *tileInfo,
-                       int radius,
-                       const QPoint &endTile,
-                       QHash<QPoint,AStarNodeFast*> &state,
-                       QList<AStarNodeFast*> &openSet);
+const Pathfinder::Obstacle *Pathfinder::obstacleAt(const QPoint &tile) const
+{
+    QMultiHash<QPoint, QString>::const_iterator it = mObstacleTiles.constFind(tile);
 
-QVector<Vector4> Pathfinder::findPath(const Vector4 &start, const Vector4 &end, float actorRadius) const
+    if (it == mObstacleTiles.constEnd())
+        return NULL;
+
+    return &mObstacles.constFind(it.value()).value();
+}
+
+bool Pathfinder::excludeOwnObstacle(const QPoint &start, int radius, OccupantExclusion *exclusion) const
 {
-    TileInfo *tileInfo = mTileInfo;
-    QVector<Vector4> result;
+    // The actor moving along the path is usually an obstacle itself, centered on the start tile
+    const Obstacle *obstacle = obstacleAt(start);
 
-    if (!tileInfo) {
-        qWarning("Called Pathfinder::findPath without setting the tile info property first.");
+    if (!obstacle)
+        return false;
+
+    *exclusion = mTileInfo->excludeOccupant(obstacle->tile, obstacle->tileRadius, radius);
+    return true;
+}
+
+ClusterGraph *Pathfinder::clusterGraph(int radius) const
+{
+    ClusterGraph *graph = mClusterGraphs.value(radius, NULL);
+
+    if (!graph) {
+        mTileInfo->reserveClearance(radius);
+        graph = new ClusterGraph(mTileInfo, radius);
+        mClusterGraphs.insert(radius, graph);
+    }
+
+    return graph;
+}
+
+ComponentMap *Pathfinder::componentMap(int radius) const
+{
+    ComponentMap *components = mComponentMaps.value(radius, NULL);
+
+    if (!components) {
+        // Every query for an actor size builds its component map first
+        mTileInfo->reserveClearance(radius);
+        components = new ComponentMap(mTileInfo, radius);
+        mComponentMaps.insert(radius, components);
+    }
+
+    return components;
+}
+
+void Pathfinder::tilesChanged(const QRect &area)
+{
+    mGeneration++;
+
+    foreach (ClusterGraph *graph, mClusterGraphs)
+        graph->invalidate(area);
+
+    foreach (ComponentMap *components, mComponentMaps)
+        components->update(area);
+
+    foreach (const FlowFieldEntry &entry, mFlowFields)
+        entry.field->invalidate(area);
+
+    mPathCache->invalidate(area);
+}
+
+QVariantMap Pathfinder::pathCacheStatistics() const
+{
+    QVariantMap result;
+
+    uint lookups = mPathCache->hits() + mPathCache->misses();
+
+    result["hits"] = mPathCache->hits();
+    result["misses"] = mPathCache->misses();
+    result["invalidations"] = mPathCache->invalidations();
+    result["hitRate"] = lookups ? mPathCache->hits() / (double)lookups : 0.0;
+    result["size"] = mPathCache->size();
+    result["capacity"] = mPathCache->capacity();
+
+    return result;
+}
+
+void Pathfinder::clearPathCache()
+{
+    mPathCache->clear();
+}
+
+QVariantMap Pathfinder::compareSearchModes(int samples, float actorRadius)
+{
+    QVariantMap result;
+
+    if (!mTileInfo) {
+        qWarning("Called Pathfinder::compareSearchModes without setting the tileInfo property first.");
         return result;
     }
 
+    int radius = (int)ceil(actorRadius / TileInfo::UnitsPerTile);
+    const QRect &extent = mTileInfo->clearanceMap().extent();
+    ComponentMap *components = componentMap(radius);
+    StandableTile passable(mTileInfo, radius);
+
+    if (extent.isEmpty())
+        return result;
+
+    // A fixed sequence of positions, so runs on the same map can be compared
+    uint seed = 12345;
+    QVector<QPoint> starts, goals;
+
+    for (int attempts = 0; starts.size() < samples && attempts < samples * 100; ++attempts) {
+        QPoint tiles[2];
+        for (int i = 0; i < 2; ++i) {
+            seed = seed * 1103515245 + 12345;
+            int x = extent.left() + (seed >> 8) % extent.width();
+            seed = seed * 1103515245 + 12345;
+            int y = extent.top() + (seed >> 8) % extent.height();
+            tiles[i] = QPoint(x, y);
+        }
+
+        if (components->isConnected(tiles[0], tiles[1])) {
+            starts.append(tiles[0]);
+            goals.append(tiles[1]);
+        }
+    }
+
+    QVector<uint> flatCosts(starts.size());
+    quint64 flatExpanded = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < starts.size(); ++i) {
+        uint lastNode = mSearch->findPath(starts[i], passable, TileGoal(goals[i]));
+        flatCosts[i] = (lastNode != TileSearch::NoNode) ? mSearch->costFromStart(lastNode) : 0;
+        flatExpanded += mSearch->expandedNodes();
+    }
+
+    qint64 flatTime = timer.restart();
+    quint64 jumpPointExpanded = 0;
+    int differentLengths = 0;
+
+    for (int i = 0; i < starts.size(); ++i) {
+        uint lastNode = mSearch->findJumpPath(starts[i], passable, TileGoal(goals[i]));
+        uint cost = (lastNode != TileSearch::NoNode) ? mSearch->costFromStart(lastNode) : 0;
+        jumpPointExpanded += mSearch->expandedNodes();
+
+        if (cost != flatCosts[i])
+            differentLengths++;
+    }
+
+    qint64 jumpPointTime = timer.elapsed();
+
+    result["samples"] = starts.size();
+    result["flatExpandedNodes"] = flatExpanded;
+    result["flatTime"] = flatTime;
+    result["jumpPointExpandedNodes"] = jumpPointExpanded;
+    result["jumpPointTime"] = jumpPointTime;
+    result["differentLengths"] = differentLengths;
+
+    return result;
+}
+
+void Pathfinder::pathSearched(const PathCacheKey &key, const QVector<QPoint> &tiles, uint generation)
+{
+    // Paths found on an outdated copy of the map may be blocked by now
+    if (generation == mGeneration)
+        mPathCache->insert(key, tiles);
+}
+
+uint Pathfinder::findPathAsync(const Vector4 &start, const Vector4 &end, float actorRadius,
+                               const QScriptValue &callback)
+{
     QPoint startTile = positionToTile(start);
     QPoint endTile = positionToTile(end);
     int actorRadiusTiles = (int)ceil(actorRadius / TileInfo::UnitsPerTile);
 
-    if (!canStandAtTile(tileInfo, startTile, actorRadiusTiles)
-            || !canStandAtTile(tileInfo, endTile, actorRadiusTiles))
-        return result;
+    // Hierarchical graphs can't be used by workers, but jumping over tiles works on any copy of the map
+    int mode = (mSearchMode == JumpPointSearch) ? JumpPointSearch : FlatSearch;
+
+    PathCacheKey key(startTile, endTile, actorRadiusTiles, -1, mode);
+    TilePathJob *job = new TilePathJob(this, start, end, key);
 
-    int touchedNodes = 0;
+    TileInfo *tileInfo = mTileInfo;
 
-    QList<AStarNodeFast*> openSet;
+    if (!tileInfo) {
+        qWarning("Called Pathfinder::findPathAsync without setting the tile info property first.");
+        return mPathRequests->submit(job, callback);
+    }
 
-    // Add all the portals accessible from the start position with correct cost
-    AStarNodeFast *startNode = new AStarNodeFast;
-    startNode->comingFrom = NULL;
-    startNode->tile = startTile;
-    startNode->inOpenSet = true;
-    startNode->inClosedSet = false;
-    startNode->costFromStart = 0;
-    startNode->costToGoal = getDistanceHeuristic(startTile, endTile);
-    startNode->totalCost = startNode->costToGoal;
-    openSet << startNode;
+    OccupantExclusion exclusion;
+    const OccupantExclusion *ownObstacle = NULL;
+    if (excludeOwnObstacle(startTile, actorRadiusTiles, &exclusion))
+        ownObstacle = &exclusion;
 
-    AStarNodeFast *lastNode = NULL;
+    StandableTile passable(tileInfo, actorRadiusTiles, ownObstacle);
 
-    QHash<QPoint,AStarNodeFast*> state;
-    state[startTile] = startNode;
+    // Requests that can be rejected right away are answered with an empty path
+    if (!passable(startTile) || !passable(endTile)
+        || !isRangeConnected(componentMap(actorRadiusTiles), startTile, ownObstacle, endTile, 0))
+        return mPathRequests->submit(job, callback);
 
-    while (!openSet.isEmpty()) {
-        AStarNodeFast *node = openSet.takeFirst();
-        node->inOpenSet = false;
+    QVector<QPoint> tiles;
 
-        touchedNodes++;
+    if ((uint)actorRadiusTiles >= tileInfo->clearanceMap().limit()) {
+        // The clearance map can't answer this for actors this large, so use the actual map now
+        if (!mPathCache->find(key, tiles)) {
+            uint lastNode;
+            if (mode == JumpPointSearch)
+                lastNode = mSearch->findJumpPath(startTile, passable, TileGoal(endTile));
+            else
+                lastNode = mSearch->findPath(startTile, passable, TileGoal(endTile));
+            if (lastNode != TileSearch::NoNode)
+                tiles = mSearch->tracePath(lastNode);
 
-        if (node->tile == endTile) {
-            lastNode = node;
-            break; // Reached end successfully.
+            mPathCache->insert(key, tiles);
         }
 
-        addNeighbourNodes(node, tileInfo, actorRadiusTiles, endTile, state, openSet);
+        job->setTiles(mSmoothPaths ? smoothPath(tiles, passable) : tiles);
+        return mPathRequests->submit(job, callback);
+    }
+
+    job->setMap(tileInfo->clearanceMap(), ownObstacle);
+    job->setSmooth(mSmoothPaths);
+
+    if (mPathCache->find(key, tiles))
+        job->setTiles(tiles);
+    else
+        job->setSearch(mGeneration);
+
+    return mPathRequests->submit(job, callback);
+}
 
-        node->inClosedSet = true;
+bool Pathfinder::cancelPathRequest(uint id)
+{
+    return mPathRequests->cancel(id);
+}
+
+QVector<Vector4> Pathfinder::findPath(const Vector4 &start, const Vector4 &end, float actorRadius) const
+{
+    return findPath(start, end, actorRadius, mSearchMode);
+}
+
+QVector<Vector4> Pathfinder::findPath(const Vector4 &start, const Vector4 &end, float actorRadius, int mode) const
+{
+    TileInfo *tileInfo = mTileInfo;
+    QVector<Vector4> result;
+
+    if (!tileInfo) {
+        qWarning("Called Pathfinder::findPath without setting the tile info property first.");
+        return result;
     }
 
-    if (lastNode) {
-        result.prepend(end);
+    QPoint startTile = positionToTile(start);
+    QPoint endTile = positionToTile(end);
+    int actorRadiusTiles = (int)ceil(actorRadius / TileInfo::UnitsPerTile);
 
-        const AStarNodeFast *node = lastNode->comingFrom;
-        if (node) {
-            while (node->comingFrom) {
-                result.prepend(tileToPosition(node->tile));
-                node = node->comingFrom;
-            }
+    OccupantExclusion exclusion;
+    const OccupantExclusion *ownObstacle = NULL;
+    if (excludeOwnObstacle(startTile, actorRadiusTiles, &exclusion))
+        ownObstacle = &exclusion;
+
+    StandableTile passable(tileInfo, actorRadiusTiles, ownObstacle);
+
+    if (!passable(startTile) || !passable(endTile))
+        return result;
+
+    // Don't bother searching if the goal is in a different area
+    if (!isRangeConnected(componentMap(actorRadiusTiles), startTile, ownObstacle, endTile, 0))
+        return result;
+
+    TileSearch *search = mSearch.data();
+    QVector<QPoint> tiles;
+
+    PathCacheKey key(startTile, endTile, actorRadiusTiles, -1, mode);
+
+    if (!mPathCache->find(key, tiles)) {
+        if (mode == HierarchicalSearch) {
+            tiles = clusterGraph(actorRadiusTiles)->findPath(startTile, endTile, search, ownObstacle);
+        } else if (mode == JumpPointSearch) {
+            uint lastNode = search->findJumpPath(startTile, passable, TileGoal(endTile));
+            if (lastNode != TileSearch::NoNode)
+                tiles = search->tracePath(lastNode);
+        } else {
+            uint lastNode = search->findPath(startTile, passable, TileGoal(endTile));
+            if (lastNode != TileSearch::NoNode)
+                tiles = search->tracePath(lastNode);
         }
 
-        result.prepend(start);
+        mPathCache->insert(key, tiles);
     }
 
-    qDeleteAll(state.values());
+    if (mSmoothPaths)
+        tiles = smoothPath(tiles, passable);
 
-    return result;
-}
-
-inline static int tileDistanceSquared(const QPoint &a, const QPoint &b) {
-    QPoint d = b - a;
-    return d.x() * d.x() + d.y() * d.y();
+    return pathFromTiles(tiles, start, end);
 }
 
 QVector<Vector4> Pathfinder::findPathIntoRange(const Vector4 &start,
@@ -158,7 +619,6 @@ QVector<Vector4> Pathfinder::findPathIntoRange(const Vector4 &start,
 
     // We are a bit more lenient here
     int maxTileDistance = ceil(maxDistance / TileInfo::UnitsPerTile);
-    int maxTileDistanceSquared = maxTileDistance * maxTileDistance;
 
     TileInfo *tileInfo = mTileInfo;
     QVector<Vector4> result;
@@ -172,60 +632,315 @@ QVector<Vector4> Pathfinder::findPathIntoRange(const Vector4 &start,
     QPoint targetTile = positionToTile(target);
     int actorRadiusTiles = (int)ceil(actorRadius / TileInfo::UnitsPerTile);
 
-    if (!canStandAtTile(tileInfo, startTile, actorRadiusTiles))
+    OccupantExclusion exclusion;
+    const OccupantExclusion *ownObstacle = NULL;
+    if (excludeOwnObstacle(startTile, actorRadiusTiles, &exclusion))
+        ownObstacle = &exclusion;
+
+    StandableTile passable(tileInfo, actorRadiusTiles, ownObstacle);
+
+    if (!passable(startTile))
         return result;
 
-    int touchedNodes = 0;
+    if (!isRangeConnected(componentMap(actorRadiusTiles), startTile, ownObstacle, targetTile, maxTileDistance))
+        return result;
+
+    QVector<QPoint> tiles;
+    PathCacheKey key(startTile, targetTile, actorRadiusTiles, maxTileDistance, FlatSearch);
+
+    if (!mPathCache->find(key, tiles)) {
+        TileSearch *search = mSearch.data();
+        uint lastNode = search->findPath(startTile, passable, TileRangeGoal(targetTile, maxTileDistance));
+        if (lastNode != TileSearch::NoNode)
+            tiles = search->tracePath(lastNode);
+
+        mPathCache->insert(key, tiles);
+    }
+
+    if (mSmoothPaths)
+        tiles = smoothPath(tiles, passable);
+
+    if (!tiles.isEmpty()) {
+        result.reserve(tiles.size());
+        result.append(start);
+        for (int i = 1; i < tiles.size(); ++i)
+            result.append(tileToPosition(tiles[i]));
+    }
+
+    return result;
+}
 
-    QList<AStarNodeFast*> openSet;
+uint Pathfinder::flowField(const QVector<Vector4> &goals, float actorRadius, float range, float maxDistance)
+{
+    if (!mTileInfo) {
+        qWarning("Called Pathfinder::flowField without setting the tileInfo property first.");
+        return 0;
+    }
 
-    // Add all the portals accessible from the start position with correct cost
-    AStarNodeFast *startNode = new AStarNodeFast;
-    startNode->comingFrom = NULL;
-    startNode->tile = startTile;
-    startNode->inOpenSet = true;
-    startNode->inClosedSet = false;
-    startNode->costFromStart = 0;
-    startNode->costToGoal = getDistanceHeuristic(startTile, targetTile);
-    startNode->totalCost = startNode->costToGoal;
-    openSet << startNode;
+    int radius = (int)ceil(actorRadius / TileInfo::UnitsPerTile);
+    int rangeTiles = (int)ceil(range / TileInfo::UnitsPerTile);
 
-    AStarNodeFast *lastNode = NULL;
+    return findFlowField(goals, radius, rangeTiles, maxDistance, NULL);
+}
 
-    QHash<QPoint,AStarNodeFast*> state;
-    state[startTile] = startNode;
+uint Pathfinder::reachableArea(const Vector4 &start, float actorRadius, float maxDistance)
+{
+    if (!mTileInfo) {
+        qWarning("Called Pathfinder::reachableArea without setting the tileInfo property first.");
+        return 0;
+    }
 
-    while (!openSet.isEmpty()) {
-        AStarNodeFast *node = openSet.takeFirst();
-        node->inOpenSet = false;
+    int radius = (int)ceil(actorRadius / TileInfo::UnitsPerTile);
 
-        touchedNodes++;
+    QVector<Vector4> goals;
+    goals.append(start);
 
-        if (tileDistanceSquared(node->tile, targetTile) <= maxTileDistanceSquared) {
-            lastNode = node;
-            break; // Reached end successfully.
+    return findFlowField(goals, radius, 0, maxDistance, obstacleAt(positionToTile(start)));
+}
+
+uint Pathfinder::findFlowField(const QVector<Vector4> &goals, int radius, int range, float maxDistance,
+                               const Obstacle *excluded)
+{
+    QVector<QPoint> goalTiles;
+    foreach (const Vector4 &goal, goals)
+        goalTiles.append(positionToTile(goal));
+
+    uint maxCost = (uint)ceil(maxDistance / TileInfo::UnitsPerTile) * TileSearch::StraightCost;
+    int excludedRadius = excluded ? excluded->tileRadius : -1;
+
+    QSharedPointer<FlowField> sharedField;
+
+    QHash<uint, FlowFieldEntry>::const_iterator it;
+    for (it = mFlowFields.constBegin(); it != mFlowFields.constEnd(); ++it) {
+        const FlowField *field = it->field.data();
+
+        if (field->radius() == radius && field->range() == range && field->maxCost() == maxCost
+            && field->goals() == goalTiles && field->excludedRadius() == excludedRadius
+            && (!excluded || field->excludedCenter() == excluded->tile)) {
+            if (samePositions(it->goals, goals)) {
+                uint id = it.key();
+                updatedFlowField(id);
+                return id;
+            }
+            sharedField = it->field;
         }
+    }
 
-        addNeighbourNodes(node, tileInfo, actorRadiusTiles, targetTile, state, openSet);
+    if (mFlowFields.size() >= MaxFlowFields) {
+        // Identifiers wrap around, so compare how long ago they were handed out
+        QList<uint> ids = mFlowFields.keys();
+        uint oldest = ids.first();
+        foreach (uint id, ids)
+            if (id - mNextFlowFieldId < oldest - mNextFlowFieldId)
+                oldest = id;
+        mFlowFields.remove(oldest);
+    }
 
-        node->inClosedSet = true;
+    uint id = mNextFlowFieldId++;
+    if (!mNextFlowFieldId)
+        mNextFlowFieldId = 1;
+
+    FlowFieldEntry entry;
+    entry.goals = goals;
+    if (sharedField) {
+        entry.field = sharedField;
+    } else {
+        mTileInfo->reserveClearance(radius);
+        entry.field = QSharedPointer<FlowField>(new FlowField(mTileInfo, radius, goalTiles, range, maxCost));
+        if (excluded)
+            entry.field->excludeOccupant(excluded->tile, excluded->tileRadius);
     }
+    entry.field->update();
+    mFlowFields.insert(id, entry);
 
-    if (lastNode) {
-        const AStarNodeFast *node = lastNode;
-        if (node) {
-            while (node->comingFrom) {
-                result.prepend(tileToPosition(node->tile));
-                node = node->comingFrom;
+    return id;
+}
+
+FlowField *Pathfinder::updatedFlowField(uint id)
+{
+    FlowField *field = mFlowFields.value(id).field.data();
+
+    if (!field) {
+        qWarning("Unknown flow field %u. It may have been replaced by newer fields.", id);
+        return NULL;
+    }
+
+    field->update();
+    return field;
+}
+
+QVector<Vector4> Pathfinder::followFlowField(uint id, const Vector4 &position)
+{
+    QVector<Vector4> result;
+    FlowField *field = updatedFlowField(id);
+
+    if (!field || !mTileInfo)
+        return result;
+
+    QPoint startTile = positionToTile(position);
+
+    OccupantExclusion exclusion;
+    const OccupantExclusion *ownObstacle = NULL;
+    if (excludeOwnObstacle(startTile, field->radius(), &exclusion))
+        ownObstacle = &exclusion;
+
+    StandableTile passable(mTileInfo, field->radius(), ownObstacle);
+
+    if (!passable(startTile))
+        return result;
+
+    QVector<QPoint> tiles = field->trace(startTile);
+
+    if (tiles.isEmpty() && ownObstacle) {
+        /*
+          The field doesn't cover the tiles blocked by the actor itself, so leave them towards the
+          tile around them that is closest to a goal.
+         */
+        QRect ring = ownObstacle->area.adjusted(-1, -1, 1, 1);
+        QPoint best;
+        uint bestCost = FlowField::NoCost;
+
+        for (int y = ring.top(); y <= ring.bottom(); ++y) {
+            for (int x = ring.left(); x <= ring.right(); ++x) {
+                QPoint tile(x, y);
+                uint cost = field->cost(tile);
+
+                if (ownObstacle->contains(x, y) || cost == FlowField::NoCost)
+                    continue;
+
+                cost += TileSearch::octileDistance(startTile, tile);
+                if (cost < bestCost) {
+                    best = tile;
+                    bestCost = cost;
+                }
             }
         }
 
-        result.prepend(start);
+        if (bestCost != FlowField::NoCost) {
+            uint lastNode = mSearch->findPath(startTile, passable, TileGoal(best));
+            if (lastNode != TileSearch::NoNode) {
+                tiles = mSearch->tracePath(lastNode);
+                tiles.resize(tiles.size() - 1);
+                tiles += field->trace(best);
+            }
+        }
     }
 
-    qDeleteAll(state.values());
+    if (tiles.isEmpty())
+        return result;
 
-    return result;
+    if (mSmoothPaths)
+        tiles = smoothPath(tiles, passable);
+
+    // Paths to the exact goal end at its position, others end on the tile in range
+    Vector4 end = tileToPosition(tiles.last());
+    if (field->range() == 0) {
+        int goal = field->goals().indexOf(tiles.last());
+        if (goal != -1)
+            end = mFlowFields.value(id).goals[goal];
+    }
+
+    return pathFromTiles(tiles, position, end);
+}
+
+QVector<Vector4> Pathfinder::pathInReachableArea(uint area, const Vector4 &target)
+{
+    QVector<Vector4> result;
+    FlowField *field = updatedFlowField(area);
+
+    if (!field || !mTileInfo)
+        return result;
+
+    // The field leads back to the start, so the path is the trace in reverse
+    QVector<QPoint> trace = field->trace(positionToTile(target));
+
+    if (trace.isEmpty())
+        return result;
+
+    QVector<QPoint> tiles;
+    tiles.reserve(trace.size());
+    for (int i = trace.size() - 1; i >= 0; --i)
+        tiles.append(trace[i]);
+
+    if (mSmoothPaths) {
+        OccupantExclusion exclusion;
+        bool ownObstacle = field->excludedRadius() >= 0;
+        if (ownObstacle)
+            exclusion = mTileInfo->excludeOccupant(field->excludedCenter(), field->excludedRadius(), field->radius());
+
+        tiles = smoothPath(tiles, StandableTile(mTileInfo, field->radius(), ownObstacle ? &exclusion : NULL));
+    }
+
+    return pathFromTiles(tiles, mFlowFields.value(area).goals.first(), target);
+}
+
+float Pathfinder::flowFieldDistance(uint id, const Vector4 &position)
+{
+    FlowField *field = updatedFlowField(id);
+
+    if (!field)
+        return -1;
+
+    uint cost = field->cost(positionToTile(position));
+
+    if (cost == FlowField::NoCost)
+        return -1;
+
+    return cost * TileInfo::UnitsPerTile / TileSearch::StraightCost;
+}
+
+uint Pathfinder::componentAt(const Vector4 &position, float actorRadius) const
+{
+    if (!mTileInfo) {
+        qWarning("Called Pathfinder::componentAt without setting the tileInfo property first.");
+        return 0;
+    }
+
+    QPoint tile = positionToTile(position);
+    int tileRadius = ceil(actorRadius / TileInfo::UnitsPerTile);
+
+    OccupantExclusion exclusion;
+    bool ownObstacle = excludeOwnObstacle(tile, tileRadius, &exclusion);
+
+    QVector<uint> components = startComponents(componentMap(tileRadius), tile, ownObstacle ? &exclusion : NULL);
+    return components.isEmpty() ? 0 : components.first();
+}
+
+bool Pathfinder::isReachable(const Vector4 &from, const Vector4 &to, float actorRadius) const
+{
+    if (!mTileInfo) {
+        qWarning("Called Pathfinder::isReachable without setting the tileInfo property first.");
+        return false;
+    }
+
+    QPoint startTile = positionToTile(from);
+    int tileRadius = ceil(actorRadius / TileInfo::UnitsPerTile);
+
+    OccupantExclusion exclusion;
+    bool ownObstacle = excludeOwnObstacle(startTile, tileRadius, &exclusion);
+
+    return isRangeConnected(componentMap(tileRadius), startTile, ownObstacle ? &exclusion : NULL,
+                            positionToTile(to), 0);
+}
+
+bool Pathfinder::isRangeReachable(const Vector4 &from, const Vector4 &to, float actorRadius, float targetRadius) const
+{
+    if (!mTileInfo) {
+        qWarning("Called Pathfinder::isRangeReachable without setting the tileInfo property first.");
+        return false;
+    }
+
+    QPoint startTile = positionToTile(from);
+    int tileRadius = ceil(actorRadius / TileInfo::UnitsPerTile);
+
+    // The same range findPathIntoRange searches for
+    int maxTileDistance = ceil((actorRadius + targetRadius) / TileInfo::UnitsPerTile);
+
+    OccupantExclusion exclusion;
+    bool ownObstacle = excludeOwnObstacle(startTile, tileRadius, &exclusion);
+
+    return isRangeConnected(componentMap(tileRadius), startTile, ownObstacle ? &exclusion : NULL,
+                            positionToTile(to), maxTileDistance);
 }
 
 bool Pathfinder::isPathValid(const QVector<Vector4> &points, float actorRadius) const
@@ -238,14 +953,23 @@ bool Pathfinder::isPathValid(const QVector<Vector4> &points, float actorRadius)
         return false;
     }
 
-    int actorRadiusTiles = actorRadius / TileInfo::UnitsPerTile;
+    if (points.isEmpty())
+        return true;
 
-    // TODO: This ignores obstacles between two points.
+    int actorRadiusTiles = (int)ceil(actorRadius / TileInfo::UnitsPerTile);
+
+    // The actor following the path doesn't block itself
+    QPoint startTile = positionToTile(points.first());
+    OccupantExclusion exclusion;
+    bool ownObstacle = excludeOwnObstacle(startTile, actorRadiusTiles, &exclusion);
 
-    foreach (const Vector4 &point, points) {
-        QPoint tile = positionToTile(point);
+    StandableTile passable(tileInfo, actorRadiusTiles, ownObstacle ? &exclusion : NULL);
 
-        if (!canStandAtTile(tileInfo, tile, actorRadiusTiles))
+    if (!passable(startTile))
+        return false;
+
+    for (int i = 1; i < points.size(); ++i) {
+        if (!isLineWalkable(positionToTile(points[i - 1]), positionToTile(points[i]), passable))
             return false;
     }
 
@@ -267,67 +991,127 @@ bool Pathfinder::canStandAt(const Vector4 &position, float actorRadius) const
     return canStandAtTile(tileInfo, tile, tileRadius);
 }
 
-void addNeighbourNodes(const AStarNodeFast *node,
-                       const TileInfo *tileInfo,
-                       int radius,
-                       const QPoint &endTile,
-                       QHash<QPoint, AStarNodeFast*> &state,
-                       QList<AStarNodeFast*> &openSet) {
-    QPoint neighbourTiles[8] = {
-        node->tile + QPoint(-1, -1),
-        node->tile + QPoint(1, -1),
-        node->tile + QPoint(1, 1),
-        node->tile + QPoint(-1, 1),
-        node->tile + QPoint(0, -1),
-        node->tile + QPoint(0, 1),
-        node->tile + QPoint(1, 0),
-        node->tile + QPoint(-1, 0)
-    };
+/**
+  Obstacles occupy all tiles whose center is covered by them.
+  */
+static int obstacleRadiusInTiles(float radius)
+{
+    return radius / TileInfo::UnitsPerTile;
+}
+
+void Pathfinder::addObstacle(const QString &id, const Vector4 &position, float radius)
+{
+    QHash<QString, Obstacle>::iterator it = mObstacles.find(id);
+
+    if (it != mObstacles.end()) {
+        if (it->tileRadius == obstacleRadiusInTiles(radius)) {
+            it->radius = radius;
+            moveObstacle(id, position);
+            return;
+        }
+
+        if (mTileInfo)
+            mTileInfo->removeOccupancy(it->tile, it->tileRadius);
+        mObstacleTiles.remove(it->tile, id);
+    } else {
+        it = mObstacles.insert(id, Obstacle());
+    }
+
+    it->position = position;
+    it->radius = radius;
+    it->tile = positionToTile(position);
+    it->tileRadius = obstacleRadiusInTiles(radius);
+    mObstacleTiles.insert(it->tile, id);
+
+    if (mTileInfo)
+        mTileInfo->addOccupancy(it->tile, it->tileRadius);
+}
+
+bool Pathfinder::moveObstacle(const QString &id, const Vector4 &position)
+{
+    QHash<QString, Obstacle>::iterator it = mObstacles.find(id);
 
-    for (int i = 0; i < 8; i++) {
-        QPoint neighbourTile = neighbourTiles[i];
+    if (it == mObstacles.end())
+        return false;
 
-        uint neighbourCost = node->costFromStart + 1;
+    QPoint tile = positionToTile(position);
 
-        QHash<QPoint, AStarNodeFast*>::iterator it = state.find(neighbourTile);
+    if (mTileInfo)
+        mTileInfo->moveOccupancy(it->tile, tile, it->tileRadius);
 
-        AStarNodeFast *otherNode;
+    if (it->tile != tile) {
+        mObstacleTiles.remove(it->tile, id);
+        mObstacleTiles.insert(tile, id);
+    }
 
-        if (it != state.end()) {
-            otherNode = it.value();
+    it->position = position;
+    it->tile = tile;
 
-            if (node->comingFrom == otherNode)
-                continue;
+    return true;
+}
 
-            if ((otherNode->inClosedSet || otherNode->inOpenSet)
-                && otherNode->costFromStart <= neighbourCost)
-                continue; // Skip, we have already a better path to this node
-        } else {
-            /*
-             We defer this check since we'll lookup tiles in the state anyway.
-             If the tile can be stood upon once, it'll get added to the state
-             and since walkability information is assumed to be invariant during
-             a path finding operation, we can assume that finding the state for
-             a tile means the tile is walkable.
-             */
-            if (!canStandAtTile(tileInfo, neighbourTile, radius))
-                continue;
+void Pathfinder::removeObstacle(const QString &id)
+{
+    QHash<QString, Obstacle>::iterator it = mObstacles.find(id);
 
-            otherNode = new AStarNodeFast;
-            state[neighbourTile] = otherNode;
-        }
+    if (it == mObstacles.end())
+        return;
 
-        otherNode->comingFrom = node;
-        otherNode->tile = neighbourTile;
-        otherNode->costFromStart = neighbourCost;
-        otherNode->costToGoal = getDistanceHeuristic(neighbourTile, endTile);
-        otherNode->totalCost = neighbourCost + otherNode->costToGoal;
-        otherNode->inOpenSet = true;
-        otherNode->inClosedSet = false;
+    if (mTileInfo)
+        mTileInfo->removeOccupancy(it->tile, it->tileRadius);
 
-        openSet.append(otherNode);
-        qSort(openSet.begin(), openSet.end(), compareAStarNodeFasts);
+    mObstacleTiles.remove(it->tile, id);
+    mObstacles.erase(it);
+}
+
+void Pathfinder::setTileInfo(TileInfo *tileInfo)
+{
+    if (mTileInfo == tileInfo)
+        return;
+
+    if (mTileInfo) {
+        disconnect(mTileInfo, SIGNAL(occupancyChanged(QRect)), this, SLOT(tilesChanged(QRect)));
+        disconnect(mTileInfo, SIGNAL(loaded()), this, SLOT(tileInfoLoaded()));
     }
+
+    // Move the occupancy of all obstacles over to the new tile info
+    foreach (const Obstacle &obstacle, mObstacles) {
+        if (mTileInfo)
+            mTileInfo->removeOccupancy(obstacle.tile, obstacle.tileRadius);
+        if (tileInfo)
+            tileInfo->addOccupancy(obstacle.tile, obstacle.tileRadius);
+    }
+
+    mTileInfo = tileInfo;
+
+    if (mTileInfo) {
+        connect(mTileInfo, SIGNAL(occupancyChanged(QRect)), this, SLOT(tilesChanged(QRect)));
+        connect(mTileInfo, SIGNAL(loaded()), this, SLOT(tileInfoLoaded()));
+    }
+
+    discardTileData();
+}
+
+void Pathfinder::tileInfoLoaded()
+{
+    discardTileData();
+
+    // Loading drops all occupancy, so the obstacles have to occupy the new tiles again
+    foreach (const Obstacle &obstacle, mObstacles)
+        mTileInfo->addOccupancy(obstacle.tile, obstacle.tileRadius);
+}
+
+void Pathfinder::discardTileData()
+{
+    // The abstract graphs, components and pending searches belong to the previous map
+    mPathRequests->cancelAll();
+    mGeneration++;
+    qDeleteAll(mClusterGraphs);
+    mClusterGraphs.clear();
+    qDeleteAll(mComponentMaps);
+    mComponentMaps.clear();
+    mFlowFields.clear();
+    mPathCache->clear();
 }
 
 bool Pathfinder::hasLineOfSight(const Vector4 &from, const Vector4 &to) const
@@ -348,50 +1132,7 @@ bool Pathfinder::hasLineOfSight(const Vector4 &from, const Vector4 &to) const
     if (!tileInfo->isTileFlyable(endTile.x(), endTile.y()))
         return false;
 
-    int x0 = startTile.x();
-    int y0 = startTile.y();
-    int x1 = endTile.x();
-    int y1 = endTile.y();
-
-    bool steep = abs(y1 - y0) > abs(x1 - x0);
-    if (steep) {
-        std::swap(x0, y0);
-        std::swap(x1, y1);
-    }
-    if (x0 > x1) {
-        std::swap(x0, x1);
-        std::swap(y0, y1);
-    }
-    int deltax = x1 - x0;
-    int deltay = abs(y1 - y0);
-    float error = 0;
-    float deltaerr = 0;
-    if (deltax != 0)
-        deltaerr = deltay / deltax;
-    int ystep;
-    int y = y0;
-    if (y0 < y1)
-        ystep = 1;
-    else
-        ystep = -1;
-
-    for (int x = x0; x <= x1; ++x) {
-        if (steep) {
-            if (!tileInfo->isTileFlyable(y, x))
-                return false;
-        } else {
-            if (!tileInfo->isTileFlyable(x, y))
-                return false;
-        }
-
-        error += deltaerr;
-        if (error >= 0.5) {
-            y = y + ystep;
-            error = error - 1.0;
-        }
-    }
-
-    return true;
+    return walkGridLine(startTile.x(), startTile.y(), endTile.x(), endTile.y(), FlyableTile(tileInfo));
 }
 
 }
@@ -4,6 +4,10 @@
 #include <QObject>
 #include <QMetaType>
 #include <QPointer>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QScriptValue>
+#include <QVariantMap>
 #include <QVector>
 
 #include <gamemath.h>
@@ -13,20 +17,93 @@ using namespace GameMath;
 
 namespace EvilTemple {
 
+class TileSearch;
+class ClusterGraph;
+class ComponentMap;
+class PathCache;
+struct PathCacheKey;
+class PathRequests;
+class FlowField;
+
 class Pathfinder : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(EvilTemple::TileInfo *tileInfo READ tileInfo WRITE setTileInfo)
+    Q_PROPERTY(SearchMode searchMode READ searchMode WRITE setSearchMode)
+    Q_PROPERTY(bool smoothPaths READ smoothPaths WRITE setSmoothPaths)
+    Q_ENUMS(SearchMode)
 public:
     Q_INVOKABLE explicit Pathfinder(QObject *parent = 0);
+    ~Pathfinder();
+
+    /**
+      The algorithm used to find paths between two points.
+      */
+    enum SearchMode {
+        /**
+          A* over all tiles. Always finds the shortest path.
+          */
+        FlatSearch = 0,
+        /**
+          HPA* over clusters of tiles, which only explores the tiles along the route that is found.
+          The path may be slightly longer than the shortest path, but long paths and unreachable goals
+          are found much faster.
+          */
+        HierarchicalSearch,
+        /**
+          A* over all tiles that jumps over open terrain (Jump Point Search). Finds paths as short as
+          FlatSearch, while expanding only the tiles where the path may turn. This relies on every step
+          between two tiles having the same cost, so terrain with movement costs would need FlatSearch.
+          */
+        JumpPointSearch
+    };
 
     void setTileInfo(TileInfo *tileInfo);
     TileInfo *tileInfo() const;
 
+    SearchMode searchMode() const;
+    void setSearchMode(SearchMode mode);
+
+    /**
+      If enabled (the default), paths only contain the points where the actor has to change its
+      direction, instead of one point per tile. The straight lines between the points are checked
+      against the size of the actor.
+      */
+    bool smoothPaths() const;
+    void setSmoothPaths(bool smoothPaths);
+
 public slots:
 
+    /**
+      Finds a path between two points using the default search mode of this pathfinder.
+      */
     QVector<Vector4> findPath(const Vector4 &start, const Vector4 &end, float actorRadius) const;
 
+    /**
+      Finds a path between two points using the given search mode.
+      */
+    QVector<Vector4> findPath(const Vector4 &start, const Vector4 &end, float actorRadius, int mode) const;
+
+    /**
+      Finds a path between two points on a worker thread, so long searches don't stall the game.
+
+      The search runs on a copy of the current clearance map and always searches all tiles, since
+      the hierarchical graphs are only updated on demand by the main thread. Jump Point Search is
+      used if it is the default search mode. The callback is called
+      with the path (empty if there is none) from the event loop, even if the path was cached.
+
+      @return The identifier of the request, which can be passed to cancelPathRequest.
+      */
+    uint findPathAsync(const Vector4 &start, const Vector4 &end, float actorRadius, const QScriptValue &callback);
+
+    /**
+      Drops a request made using findPathAsync, so its callback won't be called. Use this for previews
+      that are replaced by a new request before the old one finished.
+
+      @return False if the request already finished or was cancelled before.
+      */
+    bool cancelPathRequest(uint id);
+
     /**
       Tries to find a path that moves the actor into range of a target.
 
@@ -45,23 +122,127 @@ public slots:
                                        float actorRadius,
                                        float targetRadius);
 
+    /**
+      Computes a flow field that leads actors of one size to the closest of several goals. Moving a
+      group of actors to the same place only needs a single search this way, see followFlowField.
+
+      Fields are cached and only recomputed if obstacles changed around them since they were last
+      used. Requesting a field with the same parameters again returns the same identifier. Goals on
+      the same tiles share the field, but get their own identifier so paths end at the exact
+      positions requested. Only the most recently created fields are kept, so identifiers should not
+      be stored for long.
+
+      @param goals The positions to move to.
+      @param range Actors have reached a goal once they are this close to it. 0 for the exact position.
+      @param maxDistance Actors further away than this (along the shortest path) can't follow the
+                         field. 0 for no limit, which makes the field cover the entire map: a
+                         large map then needs tens of megabytes for every cached field, so
+                         limit the distance where possible.
+      @return The identifier of the field.
+      */
+    uint flowField(const QVector<Vector4> &goals, float actorRadius, float range, float maxDistance);
+
+    /**
+      Follows a flow field from a position to the closest goal. The actor following the field has to
+      have the radius the field was created for.
+
+      @return The path to the goal or an empty path if the field doesn't reach the position.
+      */
+    QVector<Vector4> followFlowField(uint field, const Vector4 &position);
+
+    /**
+      Returns the length of the path from a position to the closest goal of a flow field, or -1 if
+      the field doesn't reach the position. For reachable areas, this is the distance an actor has to
+      walk to reach the position.
+      */
+    float flowFieldDistance(uint field, const Vector4 &position);
+
+    /**
+      Determines where an actor can walk within a maximum distance, using a single search. The area
+      is a flow field leading back to the start (see flowField), so the same rules for caching apply.
+      Checking whether and how far a position is reachable (flowFieldDistance) is then a single lookup,
+      and the path to it can be found without another search.
+
+      @return The identifier of the area.
+      */
+    uint reachableArea(const Vector4 &start, float actorRadius, float maxDistance);
+
+    /**
+      Returns the path from the start of a reachable area to a position within the area, or an empty
+      path if the position can't be reached within the maximum distance.
+      */
+    QVector<Vector4> pathInReachableArea(uint area, const Vector4 &target);
+
+    /**
+      Returns the connected area an actor standing at a position can move in. Actors can only move
+      between positions with the same component. The component is 0 if the actor can't stand at the
+      position at all. Components change whenever obstacles change.
+      */
+    uint componentAt(const Vector4 &position, float actorRadius) const;
+
+    /**
+      Checks whether an actor can move between two points, without searching for a path.
+      */
+    bool isReachable(const Vector4 &from, const Vector4 &to, float actorRadius) const;
+
+    /**
+      Checks whether an actor can move into range of a target, without searching for a path. Unlike
+      isReachable, this also works for targets that block their own position, such as critters.
+      @param targetRadius The distance to the target, as for findPathIntoRange.
+      */
+    bool isRangeReachable(const Vector4 &from, const Vector4 &to, float actorRadius, float targetRadius) const;
+
+    /**
+      Returns the number of hits, misses and invalidations of the path cache, as well as the
+      hit rate (hits / lookups) and the number of cached paths.
+      */
+    QVariantMap pathCacheStatistics() const;
+
+    /**
+      Removes all cached paths.
+      */
+    void clearPathCache();
+
+    /**
+      Compares the search modes that search all tiles on random pairs of positions of the current
+      map, which an actor of the given size can move between. The samples are the same for every
+      run on the same map. The path cache isn't used.
+
+      @return The number of samples, and the expanded nodes and time in milliseconds per mode (i.e.
+              flatExpandedNodes, jumpPointTime), as well as the number of paths whose length differs
+              between the modes.
+      */
+    QVariantMap compareSearchModes(int samples, float actorRadius);
+
     /**
       Checks whether there is an uninterrupted line of sight between two points.
       */
     bool hasLineOfSight(const Vector4 &from, const Vector4 &to) const;
 
     /**
-      Verifies a path for a given actor size.
+      Verifies a path for a given actor size. The actor has to fit onto every tile along the straight
+      lines between the points of the path.
       */
     bool isPathValid(const QVector<Vector4> &points, float actorRadius) const;
 
     /**
       Adds a dynamic obstacle that is respected during path calculations.
       If an obstacle with the same identifier already exists, the existing obstacle
-      is modified with the given data.
+      is modified with the given data. The obstacle marks the tiles it covers as occupied in
+      the tile info, which only updates the clearance around the obstacle.
       */
     void addObstacle(const QString &id, const Vector4 &position, float radius);
 
+    /**
+      Moves an existing dynamic obstacle. Only the clearance around the tiles the obstacle leaves
+      and enters is updated (see TileInfo::addOccupancy), along with the connected components and
+      hierarchical graphs of that area. Nothing needs to be updated as long as the obstacle stays
+      on the same tile.
+
+      @return False if there is no obstacle with the given identifier.
+      */
+    bool moveObstacle(const QString &id, const Vector4 &position);
+
     /**
       Removes a dynamic obstacle.
       */
@@ -72,33 +253,92 @@ public slots:
       */
     bool canStandAt(const Vector4 &position, float actorRadius) const;
 
+private slots:
+    void tilesChanged(const QRect &area);
+    void tileInfoLoaded();
+
 private:
-    typedef QPair<Vector4, float> Obstacle;
+    friend class TilePathJob;
+
+    ClusterGraph *clusterGraph(int radius) const;
+    ComponentMap *componentMap(int radius) const;
+    void discardTileData();
+
+    struct Obstacle {
+        Vector4 position;
+        float radius;
+        QPoint tile; // The occupied area in tiles
+        int tileRadius;
+    };
+
+    const Obstacle *obstacleAt(const QPoint &tile) const;
+    bool excludeOwnObstacle(const QPoint &start, int radius, OccupantExclusion *exclusion) const;
+    void pathSearched(const PathCacheKey &key, const QVector<QPoint> &tiles, uint generation);
 
     QPointer<TileInfo> mTileInfo;
 
     QHash<QString, Obstacle> mObstacles;
 
+    // The obstacles centered on each tile, since every query looks up the one on its start tile
+    QMultiHash<QPoint, QString> mObstacleTiles;
+
+    // Search state is reused across queries to avoid allocating nodes for every search
+    QScopedPointer<TileSearch> mSearch;
+
+    SearchMode mSearchMode;
+    bool mSmoothPaths;
+
+    // Recently found paths, which are requested over and over again by the user interface
+    QScopedPointer<PathCache> mPathCache;
+
+    // Abstract graphs for hierarchical searches are built on demand for every actor radius (in tiles)
+    mutable QHash<int, ClusterGraph*> mClusterGraphs;
+
+    // Connected components are labelled on demand for every actor radius (in tiles)
+    mutable QHash<int, ComponentMap*> mComponentMaps;
+
+    // Several entries share a field if their goals only differ within the goal tiles
+    struct FlowFieldEntry {
+        QSharedPointer<FlowField> field;
+        QVector<Vector4> goals;
+    };
+
+    uint findFlowField(const QVector<Vector4> &goals, int radius, int range, float maxDistance, const Obstacle *excluded);
+    FlowField *updatedFlowField(uint id);
+
+    // Flow fields by identifier, the oldest fields are evicted first
+    QHash<uint, FlowFieldEntry> mFlowFields;
+    uint mNextFlowFieldId;
+
+    // Searches running on worker threads, and the number of changes to the tiles they may be based on
+    PathRequests *mPathRequests;
+    uint mGeneration;
+
 };
 
-inline void Pathfinder::addObstacle(const QString &id, const Vector4 &position, float radius)
+inline TileInfo *Pathfinder::tileInfo() const
+{
+    return mTileInfo;
+}
+
+inline Pathfinder::SearchMode Pathfinder::searchMode() const
 {
-    mObstacles[id] = Obstacle(position, radius);
+    return mSearchMode;
 }
 
-inline void Pathfinder::removeObstacle(const QString &id)
+inline void Pathfinder::setSearchMode(SearchMode mode)
 {
-    mObstacles.remove(id);
+    mSearchMode = mode;
 }
 
-inline void Pathfinder::setTileInfo(TileInfo *tileInfo)
+inline bool Pathfinder::smoothPaths() const
 {
-    mTileInfo = tileInfo;
+    return mSmoothPaths;
 }
 
-inline TileInfo *Pathfinder::tileInfo() const
+inline void Pathfinder::setSmoothPaths(bool smoothPaths)
 {
-    return mTileInfo;
+    mSmoothPaths = smoothPaths;
 }
 
 }
@@ -0,0 +1,149 @@
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+#include <QtCore/QMutex>
+#include <QtCore/QRunnable>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtScript/QScriptEngine>
+
+#include "pathrequests.h"
+#include "scriptables.h"
+
+namespace EvilTemple {
+
+PathRequestToken::PathRequestToken() : mCancelled(0)
+{
+}
+
+PathJob::~PathJob()
+{
+}
+
+/**
+  The state of a request that is shared between the queue and the worker running it.
+  */
+struct PathTask {
+    PathTask(uint _id, PathJob *_job) : id(_id), job(_job), owner(NULL)
+    {
+    }
+
+    uint id;
+    QScopedPointer<PathJob> job;
+    PathRequestToken token;
+
+    QMutex mutex; // Guards the owner, which is reset when the queue is destroyed
+    PathRequests *owner;
+};
+
+class PathRunnable : public QRunnable
+{
+public:
+    PathRunnable(const QSharedPointer<PathTask> &task) : mTask(task)
+    {
+    }
+
+    void run()
+    {
+        // Requests are often cancelled before a worker even gets to them
+        if (!mTask->token.isCancelled())
+            mTask->job->run(mTask->token);
+
+        QMutexLocker locker(&mTask->mutex);
+
+        if (mTask->owner && !mTask->token.isCancelled())
+            QMetaObject::invokeMethod(mTask->owner, "deliver", Qt::QueuedConnection, Q_ARG(uint, mTask->id));
+    }
+
+private:
+    QSharedPointer<PathTask> mTask;
+};
+
+PathRequests::PathRequests(QObject *parent) : QObject(parent), mNextId(1)
+{
+}
+
+PathRequests::~PathRequests()
+{
+    cancelAll();
+}
+
+QThreadPool *PathRequests::threadPool()
+{
+    static QThreadPool *pool = NULL;
+
+    if (!pool) {
+        pool = new QThreadPool(QCoreApplication::instance());
+        pool->setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+    }
+
+    return pool;
+}
+
+uint PathRequests::submit(PathJob *job, const QScriptValue &callback)
+{
+    uint id = mNextId++;
+    if (!mNextId)
+        mNextId = 1;
+
+    Request request;
+    request.task = QSharedPointer<PathTask>(new PathTask(id, job));
+    request.task->owner = this;
+    request.callback = callback;
+    mRequests.insert(id, request);
+
+    threadPool()->start(new PathRunnable(request.task));
+
+    return id;
+}
+
+bool PathRequests::cancel(uint id)
+{
+    QHash<uint, Request>::iterator it = mRequests.find(id);
+
+    if (it == mRequests.end())
+        return false;
+
+    it->task->token.cancel();
+    mRequests.erase(it);
+    return true;
+}
+
+void PathRequests::cancelAll()
+{
+    foreach (const Request &request, mRequests) {
+        QMutexLocker locker(&request.task->mutex);
+        request.task->owner = NULL;
+        request.task->token.cancel();
+    }
+
+    mRequests.clear();
+}
+
+void PathRequests::deliver(uint id)
+{
+    // Cancelled requests may still have a delivery queued
+    Request request = mRequests.take(id);
+
+    if (!request.task)
+        return;
+
+    QVector<Vector4> path = request.task->job->result();
+
+    QScriptEngine *engine = request.callback.engine();
+
+    if (!engine || !request.callback.isFunction())
+        return;
+
+    request.callback.call(QScriptValue(), QScriptValueList() << Vector4Scriptable::toScriptValue(engine, path));
+
+    if (engine->hasUncaughtException()) {
+        qDebug() << engine->uncaughtException().toString() << engine->uncaughtExceptionLineNumber();
+        foreach (const QString &line, engine->uncaughtExceptionBacktrace()) {
+            qDebug() << "   " << line;
+        }
+    }
+}
+
+}
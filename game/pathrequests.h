@@ -0,0 +1,128 @@
+#ifndef PATHREQUESTS_H
+#define PATHREQUESTS_H
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+#include <QtScript/QScriptValue>
+
+#include <gamemath.h>
+using namespace GameMath;
+
+class QThreadPool;
+
+namespace EvilTemple {
+
+/**
+  Tells a running search whether its result is still wanted.
+  */
+class PathRequestToken
+{
+public:
+    PathRequestToken();
+
+    bool isCancelled() const;
+    void cancel();
+
+private:
+    QAtomicInt mCancelled;
+
+    Q_DISABLE_COPY(PathRequestToken)
+};
+
+/**
+  A path search that runs on one of the pathfinding worker threads.
+
+  The job has to carry copies of all the data it searches, since the map may change or be
+  unloaded while the search is running.
+  */
+class PathJob
+{
+public:
+    virtual ~PathJob();
+
+    /**
+      Runs the search on a worker thread. Long searches should stop early once the token is cancelled.
+      */
+    virtual void run(const PathRequestToken &token) = 0;
+
+    /**
+      Called on the thread of the request queue after the search finished.
+      @return The path that is passed to the callback.
+      */
+    virtual QVector<Vector4> result() = 0;
+};
+
+struct PathTask;
+
+/**
+  Runs path searches on a pool of worker threads and passes their results to script callbacks.
+
+  Callbacks are always called from the event loop of the thread the queue lives in, even if the
+  result is known right away, so scripts see the same order of events for every request.
+  Cancelled requests never call their callback.
+  */
+class PathRequests : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PathRequests(QObject *parent = 0);
+    ~PathRequests();
+
+    /**
+      Queues a job and takes ownership of it.
+      @return The identifier of the request, which can be used to cancel it. Never 0.
+      */
+    uint submit(PathJob *job, const QScriptValue &callback);
+
+    /**
+      Drops a request. A search that is already running stops as soon as it notices.
+      @return False if the request is unknown or was already delivered.
+      */
+    bool cancel(uint id);
+
+    /**
+      Drops all pending requests.
+      */
+    void cancelAll();
+
+    int pendingCount() const;
+
+    /**
+      The worker threads shared by all request queues. One core is left to the render thread.
+      */
+    static QThreadPool *threadPool();
+
+private slots:
+    void deliver(uint id);
+
+private:
+    struct Request {
+        QSharedPointer<PathTask> task;
+        QScriptValue callback;
+    };
+
+    QHash<uint, Request> mRequests;
+    uint mNextId;
+};
+
+inline bool PathRequestToken::isCancelled() const
+{
+    return mCancelled != 0;
+}
+
+inline void PathRequestToken::cancel()
+{
+    mCancelled.fetchAndStoreOrdered(1);
+}
+
+inline int PathRequests::pendingCount() const
+{
+    return mRequests.size();
+}
+
+}
+
+#endif // PATHREQUESTS_H
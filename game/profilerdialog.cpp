@@ -7,6 +7,7 @@
 
 #include "profilerdialog.h"
 #include "profiler.h"
+#include "glstate.h"
 
 #include "ui_profilerdialog.h"
 
@@ -79,6 +80,19 @@ void ProfilerDialog::updateData()
         model->appendRow(row);
     }
 
+    // State changes sent to OpenGL and skipped by the state cache during the last frame
+    GLState::Counters counters = GLState::lastFrame();
+
+    QList<QStandardItem*> issuedRow;
+    issuedRow.append(new QStandardItem("GLStateChangesIssued"));
+    issuedRow.append(new QStandardItem(QString("%1").arg(counters.issued)));
+    model->appendRow(issuedRow);
+
+    QList<QStandardItem*> elidedRow;
+    elidedRow.append(new QStandardItem("GLStateChangesElided"));
+    elidedRow.append(new QStandardItem(QString("%1").arg(counters.elided)));
+    model->appendRow(elidedRow);
+
     ui->tableView->update();
 }
 
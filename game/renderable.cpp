@@ -40,6 +40,17 @@ IntersectionResult Renderable::intersect(const Ray3d &ray) const
     return result;
 }
 
+bool Renderable::isOpaque() const
+{
+    return false;
+}
+
+void Renderable::sortState(uint &program, uint &material) const
+{
+    program = 0;
+    material = 0;
+}
+
 void Renderable::mouseDoubleClickEvent(QMouseEvent *evt)
 {
     emit mouseDoubleClicked(evt);
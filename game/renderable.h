@@ -57,6 +57,18 @@ public:
 
     virtual IntersectionResult intersect(const Ray3d &ray) const;
 
+    /**
+      Opaque renderables are drawn first and grouped by the state returned by sortState(), all
+      other renderables are blended with what is behind them and are drawn back to front.
+      */
+    virtual bool isOpaque() const;
+
+    /**
+      Identifies the shader program and the material this renderable is drawn with, so opaque
+      renderables sharing them can be drawn one after another.
+      */
+    virtual void sortState(uint &program, uint &material) const;
+
     bool isAnimated() const;
     void setAnimated(bool animated);
 
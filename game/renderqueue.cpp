@@ -0,0 +1,113 @@
+
+#include <string.h>
+
+#include "renderqueue.h"
+#include "scenenode.h"
+
+namespace EvilTemple {
+
+static const int CategoryShift = 61;
+static const quint64 BlendedBit = Q_UINT64_C(1) << 60;
+static const int ProgramShift = 44;
+static const int MaterialShift = 24;
+
+RenderQueue::RenderQueue() : mSorted(true)
+{
+    for (int i = 0; i <= Renderable::Count; ++i)
+        mCategoryStart[i] = 0;
+
+    // Until a view is set, everything is at the same distance
+    for (int i = 0; i < 4; ++i)
+        mDepthRow[i] = 0;
+}
+
+void RenderQueue::setViewMatrix(const Matrix4 &viewMatrix)
+{
+    // Matrices are stored column by column
+    const float *data = viewMatrix.data();
+    for (int i = 0; i < 4; ++i)
+        mDepthRow[i] = data[i * 4 + 2];
+}
+
+quint64 RenderQueue::sortKey(Renderable::Category category, const Renderable *renderable) const
+{
+    quint64 key = (quint64)category << CategoryShift;
+
+    // The camera looks along the negative z axis of the view space
+    float distance = 0;
+    SceneNode *node = renderable->parentNode();
+
+    if (node && !node->worldBoundingBox().isNull()) {
+        const Box3d &box = node->worldBoundingBox();
+        Vector4 center = 0.5f * (box.minimum() + box.maximum());
+        distance = -(mDepthRow[0] * center.x() + mDepthRow[1] * center.y() + mDepthRow[2] * center.z()
+                     + mDepthRow[3]);
+    }
+
+    // The bits of positive floats are ordered like the floats themselves
+    quint32 distanceBits = 0;
+    if (distance > 0)
+        memcpy(&distanceBits, &distance, sizeof(distanceBits));
+
+    if (!renderable->isOpaque())
+        return key | BlendedBit | (quint32)~distanceBits;
+
+    uint program, material;
+    renderable->sortState(program, material);
+
+    key |= (quint64)(program & 0xFFFF) << ProgramShift;
+    key |= (quint64)(material & 0xFFFFF) << MaterialShift;
+    key |= distanceBits >> 8; // The sign bit is always clear, which leaves 23 bits
+
+    return key;
+}
+
+void RenderQueue::sort()
+{
+    int count = mEntries.size();
+    mSortBuffer.resize(count);
+
+    Entry *source = mEntries.data();
+    Entry *target = mSortBuffer.data();
+
+    // Least significant digit first radix sort, which keeps entries with equal keys in order
+    for (int shift = 0; shift < 64; shift += 8) {
+        int offsets[256];
+        memset(offsets, 0, sizeof(offsets));
+
+        for (int i = 0; i < count; ++i)
+            offsets[(source[i].key >> shift) & 0xFF]++;
+
+        // Skip digits that are the same for all keys, like the unused bits of blended objects
+        if (count == 0 || offsets[(source[0].key >> shift) & 0xFF] == count)
+            continue;
+
+        int offset = 0;
+        for (int i = 0; i < 256; ++i) {
+            int digitCount = offsets[i];
+            offsets[i] = offset;
+            offset += digitCount;
+        }
+
+        for (int i = 0; i < count; ++i)
+            target[offsets[(source[i].key >> shift) & 0xFF]++] = source[i];
+
+        qSwap(source, target);
+    }
+
+    if (source != mEntries.data())
+        memcpy(mEntries.data(), source, sizeof(Entry) * count);
+
+    // Find where each category starts
+    int entry = 0;
+    for (int category = 0; category < Renderable::Count; ++category) {
+        mCategoryStart[category] = entry;
+        while (entry < count && (int)(mEntries.at(entry).key >> CategoryShift) == category)
+            entry++;
+    }
+    mCategoryStart[Renderable::Count] = entry;
+
+    mSorted = true;
+}
+
+}
@@ -1,6 +1,8 @@
 #ifndef RENDERQUEUE_H
 #define RENDERQUEUE_H
 
+#include <QtCore/QVector>
+
 #include "renderable.h"
 #include "renderstates.h"
 
@@ -10,37 +12,88 @@ class Renderable;
 
 /**
   A utility class that is used to assemble a list of objects for rendering.
+
+  Every queued object is given a 64-bit key, and the keys are sorted once all objects have been
+  queued. From the most to the least significant bits, a key consists of:
+  - the category (3 bits)
+  - whether the object is blended with what is behind it (1 bit)
+  - for opaque objects, the shader program (16 bits), the material (20 bits) and the distance
+    to the camera (24 bits), so objects drawn with the same state follow each other, front to back
+  - for other objects, the inverted distance to the camera (32 bits), so they're drawn back to front
+
+  Objects with the same key stay in the order they were queued in.
   */
 class RenderQueue
 {
 public:
+    RenderQueue();
+
+    /**
+      Sets the view used to compute the distance of queued objects to the camera.
+      */
+    void setViewMatrix(const Matrix4 &viewMatrix);
+
     void addRenderable(Renderable::Category category, Renderable *renderable);
 
-    const QList<Renderable*> queuedObjects(Renderable::Category category) const;
+    /**
+      Sorts the queued objects by their keys. This has to be called before the objects are
+      accessed.
+      */
+    void sort();
+
+    int queuedCount(Renderable::Category category) const;
+    Renderable *queuedObject(Renderable::Category category, int index) const;
+
     void clear();
 private:
-    QList<Renderable*> mQueuedObjects[Renderable::Count];
+    struct Entry {
+        quint64 key;
+        Renderable *renderable;
+    };
+
+    quint64 sortKey(Renderable::Category category, const Renderable *renderable) const;
+
+    QVector<Entry> mEntries;
+    QVector<Entry> mSortBuffer;
+
+    int mCategoryStart[Renderable::Count + 1];
+    bool mSorted;
+
+    float mDepthRow[4]; // The row of the view matrix that computes the view space z coordinate
 };
 
 inline void RenderQueue::addRenderable(Renderable::Category category, Renderable *renderable)
 {
     if (category < Renderable::Count) {
-        mQueuedObjects[category].append(renderable);
+        Entry entry;
+        entry.key = sortKey(category, renderable);
+        entry.renderable = renderable;
+        mEntries.append(entry);
+        mSorted = false;
     } else {
         qWarning("Invalid render category.");
     }
 }
 
-inline const QList<Renderable*> RenderQueue::queuedObjects(Renderable::Category category) const
+inline int RenderQueue::queuedCount(Renderable::Category category) const
 {
     Q_ASSERT(category >= Renderable::Default && category < Renderable::Count);
-    return mQueuedObjects[category];
+    Q_ASSERT(mSorted);
+    return mCategoryStart[category + 1] - mCategoryStart[category];
+}
+
+inline Renderable *RenderQueue::queuedObject(Renderable::Category category, int index) const
+{
+    Q_ASSERT(index >= 0 && index < queuedCount(category));
+    return mEntries.at(mCategoryStart[category] + index).renderable;
 }
 
 inline void RenderQueue::clear()
 {
-    for (int i = Renderable::Default; i < Renderable::Count; ++i)
-        mQueuedObjects[i].clear();
+    mEntries.resize(0);
+    for (int i = 0; i <= Renderable::Count; ++i)
+        mCategoryStart[i] = 0;
+    mSorted = true;
 }
 
 }
@@ -16,6 +16,35 @@ namespace EvilTemple {
 class UniformBinder;
 class Light;
 
+/**
+  The lights affecting an object while it is drawn. The number of lights is limited, so the list
+  can be filled for every object without allocating memory.
+  */
+class GAME_EXPORT ActiveLights {
+public:
+    /**
+      Two passes of the model shaders, which handle up to 12 lights each.
+      */
+    static const int Capacity = 24;
+
+    ActiveLights();
+
+    bool isEmpty() const;
+    int size() const;
+    const Light *at(int i) const;
+
+    void clear();
+
+    /**
+      Adds a light to the list, which must not be full yet.
+      */
+    void append(const Light *light);
+
+private:
+    const Light *mLights[Capacity];
+    int mCount;
+};
+
 /**
  * Encapsulates various render state settings that influence the rendering of the scene.
  */
@@ -43,8 +72,8 @@ public:
     /**
     Returns the active lights in the scene.
     */
-    const QList<const Light*> &activeLights() const;
-    void setActiveLights(const QList<const Light*> &activeLights);
+    const ActiveLights &activeLights() const;
+    void setActiveLights(const ActiveLights &activeLights);
 
     /**
       Returns a 2D box that encapsulates the viewport in absolute screen coordinates.
@@ -98,9 +127,40 @@ private:
     float mTextureAnimationTime;
     QScopedPointer<UniformBinder> mTextureAnimationTimeBinder;
 
-    QList<const Light*> mActiveLights;
+    ActiveLights mActiveLights;
 };
 
+inline ActiveLights::ActiveLights() : mCount(0)
+{
+}
+
+inline bool ActiveLights::isEmpty() const
+{
+    return mCount == 0;
+}
+
+inline int ActiveLights::size() const
+{
+    return mCount;
+}
+
+inline const Light *ActiveLights::at(int i) const
+{
+    Q_ASSERT(i >= 0 && i < mCount);
+    return mLights[i];
+}
+
+inline void ActiveLights::clear()
+{
+    mCount = 0;
+}
+
+inline void ActiveLights::append(const Light *light)
+{
+    Q_ASSERT(mCount < Capacity);
+    mLights[mCount++] = light;
+}
+
 inline void RenderStates::setTextureAnimationTime(float t)
 {
     mTextureAnimationTime = t;
@@ -181,12 +241,12 @@ inline const Matrix4 &RenderStates::worldViewProjectionMatrix() const
     return mWorldViewProjectionMatrix;
 }
 
-inline const QList<const Light*> &RenderStates::activeLights() const
+inline const ActiveLights &RenderStates::activeLights() const
 {
     return mActiveLights;
 }
 
-inline void RenderStates::setActiveLights(const QList<const Light*> &activeLights)
+inline void RenderStates::setActiveLights(const ActiveLights &activeLights)
 {
     mActiveLights = activeLights;
 }
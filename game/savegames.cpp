@@ -62,6 +62,23 @@ static bool writePayload(const QString &path, const QString &payload)
     return true;
 }
 
+static bool writeFogOfWar(const QString &path, const QByteArray &fogOfWar)
+{
+    QFile file(path);
+
+    if (!file.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+        return false;
+    }
+
+    // Mostly explored or unexplored maps compress very well
+    QByteArray compressed = qCompress(fogOfWar);
+    bool written = (file.write(compressed) == compressed.size());
+
+    file.close();
+
+    return written;
+}
+
 static QScriptValue loadPayload(const QString &path, QScriptEngine *engine)
 {
     QFile file(path);
@@ -150,11 +167,20 @@ QScriptValue SaveGames::save(const QString &id,
                              const QString &name,
                              const QUrl &screenshot,
                              const QString &payload)
+{
+    return save(id, name, screenshot, payload, QByteArray());
+}
+
+QScriptValue SaveGames::save(const QString &id,
+                             const QString &name,
+                             const QUrl &screenshot,
+                             const QString &payload,
+                             const QByteArray &fogOfWar)
 {
     IndexRecord record;
 
     // Find a suitable id. TODO: This is not a very convincing algorithm.
-    if (id.isNull()) {
+    if (id.isEmpty()) {
         uint i = 1;
         do {
             record.id = QString("save%1").arg(i++);
@@ -221,6 +247,22 @@ QScriptValue SaveGames::save(const QString &id,
         return mEngine->currentContext()->throwError(errorMessage);
     }
 
+    // The fog of war is stored separately, since it is binary. Overwritten saves may have an old one.
+    QString fogOfWarPath = saveDirectory.absoluteFilePath("fog.dat");
+    if (fogOfWar.isEmpty()) {
+        if (saveDirectory.exists("fog.dat"))
+            saveDirectory.remove("fog.dat");
+    } else if (!writeFogOfWar(fogOfWarPath, fogOfWar)) {
+        QFile::remove(indexDatPath);
+        QFile::remove(payloadPath);
+        QFile::remove(fogOfWarPath);
+        QFile::remove(screenshotPath);
+        mSavesDirectory.remove(record.id);
+
+        QString errorMessage("Unable to write savegame fog of war: " + fogOfWarPath);
+        return mEngine->currentContext()->throwError(errorMessage);
+    }
+
     qDebug("Created new save @ %s.", qPrintable(mSavesDirectory.absoluteFilePath(record.id)));
 
     return indexRecordToObject(mEngine, record);
@@ -240,4 +282,21 @@ QScriptValue SaveGames::load(const QString &id)
     return loadPayload(payloadPath, mEngine);
 }
 
+QByteArray SaveGames::loadFogOfWar(const QString &id)
+{
+    QDir saveDir(mSavesDirectory);
+
+    if (!saveDir.cd(id) || !saveDir.exists("fog.dat"))
+        return QByteArray();
+
+    QFile file(saveDir.absoluteFilePath("fog.dat"));
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning("Unable to open savegame fog of war: %s", qPrintable(file.fileName()));
+        return QByteArray();
+    }
+
+    return qUncompress(file.readAll());
+}
+
 }
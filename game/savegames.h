@@ -1,6 +1,7 @@
 #ifndef SAVEGAMES_H
 #define SAVEGAMES_H
 
+#include <QByteArray>
 #include <QMetaType>
 #include <QObject>
 #include <QScriptEngine>
@@ -45,8 +46,8 @@ public slots:
       This can be used to overwrite existing save-games, or create savegames in fixed slots, like
       the quicksaves.
 
-      @param id The unique identifier of the savegame that should be overwritten or created. If this is null,
-                a new unique identifier will be generated.
+      @param id The unique identifier of the savegame that should be overwritten or created. If this is null
+                or empty, a new unique identifier will be generated.
       @param name The user defined name of the savegame.
       @param screenshot A URL pointing to a screenshot that will be copied to the savegame.
       @param payload The payload of the savegame.
@@ -57,6 +58,19 @@ public slots:
                       const QUrl &screenshot,
                       const QString &payload);
 
+    /**
+      Overwrites or saves a new savegame like the other overload, and stores a snapshot of the
+      fog of war next to the payload.
+
+      @param fogOfWar A snapshot created by FogOfWar::saveSnapshot. It is stored compressed.
+      @returns The record (as per @ref listSaves) of the new save game.
+      */
+    QScriptValue save(const QString &id,
+                      const QString &name,
+                      const QUrl &screenshot,
+                      const QString &payload,
+                      const QByteArray &fogOfWar);
+
     /**
       Loads a savegame.
 
@@ -65,6 +79,14 @@ public slots:
       */
     QScriptValue load(const QString &id);
 
+    /**
+      Loads the fog of war snapshot of a savegame.
+
+      @param id The savegame's unique id.
+      @return The uncompressed snapshot, which is empty if the savegame has none.
+      */
+    QByteArray loadFogOfWar(const QString &id);
+
 private:
     QDir mSavesDirectory;
     QScriptEngine *mEngine;
@@ -6,9 +6,12 @@
 #include "renderqueue.h"
 #include "scene.h"
 #include "lighting.h"
+#include "lightgrid.h"
 #include "renderable.h"
 #include "scenenode.h"
+#include "scenequadtree.h"
 #include "profiler.h"
+#include "glstate.h"
 #include "materials.h"
 
 #include <gamemath.h>
@@ -32,7 +35,7 @@ class SceneData {
 public:
 
     SceneData(Materials *materials)
-        : objectsDrawn(0), behindWallsMaterial(materials->load(":/material/behindwalls_material.xml"))
+        : objectsDrawn(0), nextNodeOrder(0), behindWallsMaterial(materials->load(":/material/behindwalls_material.xml"))
     {
         font.setFamily("Fontin");
         font.setPointSize(12);
@@ -47,7 +50,13 @@ public:
 
     SharedMaterialState behindWallsMaterial;
     QList<SceneNode*> sceneNodes;
+    SceneQuadtree sceneIndex; // Finds the nodes in the view frustum
+    QVector<SceneNode*> visibleNodes;
+    QVector<SceneQuadtree::RayHit> pickedNodes;
+    LightGrid lightGrid; // The visible lights of the current frame
+    ActiveLights activeLights;
     int objectsDrawn;
+    uint nextNodeOrder;
     RenderQueue renderQueue;
     QList<TextOverlay*> activeOverlays;
     QFont font;
@@ -67,6 +76,7 @@ SceneNode *Scene::createNode()
 {
     SceneNode *node = new SceneNode(this);
     d->sceneNodes.append(node);
+    d->sceneIndex.insert(node, d->nextNodeOrder++);
     return node;
 }
 
@@ -76,6 +86,7 @@ void Scene::removeNode(SceneNode *node)
         return;
 
     d->sceneNodes.removeOne(node);
+    d->sceneIndex.remove(node);
     node->setParentNode(NULL);
     node->deleteLater();
 }
@@ -106,15 +117,20 @@ void Scene::render(RenderStates &renderStates)
     d->objectsDrawn = 0;
 
     d->renderQueue.clear();
+    d->renderQueue.setViewMatrix(renderStates.viewMatrix());
 
     // Build a view frustum
     Frustum viewFrustum;
     viewFrustum.extract(renderStates.viewProjectionMatrix());
 
-    for (int i = 0; i < d->sceneNodes.size(); ++i) {
-        d->sceneNodes[i]->addVisibleObjects(viewFrustum, &d->renderQueue);
+    d->sceneIndex.findVisible(viewFrustum, d->visibleNodes);
+
+    for (int i = 0; i < d->visibleNodes.size(); ++i) {
+        d->visibleNodes[i]->addVisibleObjects(viewFrustum, &d->renderQueue);
     }
 
+    d->renderQueue.sort();
+
     const Renderable::Category renderOrder[Renderable::Count] = {
         Renderable::Background,
         Renderable::ClippingGeometry,
@@ -128,36 +144,51 @@ void Scene::render(RenderStates &renderStates)
     // Find all light sources that are visible.
     QList<const Light*> visibleLights;
 
-    foreach (Renderable *lightCanidate, d->renderQueue.queuedObjects(Renderable::Lights)) {
-        Light *light = qobject_cast<Light*>(lightCanidate);
+    for (int i = 0; i < d->renderQueue.queuedCount(Renderable::Lights); ++i) {
+        Light *light = qobject_cast<Light*>(d->renderQueue.queuedObject(Renderable::Lights, i));
         if (light) {
             visibleLights.append(light);
         }
     }
 
+    // Lights are only looked up for the visible objects, so the grid only has to cover them
+    Box3d visibleArea;
+    for (int i = 0; i < d->visibleNodes.size(); ++i) {
+        const Box3d &box = d->visibleNodes[i]->worldBoundingBox();
+        if (i == 0) {
+            visibleArea = box;
+        } else {
+            visibleArea.merge(box.minimum());
+            visibleArea.merge(box.maximum());
+        }
+    }
+
+    d->lightGrid.build(visibleLights, visibleArea);
+
     for (int catOrder = 0; catOrder < Renderable::Count; ++catOrder) {
         Renderable::Category category = renderOrder[catOrder];
-        const QList<Renderable*> &renderables = d->renderQueue.queuedObjects(category);
-        for (int i = 0; i < renderables.size(); ++i) {
-            Renderable *renderable = renderables.at(i);
+        for (int i = 0; i < d->renderQueue.queuedCount(category); ++i) {
+            Renderable *renderable = d->renderQueue.queuedObject(category, i);
 
             // Find all light sources that intersect the bounding volume of the given object
-            QList<const Light*> activeLights;
-
             SceneNode *sceneNode = renderable->parentNode();
 
             float bbExtent = (sceneNode->worldBoundingBox().maximum() - sceneNode->worldBoundingBox().minimum()).length();
 
-            for (int j = 0; j < visibleLights.size(); ++j) {
-                // TODO: This ignores the full position
-                float squaredRange = visibleLights[j]->range() * visibleLights[j]->range() + bbExtent * bbExtent;
+            // TODO: This ignores the full position
+            d->lightGrid.findLights(sceneNode->position(), bbExtent, d->activeLights);
 
-                float distance = (visibleLights[j]->position() - sceneNode->position()).lengthSquared();
-                if (distance <= squaredRange)
-                    activeLights.append(visibleLights[j]);
-            }
+            renderStates.setActiveLights(d->activeLights);
 
-            renderStates.setActiveLights(activeLights);
+            /*
+              Model instances only change state through GLState, so the state they leave behind can
+              be reused by the next one. Other objects expect the default state.
+              */
+            bool modelInstance = qobject_cast<ModelInstance*>(renderable) != NULL;
+            if (modelInstance && !GLState::isCaching())
+                GLState::beginCaching();
+            else if (!modelInstance && GLState::isCaching())
+                GLState::endCaching();
 
             renderStates.setWorldMatrix(renderable->worldTransform());
             renderable->render(renderStates);
@@ -166,16 +197,16 @@ void Scene::render(RenderStates &renderStates)
         }
     }
 
-    renderStates.setActiveLights(QList<const Light*>());
+    GLState::endCaching();
+
+    renderStates.setActiveLights(ActiveLights());
 
     // Now, render the behind-walls sections
     glClear(GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
 
-    const QList<Renderable*> &clippingRenderables = d->renderQueue.queuedObjects(Renderable::ClippingGeometry);
-
-    for (int i = 0; i < clippingRenderables.size(); ++i) {
-        Renderable *renderable = clippingRenderables.at(i);
+    for (int i = 0; i < d->renderQueue.queuedCount(Renderable::ClippingGeometry); ++i) {
+        Renderable *renderable = d->renderQueue.queuedObject(Renderable::ClippingGeometry, i);
 
         renderStates.setWorldMatrix(renderable->worldTransform());
         renderable->render(renderStates);
@@ -186,10 +217,10 @@ void Scene::render(RenderStates &renderStates)
     glDepthFunc(GL_GEQUAL); // Flip depth-test so primitives are drawn when depth-test fails
     glDepthMask(GL_FALSE); // But don't actually modify the depth-buffer
 
-    const QList<Renderable*> &defaultRenderables = d->renderQueue.queuedObjects(Renderable::Default);
+    GLState::beginCaching();
 
-    for (int i = 0; i < defaultRenderables.size(); ++i) {
-        ModelInstance *renderable = qobject_cast<ModelInstance*>(defaultRenderables.at(i));
+    for (int i = 0; i < d->renderQueue.queuedCount(Renderable::Default); ++i) {
+        ModelInstance *renderable = qobject_cast<ModelInstance*>(d->renderQueue.queuedObject(Renderable::Default, i));
         if (!renderable || !renderable->drawsBehindWalls())
             continue;
 
@@ -197,6 +228,8 @@ void Scene::render(RenderStates &renderStates)
         renderable->render(renderStates, d->behindWallsMaterial.data());
     }
 
+    GLState::endCaching();
+
     glDepthFunc(GL_LESS);
     glDepthMask(GL_TRUE);
 
@@ -252,6 +285,11 @@ void Scene::render(RenderStates &renderStates)
     glEnable(GL_MULTISAMPLE);
 }
 
+void Scene::nodeChanged(SceneNode *node)
+{
+    d->sceneIndex.invalidate(node);
+}
+
 int Scene::objectsDrawn() const
 {
     return d->objectsDrawn;
@@ -259,22 +297,21 @@ int Scene::objectsDrawn() const
 
 SceneNode *Scene::pickNode(const Ray3d &ray) const
 {
-    SceneNode *picked;
+    d->sceneIndex.findIntersecting(ray, d->pickedNodes);
 
-    for (int i = 0; i < d->sceneNodes.size(); ++i) {
-        SceneNode *node = d->sceneNodes.at(i);
+    for (int i = 0; i < d->pickedNodes.size(); ++i) {
+        SceneNode *node = d->pickedNodes.at(i).node;
 
         if (!node->isInteractive())
             continue;
 
         Ray3d localRay = node->fullTransform().inverted() * ray;
 
-        if (localRay.intersects(node->boundingBox())) {
-            picked = node;
-        }
+        if (localRay.intersects(node->boundingBox()))
+            return node;
     }
 
-    return picked;
+    return NULL;
 }
 
 Renderable *Scene::pickRenderable(const Ray3d &ray) const
@@ -282,8 +319,16 @@ Renderable *Scene::pickRenderable(const Ray3d &ray) const
     Renderable *picked = NULL;
     float distance = std::numeric_limits<float>::infinity();
 
-    for (int i = 0; i < d->sceneNodes.size(); ++i) {
-        SceneNode *node = d->sceneNodes.at(i);
+    d->sceneIndex.findIntersecting(ray, d->pickedNodes);
+
+    for (int i = 0; i < d->pickedNodes.size(); ++i) {
+        const SceneQuadtree::RayHit &hit = d->pickedNodes.at(i);
+
+        // Nodes are ordered by where the ray enters their box, so the remaining nodes are farther away
+        if (hit.distance >= distance)
+            break;
+
+        SceneNode *node = hit.node;
 
         if (!node->isInteractive())
             continue;
@@ -291,11 +336,21 @@ Renderable *Scene::pickRenderable(const Ray3d &ray) const
         Ray3d localRay = node->fullTransform().inverted() * ray;
 
         if (localRay.intersects(node->boundingBox())) {
+            // Renderables measure distances along the ray in the space of the node
+            float scale = ray.direction().length() / localRay.direction().length();
+
             foreach (Renderable *renderable, node->attachedObjects()) {
                 IntersectionResult intersection = renderable->intersect(localRay);
-                if (intersection.intersects && intersection.distance < distance) {
+
+                if (!intersection.intersects)
+                    continue;
+
+                // The background map is hit at the largest distance possible, which has to stay finite
+                float intersectionDistance = qMin(intersection.distance * scale, std::numeric_limits<float>::max());
+
+                if (intersectionDistance < distance) {
                     picked = renderable;
-                    distance = intersection.distance;
+                    distance = intersectionDistance;
                 }
             }
         }
@@ -307,6 +362,9 @@ Renderable *Scene::pickRenderable(const Ray3d &ray) const
 void Scene::clear()
 {
     d->sceneNodes.clear();
+    d->sceneIndex.clear();
+    d->visibleNodes.clear();
+    d->pickedNodes.clear();
     qDeleteAll(children());
 }
 
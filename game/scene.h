@@ -27,6 +27,11 @@ public:
 
     void render(RenderStates &renderStates);
 
+    /**
+      Called by nodes of this scene when their world bounding box changes.
+      */
+    void nodeChanged(SceneNode *node);
+
 public slots:
     /**
       Creates a new scene node and adds it as a top-level node to the scene.
@@ -88,6 +88,15 @@ void SceneNode::updateBoundingBox() const
     mBoundingBoxInvalid = false;
 }
 
+void SceneNode::invalidateWorldBoundingBox()
+{
+    mWorldBoundingBoxInvalid = true;
+
+    // The scene indexes its nodes by their world bounding box
+    if (mScene)
+        mScene->nodeChanged(this);
+}
+
 void SceneNode::attachObject(Renderable *renderable)
 {
     if (!renderable) {
@@ -105,13 +114,16 @@ void SceneNode::attachObject(Renderable *renderable)
         renderable->setParentNode(this);
         mAttachedObjects.append(renderable);
         mBoundingBoxInvalid = true;
-        mWorldBoundingBoxInvalid = true;
+        invalidateWorldBoundingBox();
     }
 }
 
 void SceneNode::detachObject(Renderable *renderable)
 {
-    mAttachedObjects.removeOne(renderable);
+    if (mAttachedObjects.removeOne(renderable)) {
+        mBoundingBoxInvalid = true;
+        invalidateWorldBoundingBox();
+    }
 }
 
 };
@@ -102,6 +102,7 @@ public slots:
 private:
     void updateFullTransform() const;
     void updateBoundingBox() const;
+    void invalidateWorldBoundingBox();
 
     Vector4 mScale;
     Quaternion mRotation;
@@ -200,7 +201,7 @@ inline void SceneNode::setPosition(const Vector4 &position)
     mPosition = position;
     mWorldMatrixInvalid = true;
     mFullTransformInvalid = true;
-    mWorldBoundingBoxInvalid = true;
+    invalidateWorldBoundingBox();
 }
 
 inline void SceneNode::setRotation(const Quaternion &rotation)
@@ -208,7 +209,7 @@ inline void SceneNode::setRotation(const Quaternion &rotation)
     mRotation = rotation;
     mWorldMatrixInvalid = true;
     mFullTransformInvalid = true;
-    mWorldBoundingBoxInvalid = true;
+    invalidateWorldBoundingBox();
 }
 
 inline void SceneNode::setScale(const Vector4 &scale)
@@ -216,7 +217,7 @@ inline void SceneNode::setScale(const Vector4 &scale)
     mScale = scale;
     mWorldMatrixInvalid = true;
     mFullTransformInvalid = true;
-    mWorldBoundingBoxInvalid = true;
+    invalidateWorldBoundingBox();
 }
 
 inline void SceneNode::setInteractive(bool interactive)
@@ -0,0 +1,304 @@
+
+#include <QtCore/QtAlgorithms>
+
+#include <limits>
+
+#include "scenequadtree.h"
+#include "scenenode.h"
+
+namespace EvilTemple {
+
+const float SceneQuadtree::Sidelength = 32768;
+
+SceneQuadtree::Cell::Cell(Cell *_parent) : parent(_parent), count(0)
+{
+    for (int i = 0; i < 4; ++i)
+        children[i] = NULL;
+}
+
+SceneQuadtree::Cell::~Cell()
+{
+    for (int i = 0; i < 4; ++i)
+        delete children[i];
+}
+
+SceneQuadtree::SceneQuadtree() : mRoot(NULL), mUnbounded(NULL),
+    mMinY(std::numeric_limits<float>::infinity()), mMaxY(-std::numeric_limits<float>::infinity())
+{
+}
+
+SceneQuadtree::~SceneQuadtree()
+{
+}
+
+void SceneQuadtree::insert(SceneNode *node, uint order)
+{
+    Entry entry;
+    entry.cell = NULL;
+    entry.order = order;
+    entry.dirty = true;
+    mEntries.insert(node, entry);
+    mDirty.append(node);
+}
+
+void SceneQuadtree::remove(SceneNode *node)
+{
+    QHash<SceneNode*, Entry>::iterator it = mEntries.find(node);
+
+    if (it == mEntries.end())
+        return;
+
+    take(node, it.value());
+    mEntries.erase(it);
+
+    // Dirty nodes that are no longer in the tree are skipped when the tree is updated
+}
+
+void SceneQuadtree::invalidate(SceneNode *node)
+{
+    QHash<SceneNode*, Entry>::iterator it = mEntries.find(node);
+
+    if (it != mEntries.end() && !it->dirty) {
+        it->dirty = true;
+        mDirty.append(node);
+    }
+}
+
+void SceneQuadtree::clear()
+{
+    for (int i = 0; i < 4; ++i) {
+        delete mRoot.children[i];
+        mRoot.children[i] = NULL;
+    }
+    mRoot.items.clear();
+    mRoot.count = 0;
+    mUnbounded.items.clear();
+    mUnbounded.count = 0;
+
+    mEntries.clear();
+    mDirty.clear();
+    mMinY = std::numeric_limits<float>::infinity();
+    mMaxY = -std::numeric_limits<float>::infinity();
+}
+
+void SceneQuadtree::take(SceneNode *node, Entry &entry)
+{
+    if (!entry.cell)
+        return;
+
+    QVector<Item> &items = entry.cell->items;
+    for (int i = 0; i < items.size(); ++i) {
+        if (items[i].node == node) {
+            items[i] = items.last();
+            items.resize(items.size() - 1);
+            break;
+        }
+    }
+
+    for (Cell *cell = entry.cell; cell; cell = cell->parent)
+        cell->count--;
+
+    entry.cell = NULL;
+}
+
+void SceneQuadtree::place(SceneNode *node, Entry &entry)
+{
+    const Box3d &box = node->worldBoundingBox();
+
+    Cell *cell;
+
+    if (box.isNull()) {
+        cell = &mUnbounded;
+    } else {
+        const Vector4 &minimum = box.minimum();
+        const Vector4 &maximum = box.maximum();
+
+        mMinY = qMin(mMinY, minimum.y());
+        mMaxY = qMax(mMaxY, maximum.y());
+
+        float centerX = (minimum.x() + maximum.x()) * 0.5f;
+        float centerZ = (minimum.z() + maximum.z()) * 0.5f;
+        float extent = qMax(maximum.x() - minimum.x(), maximum.z() - minimum.z()) * 0.5f;
+
+        cell = &mRoot;
+
+        // Nodes outside of the tree stay in the root, which is always visible
+        if (centerX >= 0 && centerZ >= 0 && centerX < Sidelength && centerZ < Sidelength) {
+            float x = 0, z = 0, size = Sidelength;
+
+            // A child cell can hold the node if its extent is at most half the child's size
+            for (int depth = 0; depth < MaxDepth && extent <= size * 0.25f; ++depth) {
+                size *= 0.5f;
+
+                int child = 0;
+                if (centerX >= x + size) {
+                    x += size;
+                    child |= 1;
+                }
+                if (centerZ >= z + size) {
+                    z += size;
+                    child |= 2;
+                }
+
+                if (!cell->children[child])
+                    cell->children[child] = new Cell(cell);
+                cell = cell->children[child];
+            }
+        }
+    }
+
+    Item item;
+    item.node = node;
+    item.order = entry.order;
+    cell->items.append(item);
+
+    for (Cell *parent = cell; parent; parent = parent->parent)
+        parent->count++;
+
+    entry.cell = cell;
+}
+
+void SceneQuadtree::addItems(const Cell *cell, const Frustum &frustum, float x, float z, float size,
+                             QVector<Item> &items) const
+{
+    if (!cell || !cell->count)
+        return;
+
+    // The root also holds the nodes outside of the tree, so it is never culled
+    if (cell != &mRoot) {
+        float margin = size * 0.5f;
+        Box3d looseBounds(Vector4(x - margin, mMinY, z - margin, 1),
+                          Vector4(x + size + margin, mMaxY, z + size + margin, 1));
+
+        if (!frustum.isVisible(looseBounds))
+            return;
+    }
+
+    items += cell->items;
+
+    float childSize = size * 0.5f;
+    addItems(cell->children[0], frustum, x, z, childSize, items);
+    addItems(cell->children[1], frustum, x + childSize, z, childSize, items);
+    addItems(cell->children[2], frustum, x, z + childSize, childSize, items);
+    addItems(cell->children[3], frustum, x + childSize, z + childSize, childSize, items);
+}
+
+void SceneQuadtree::update()
+{
+    // Place the nodes whose bounding box changed since the last query
+    foreach (SceneNode *node, mDirty) {
+        QHash<SceneNode*, Entry>::iterator it = mEntries.find(node);
+
+        if (it == mEntries.end() || !it->dirty)
+            continue;
+
+        take(node, it.value());
+        place(node, it.value());
+        it->dirty = false;
+    }
+    mDirty.clear();
+}
+
+void SceneQuadtree::findVisible(const Frustum &frustum, QVector<SceneNode*> &result)
+{
+    update();
+
+    QVector<Item> items = mUnbounded.items;
+    addItems(&mRoot, frustum, 0, 0, Sidelength, items);
+
+    // Keep the order the nodes were created in, which is the order they used to be drawn in
+    qSort(items);
+
+    result.resize(items.size());
+    for (int i = 0; i < items.size(); ++i)
+        result[i] = items[i].node;
+}
+
+/**
+  Computes where a ray enters a box, as a multiple of the ray's direction.
+  */
+static bool intersectBox(const Vector4 &origin, const Vector4 &direction, const Vector4 &minimum,
+                         const Vector4 &maximum, float &entry)
+{
+    float nearest = 0;
+    float farthest = std::numeric_limits<float>::infinity();
+
+    for (int axis = 0; axis < 3; ++axis) {
+        float start = origin.data()[axis];
+        float step = direction.data()[axis];
+
+        if (qFuzzyIsNull(step)) {
+            if (start < minimum.data()[axis] || start > maximum.data()[axis])
+                return false;
+            continue;
+        }
+
+        float low = (minimum.data()[axis] - start) / step;
+        float high = (maximum.data()[axis] - start) / step;
+
+        if (low > high)
+            qSwap(low, high);
+
+        nearest = qMax(nearest, low);
+        farthest = qMin(farthest, high);
+
+        if (nearest > farthest)
+            return false;
+    }
+
+    entry = nearest;
+    return true;
+}
+
+void SceneQuadtree::addIntersecting(const Cell *cell, const Ray3d &ray, float x, float z, float size,
+                                    QVector<RayHit> &hits) const
+{
+    if (!cell || !cell->count)
+        return;
+
+    Vector4 origin = ray.origin();
+    Vector4 direction = ray.direction();
+    float entry;
+
+    // The root also holds the nodes outside of the tree, so it is never culled
+    if (cell != &mRoot) {
+        float margin = size * 0.5f;
+        Vector4 minimum(x - margin, mMinY, z - margin, 1);
+        Vector4 maximum(x + size + margin, mMaxY, z + size + margin, 1);
+
+        if (!intersectBox(origin, direction, minimum, maximum, entry))
+            return;
+    }
+
+    float directionLength = direction.length();
+
+    for (int i = 0; i < cell->items.size(); ++i) {
+        SceneNode *node = cell->items[i].node;
+        const Box3d &box = node->worldBoundingBox();
+
+        if (intersectBox(origin, direction, box.minimum(), box.maximum(), entry)) {
+            RayHit hit;
+            hit.node = node;
+            hit.distance = entry * directionLength;
+            hits.append(hit);
+        }
+    }
+
+    float childSize = size * 0.5f;
+    addIntersecting(cell->children[0], ray, x, z, childSize, hits);
+    addIntersecting(cell->children[1], ray, x + childSize, z, childSize, hits);
+    addIntersecting(cell->children[2], ray, x, z + childSize, childSize, hits);
+    addIntersecting(cell->children[3], ray, x + childSize, z + childSize, childSize, hits);
+}
+
+void SceneQuadtree::findIntersecting(const Ray3d &ray, QVector<RayHit> &result)
+{
+    update();
+
+    result.clear();
+    addIntersecting(&mRoot, ray, 0, 0, Sidelength, result);
+
+    qSort(result);
+}
+
+}
@@ -0,0 +1,145 @@
+#ifndef SCENEQUADTREE_H
+#define SCENEQUADTREE_H
+
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+#include <gamemath.h>
+using namespace GameMath;
+
+namespace EvilTemple {
+
+class SceneNode;
+
+/**
+  A loose quadtree over the XZ plane that finds the scene nodes within a view frustum, without
+  testing every node of the scene.
+
+  Every node is stored in the smallest cell that contains the center of its world bounding box
+  and is at least twice as large as the box. The bounds of a cell are extended by half its size
+  on every side, so they contain all nodes stored in the cell, and a node is placed by its size and
+  center alone. Cells along the frustum are tested against it, which skips the nodes of all other
+  cells at once.
+
+  Nodes are only placed again when their bounding box changed, which the nodes report through
+  invalidate(). Nodes without a bounding box and nodes outside of the tree are always visible.
+  */
+class SceneQuadtree
+{
+public:
+    SceneQuadtree();
+    ~SceneQuadtree();
+
+    /**
+      The side length of the area covered by the tree, starting at the origin of the map.
+      */
+    static const float Sidelength;
+
+    /**
+      The depth of the smallest cells. With a side length of 32768 units, these are 128 units
+      across, which is a little less than the height of a character.
+      */
+    static const int MaxDepth = 8;
+
+    /**
+      Adds a node. It is placed once the tree is queried, so its bounding box may still change.
+      @param order Visible nodes are returned in the order of this number.
+      */
+    void insert(SceneNode *node, uint order);
+
+    void remove(SceneNode *node);
+
+    /**
+      Marks the bounding box of a node as changed. Nodes that are not in the tree are ignored.
+      */
+    void invalidate(SceneNode *node);
+
+    void clear();
+
+    /**
+      Finds the nodes that may be visible in a frustum, ordered by the order they were inserted
+      with. The nodes still have to test their own bounding box.
+      */
+    void findVisible(const Frustum &frustum, QVector<SceneNode*> &result);
+
+    /**
+      A node whose world bounding box is hit by a ray, and the distance at which the ray enters it.
+      */
+    struct RayHit {
+        SceneNode *node;
+        float distance;
+
+        bool operator <(const RayHit &other) const;
+    };
+
+    /**
+      Finds the nodes whose world bounding box is hit by a ray, ordered front to back by the
+      distance at which the ray enters their box. Once a hit closer than the next box has been
+      found, the remaining nodes can be skipped. Nodes without a bounding box are never hit.
+      */
+    void findIntersecting(const Ray3d &ray, QVector<RayHit> &result);
+
+    int size() const;
+
+private:
+    struct Item {
+        SceneNode *node;
+        uint order;
+
+        bool operator <(const Item &other) const;
+    };
+
+    struct Cell {
+        Cell(Cell *_parent);
+        ~Cell();
+
+        Cell *parent;
+        Cell *children[4];
+        QVector<Item> items;
+        int count; // Items in this cell and its children
+    };
+
+    struct Entry {
+        Cell *cell; // NULL if the node wasn't placed yet
+        uint order;
+        bool dirty;
+    };
+
+    void place(SceneNode *node, Entry &entry);
+    void take(SceneNode *node, Entry &entry);
+    void update();
+    void addItems(const Cell *cell, const Frustum &frustum, float x, float z, float size, QVector<Item> &items) const;
+    void addIntersecting(const Cell *cell, const Ray3d &ray, float x, float z, float size,
+                         QVector<RayHit> &hits) const;
+
+    Cell mRoot;
+    Cell mUnbounded; // Nodes without a bounding box, which are not part of the tree
+
+    QHash<SceneNode*, Entry> mEntries;
+    QVector<SceneNode*> mDirty;
+
+    // The vertical extent of all nodes that were ever placed
+    float mMinY;
+    float mMaxY;
+
+    Q_DISABLE_COPY(SceneQuadtree)
+};
+
+inline bool SceneQuadtree::Item::operator <(const Item &other) const
+{
+    return order < other.order;
+}
+
+inline bool SceneQuadtree::RayHit::operator <(const RayHit &other) const
+{
+    return distance < other.distance;
+}
+
+inline int SceneQuadtree::size() const
+{
+    return mEntries.size();
+}
+
+}
+
+#endif // SCENEQUADTREE_H
@@ -247,6 +247,11 @@ void Vector4Scriptable::registerWith(QScriptEngine *engine)
     qScriptRegisterMetaType<Vector4>(engine, float4ToScriptValue<Vector4>, float4FromScriptValue<Vector4>);
 }
 
+QScriptValue Vector4Scriptable::toScriptValue(QScriptEngine *engine, const QVector<Vector4> &points)
+{
+    return vectorOfVector4ToScriptValue(engine, points);
+}
+
 void QuaternionScriptable::registerWith(QScriptEngine *engine)
 {
     qScriptRegisterMetaType<Quaternion>(engine, float4ToScriptValue<Quaternion>, float4FromScriptValue<Quaternion>);
@@ -45,6 +45,11 @@ namespace EvilTemple {
     class Vector4Scriptable {
     public:
         static void registerWith(QScriptEngine *engine);
+
+        /**
+          Converts a list of points (i.e. a path) into a script array.
+          */
+        static QScriptValue toScriptValue(QScriptEngine *engine, const QVector<Vector4> &points);
     };
 
     class QuaternionScriptable {
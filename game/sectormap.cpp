@@ -5,6 +5,7 @@
 #include "scene.h"
 
 #include "navigationmesh.h"
+#include "pathrequests.h"
 
 #include <QFile>
 #include <QTextStream>
@@ -27,9 +28,11 @@ namespace EvilTemple {
         SharedNavigationMesh flyableMesh;
 
         RegionLayers regionLayers;
+
+        PathRequests *pathRequests;
     };
 
-    SectorMapData::SectorMapData() : flyableMesh(0), walkableMesh(0), scene(0)
+    SectorMapData::SectorMapData() : flyableMesh(0), walkableMesh(0), scene(0), pathRequests(0)
     {
 
     }
@@ -37,6 +40,7 @@ namespace EvilTemple {
     SectorMap::SectorMap(Scene *scene) : d(new SectorMapData)
     {
         d->scene = scene;
+        d->pathRequests = new PathRequests(this);
     }
 
     SectorMap::~SectorMap()
@@ -226,12 +230,13 @@ namespace EvilTemple {
         mPortalVertexBuffer.release();
     }
 
-    QVector<Vector4> SectorMap::findPath(const Vector4 &start, const Vector4 &end) const
+    QVector<Vector4> SectorMap::findPath(const Vector4 &start, const Vector4 &end,
+                                         const QString &excludedObstacle) const
     {
         if (d->walkableMesh) {
             QElapsedTimer timer;
             timer.start();
-            QVector<Vector4> result = d->walkableMesh->findPath(start, end);
+            QVector<Vector4> result = d->walkableMesh->findPath(start, end, excludedObstacle);
             qint64 elapsed = timer.elapsed();
             if (elapsed > 10)
                 qDebug("Total time for pathfinding: %ld ms.", elapsed);
@@ -242,6 +247,30 @@ namespace EvilTemple {
             return QVector<Vector4>();
     }
 
+    uint SectorMap::findPathAsync(const Vector4 &start, const Vector4 &end, const QScriptValue &callback,
+                                  const QString &excludedObstacle)
+    {
+        return NavigationMesh::findPathAsync(d->walkableMesh, start, end, d->pathRequests, callback,
+                                             excludedObstacle);
+    }
+
+    bool SectorMap::cancelPathRequest(uint id)
+    {
+        return d->pathRequests->cancel(id);
+    }
+
+    void SectorMap::setObstacle(const QString &id, const Vector4 &position, float radius)
+    {
+        if (d->walkableMesh)
+            d->walkableMesh->changeDynamicObstacle(id, position, radius, false);
+    }
+
+    void SectorMap::removeObstacle(const QString &id)
+    {
+        if (d->walkableMesh)
+            d->walkableMesh->removeDynamicObstacle(id);
+    }
+
     bool SectorMap::hasLineOfSight(const Vector4 &from, const Vector4 &to) const
     {
         if (d->flyableMesh)
@@ -258,6 +287,7 @@ namespace EvilTemple {
             return false;
 
         d->regionLayers.clear();
+        d->pathRequests->cancelAll();
         d->walkableMesh.clear();
         d->flyableMesh.clear();
 
@@ -265,10 +295,24 @@ namespace EvilTemple {
         stream.setByteOrder(QDataStream::LittleEndian);
         stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
 
+        // Files without a header are from the first version
+        uint version = 1;
+
+        if (file.peek(sizeof(NavigationMesh::FileMagic)) == QByteArray(NavigationMesh::FileMagic, sizeof(NavigationMesh::FileMagic))) {
+            stream.skipRawData(sizeof(NavigationMesh::FileMagic));
+            stream >> version;
+
+            if (version > NavigationMesh::FileVersion) {
+                qWarning("The regions file %s has the unsupported version %d.", qPrintable(filename), version);
+                return false;
+            }
+        }
+
         d->walkableMesh = SharedNavigationMesh(new NavigationMesh);
         d->flyableMesh = SharedNavigationMesh(new NavigationMesh);
 
-        stream >> *(d->walkableMesh.data()) >> *(d->flyableMesh.data());
+        d->walkableMesh->load(stream, version);
+        d->flyableMesh->load(stream, version);
 
         while (!stream.atEnd()) {
             QString layerName;
@@ -4,6 +4,7 @@
 #include <QObject>
 #include <QScopedPointer>
 #include <QPolygon>
+#include <QScriptValue>
 
 #include "renderable.h"
 #include "texture.h"
@@ -77,10 +78,39 @@ public slots:
 
     bool createDebugLayer(const QString &layerName, const Vector4 &baseColor) const;
 
-    QVector<Vector4> findPath(const Vector4 &start, const Vector4 &end) const;
+    /**
+      Finds a path on the walkable navigation mesh. The obstacle with the given id, usually the one of
+      the actor that is moving, doesn't block the path.
+      */
+    QVector<Vector4> findPath(const Vector4 &start, const Vector4 &end,
+                              const QString &excludedObstacle = QString()) const;
+
+    /**
+      Finds a path on the walkable navigation mesh using a worker thread and passes it to the callback.
+      @return The identifier of the request, which can be passed to cancelPathRequest.
+      */
+    uint findPathAsync(const Vector4 &start, const Vector4 &end, const QScriptValue &callback,
+                       const QString &excludedObstacle = QString());
+
+    /**
+      Drops a request made using findPathAsync, so its callback won't be called.
+      */
+    bool cancelPathRequest(uint id);
 
     bool hasLineOfSight(const Vector4 &from, const Vector4 &to) const;
 
+    /**
+      Adds an obstacle to the walkable navigation mesh or moves an existing one. Obstacles are
+      dropped when another map is loaded. The obstacles of a Map are only registered with its tile
+      pathfinder, so whoever uses a sector map for paths has to register them here as well.
+
+      This only approximates the obstacle: a portal is blocked only if both gaps the obstacle leaves
+      in it are narrower than its diameter, and a rectangle only if the obstacle covers it completely.
+      Paths that are pulled through the portal funnel can therefore still cross the obstacle itself.
+      */
+    void setObstacle(const QString &id, const Vector4 &position, float radius);
+    void removeObstacle(const QString &id);
+
     QVariant regionTag(const QString &layer, const Vector4 &at) const;
 
 private:
@@ -26,6 +26,8 @@ public:
 
     bool isValid() const;
 
+    GLuint handle() const;
+
     bool load(QImage image);
 
     void setMinFilter(GLenum minFilter);
@@ -103,6 +105,11 @@ inline bool Texture::isValid() const
         return mHandle != 0;
 }
 
+inline GLuint Texture::handle() const
+{
+        return mHandle;
+}
+
 // Holders of textures should use this pointer type instead of textures directly
 typedef QSharedPointer<Texture> SharedTexture;
 
@@ -4,10 +4,13 @@
 #include <QFile>
 #include <QDataStream>
 
+#include <limits>
+#include <string.h>
+
 namespace EvilTemple {
 
 TileInfo::TileInfo(QObject *parent) :
-    QObject(parent)
+    QObject(parent), mDense(true)
 {
 }
 
@@ -25,9 +28,405 @@ bool TileInfo::load(const QString &filename)
             >> mTileMaterial >> mTileHeight >> mVisionExtend
             >> mVisionEnd >> mVisionBase >> mVisionArchway;
 
-    return stream.status() == QDataStream::Ok;
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    if (mDense)
+        decodeRasters();
+
+    buildClearance();
+
+    emit loaded();
+
+    return true;
+}
+
+void TileInfo::setDense(bool dense)
+{
+    if (mDense == dense)
+        return;
+
+    mDense = dense;
+
+    if (mDense) {
+        decodeRasters();
+    } else {
+        // Release the memory used by the rasters
+        mWalkableRaster = BitRaster();
+        mFlyableRaster = BitRaster();
+        mHeightRaster = CharRaster();
+        mVisionExtendRaster = BitRaster();
+        mVisionEndRaster = BitRaster();
+        mVisionBaseRaster = BitRaster();
+        mVisionArchwayRaster = BitRaster();
+    }
+}
+
+void TileInfo::decodeRasters()
+{
+    mWalkableRaster.decode(mWalkableTiles);
+    mFlyableRaster.decode(mFlyableTiles);
+    mHeightRaster.decode(mTileHeight);
+    mVisionExtendRaster.decode(mVisionExtend);
+    mVisionEndRaster.decode(mVisionEnd);
+    mVisionBaseRaster.decode(mVisionBase);
+    mVisionArchwayRaster.decode(mVisionArchway);
 }
 
 const float TileInfo::UnitsPerTile = 28.2842703f / 3;
 
+/*
+  The largest squared distance the clearance table covers. Anything beyond it exceeds the maximum
+  clearance anyway.
+ */
+static const int DistanceCap = ClearanceMap::MaxClearance * ClearanceMap::MaxClearance;
+
+/**
+  Computes the one-dimensional squared euclidean distance transform of f in linear time
+  (see Felzenszwalb & Huttenlocher, "Distance Transforms of Sampled Functions").
+  The result is d[q] = min((q - p)^2 + f[p]) over all p. v and z are scratch buffers with room for
+  n and n + 1 elements respectively.
+  */
+static void distanceTransform(const int *f, int n, int *d, int *v, float *z)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = - std::numeric_limits<float>::max();
+    z[1] = std::numeric_limits<float>::max();
+
+    for (int q = 1; q < n; ++q) {
+        float s;
+
+        forever {
+            int p = v[k];
+            s = ((f[q] + q * q) - (f[p] + p * p)) / (2.0f * (q - p));
+            if (s > z[k])
+                break;
+            k--;
+        }
+
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = std::numeric_limits<float>::max();
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k + 1] < q)
+            k++;
+        int p = v[k];
+        d[q] = (q - p) * (q - p) + f[p];
+    }
+}
+
+/**
+  Converts a squared distance to the nearest blocked tile into a clearance value.
+  The largest radius r that fits is the largest r with r^2 < distance, which means the clearance
+  (r + 1) is the smallest c with c^2 >= distance.
+  */
+static uchar clearanceFromDistance(int squaredDistance)
+{
+    int c = 0;
+    while (c * c < squaredDistance && c < ClearanceMap::MaxClearance)
+        c++;
+    return c;
+}
+
+void TileInfo::computeClearance(const QRect &window, const QVector<uchar> &blocked, const QRect &target)
+{
+    static uchar clearanceTable[DistanceCap + 1];
+    static bool clearanceTableInitialized = false;
+
+    if (!clearanceTableInitialized) {
+        for (int i = 0; i <= DistanceCap; ++i)
+            clearanceTable[i] = clearanceFromDistance(i);
+        clearanceTableInitialized = true;
+    }
+
+    Q_ASSERT(window.contains(target));
+
+    // Distances are clamped to the square of the limit, which maps to the limit itself
+    int distanceCap = mClearance.mLimit * mClearance.mLimit;
+
+    int width = window.width();
+    int height = window.height();
+    int n = qMax(width, height);
+
+    QVector<quint16> columns(width * height);
+    QVector<int> f(n), d(n), v(n);
+    QVector<float> z(n + 1);
+
+    // First pass: distances to the nearest blocked tile in the same column
+    for (int x = 0; x < width; ++x) {
+        for (int y = 0; y < height; ++y)
+            f[y] = blocked[y * width + x] ? 0 : distanceCap;
+
+        distanceTransform(f.data(), height, d.data(), v.data(), z.data());
+
+        for (int y = 0; y < height; ++y)
+            columns[y * width + x] = qMin(d[y], distanceCap);
+    }
+
+    const QRect &extent = mClearance.mExtent;
+    uchar *values = mClearance.mValues.data();
+
+    // Second pass: combine the column distances along each row of the target area
+    for (int y = target.top(); y <= target.bottom(); ++y) {
+        int row = y - window.top();
+
+        for (int x = 0; x < width; ++x)
+            f[x] = columns[row * width + x];
+
+        distanceTransform(f.data(), width, d.data(), v.data(), z.data());
+
+        uchar *out = values + (y - extent.top()) * extent.width() + (target.left() - extent.left());
+        for (int x = target.left(); x <= target.right(); ++x)
+            *(out++) = clearanceTable[qMin(d[x - window.left()], distanceCap)];
+    }
+}
+
+/**
+  Collects the bounding rectangle of all walkable leaves and rasterizes them into a blocked-map.
+  */
+struct WalkableExtentVisitor {
+    QRect extent;
+
+    void operator()(int x, int y, int sidelength, bool walkable)
+    {
+        if (walkable)
+            extent = extent.united(QRect(x, y, sidelength, sidelength));
+    }
+};
+
+struct WalkableRasterVisitor {
+    QRect window;
+    QVector<uchar> *blocked;
+
+    void operator()(int x, int y, int sidelength, bool walkable)
+    {
+        if (!walkable)
+            return;
+
+        QRect area = QRect(x, y, sidelength, sidelength).intersected(window);
+
+        for (int ty = area.top(); ty <= area.bottom(); ++ty) {
+            uchar *row = blocked->data() + (ty - window.top()) * window.width() + (area.left() - window.left());
+            memset(row, 0, area.width());
+        }
+    }
+};
+
+void TileInfo::buildClearance()
+{
+    int sidelength = mWalkableTiles.sidelength();
+    bool alignedQuadtree = (sidelength & (sidelength - 1)) == 0;
+
+    // Only the area that contains walkable tiles is covered by the clearance map
+    QRect extent;
+
+    if (alignedQuadtree) {
+        WalkableExtentVisitor visitor;
+        mWalkableTiles.visitLeaves(visitor);
+        extent = visitor.extent;
+    } else {
+        for (int y = 0; y < sidelength; ++y)
+            for (int x = 0; x < sidelength; ++x)
+                if (mWalkableTiles.get(x, y))
+                    extent = extent.united(QRect(x, y, 1, 1));
+    }
+
+    mClearance.mExtent = extent;
+    mClearance.mValues.fill(0, extent.width() * extent.height());
+
+    // The counts refer to the previous extent, owners of occupants add them again once loaded
+    mOccupancy.clear();
+
+    if (extent.isEmpty())
+        return;
+
+    // Surround the walkable area with a blocked border
+    QRect window = extent.adjusted(-1, -1, 1, 1);
+    QVector<uchar> blocked(window.width() * window.height());
+    blocked.fill(1);
+
+    if (alignedQuadtree) {
+        WalkableRasterVisitor visitor;
+        visitor.window = window;
+        visitor.blocked = &blocked;
+        mWalkableTiles.visitLeaves(visitor);
+    } else {
+        for (int y = extent.top(); y <= extent.bottom(); ++y)
+            for (int x = extent.left(); x <= extent.right(); ++x)
+                blocked[(y - window.top()) * window.width() + (x - window.left())] = !mWalkableTiles.get(x, y);
+    }
+
+    computeClearance(window, blocked, extent);
+}
+
+void TileInfo::reserveClearance(int radius)
+{
+    uint limit = qMin(radius + 1, (int)ClearanceMap::MaxClearance);
+
+    if (limit <= mClearance.mLimit)
+        return;
+
+    mClearance.mLimit = limit;
+    updateClearance(mClearance.mExtent);
+}
+
+void TileInfo::updateClearance(const QRect &region)
+{
+    const QRect &extent = mClearance.mExtent;
+    int limit = mClearance.mLimit;
+
+    // Every tile whose distance to a changed tile is below the clearance limit may change
+    QRect target = region.adjusted(-limit, -limit, limit, limit).intersected(extent);
+
+    if (target.isEmpty())
+        return;
+
+    // And those tiles may be affected by blocked tiles up to the limit away
+    QRect window = target.adjusted(-limit, -limit, limit, limit);
+
+    QVector<uchar> blocked(window.width() * window.height());
+    uchar *out = blocked.data();
+
+    for (int y = window.top(); y <= window.bottom(); ++y)
+        for (int x = window.left(); x <= window.right(); ++x)
+            *(out++) = isTileBlocked(x, y);
+
+    computeClearance(window, blocked, target);
+}
+
+QRect TileInfo::applyOccupancy(const QPoint &center, int radius, int delta)
+{
+    const QRect &extent = mClearance.mExtent;
+
+    QRect area = QRect(center.x() - radius, center.y() - radius, 2 * radius + 1, 2 * radius + 1).intersected(extent);
+
+    if (area.isEmpty())
+        return area;
+
+    if (mOccupancy.isEmpty())
+        mOccupancy.fill(0, extent.width() * extent.height());
+
+    int sqradius = radius * radius;
+
+    for (int y = area.top(); y <= area.bottom(); ++y) {
+        int dy = y - center.y();
+        uchar *row = mOccupancy.data() + (y - extent.top()) * extent.width();
+
+        for (int x = area.left(); x <= area.right(); ++x) {
+            int dx = x - center.x();
+            if (dx * dx + dy * dy > sqradius)
+                continue;
+
+            uchar &count = row[x - extent.left()];
+            Q_ASSERT(delta > 0 || count > 0);
+            count += delta;
+        }
+    }
+
+    return area;
+}
+
+void TileInfo::occupancyUpdated(const QRect &area)
+{
+    updateClearance(area);
+
+    emit occupancyChanged(area);
+}
+
+void TileInfo::changeOccupancy(const QPoint &center, int radius, int delta)
+{
+    QRect area = applyOccupancy(center, radius, delta);
+
+    if (!area.isEmpty())
+        occupancyUpdated(area);
+}
+
+void TileInfo::moveOccupancy(const QPoint &from, const QPoint &to, int radius)
+{
+    if (from == to)
+        return;
+
+    QRect removed = applyOccupancy(from, radius, -1);
+    QRect added = applyOccupancy(to, radius, 1);
+
+    // Nearby areas share a single clearance update, distant areas are updated separately
+    int limit = mClearance.mLimit;
+    QRect nearby = removed.adjusted(-limit, -limit, limit, limit);
+
+    if (removed.isEmpty() || added.isEmpty() || nearby.intersects(added)) {
+        QRect area = removed.united(added);
+        if (!area.isEmpty())
+            occupancyUpdated(area);
+    } else {
+        occupancyUpdated(removed);
+        occupancyUpdated(added);
+    }
+}
+
+OccupantExclusion TileInfo::excludeOccupant(const QPoint &center, int occupantRadius, int radius) const
+{
+    OccupantExclusion result;
+
+    // Only tiles within the actor's radius of the occupant can be affected by it
+    int reach = occupantRadius + radius;
+    result.area = QRect(center.x() - reach, center.y() - reach, 2 * reach + 1, 2 * reach + 1)
+                  .intersected(mClearance.mExtent);
+    result.standable.resize(result.area.width() * result.area.height());
+
+    int sqOccupantRadius = occupantRadius * occupantRadius;
+    int sqradius = radius * radius;
+    uchar *out = result.standable.data();
+
+    for (int y = result.area.top(); y <= result.area.bottom(); ++y) {
+        for (int x = result.area.left(); x <= result.area.right(); ++x) {
+            bool standable = true;
+
+            for (int cy = - radius; cy <= radius && standable; ++cy) {
+                for (int cx = - radius; cx <= radius; ++cx) {
+                    if (cx * cx + cy * cy > sqradius)
+                        continue;
+
+                    int tx = x + cx;
+                    int ty = y + cy;
+
+                    if (!mClearance.mExtent.contains(tx, ty) || !isTileWalkable(tx, ty)) {
+                        standable = false;
+                        break;
+                    }
+
+                    uint occupants = occupancyCount(tx, ty);
+                    int dx = tx - center.x();
+                    int dy = ty - center.y();
+                    if (occupants > 0 && dx * dx + dy * dy <= sqOccupantRadius)
+                        occupants--;
+
+                    if (occupants > 0) {
+                        standable = false;
+                        break;
+                    }
+                }
+            }
+
+            *(out++) = standable;
+        }
+    }
+
+    return result;
+}
+
+void TileInfo::addOccupancy(const QPoint &center, int radius)
+{
+    changeOccupancy(center, radius, 1);
+}
+
+void TileInfo::removeOccupancy(const QPoint &center, int radius)
+{
+    changeOccupancy(center, radius, -1);
+}
+
 }
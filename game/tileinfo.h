@@ -4,21 +4,93 @@
 #include <QObject>
 #include <QMetaType>
 #include <QPoint>
+#include <QRect>
+#include <QVector>
 
 #include <common/quadtree.h>
+#include <common/tileraster.h>
 #include <gamemath.h>
 using namespace GameMath;
 
 namespace EvilTemple {
 
+/**
+  Stores for every tile of a map how large an actor standing on it may be.
+
+  The value for a tile is one more than the largest radius (in tiles) of an actor that can stand on
+  it, so a value of zero means that the tile itself is blocked. Values are clamped to limit(), which
+  means checks for radii of limit() or larger can't be answered by the map. The limit is raised on
+  demand to one more than the largest radius that is checked, but never beyond MaxClearance.
+
+  Copies are cheap, since the values are shared until the tile info changes them, and they
+  don't see later changes. A copy can therefore be searched by another thread.
+  */
+class ClearanceMap
+{
+friend class TileInfo;
+public:
+    enum {
+        MaxClearance = 32
+    };
+
+    ClearanceMap();
+
+    /**
+      The area of the map covered by this clearance map. Tiles outside of it are not walkable.
+      */
+    const QRect &extent() const;
+
+    uint clearance(int x, int y) const;
+
+    /**
+      The value all clearance values are clamped to.
+      */
+    uint limit() const;
+
+    /**
+      Checks whether an actor can stand on a tile. Only valid for radii below limit().
+      */
+    bool canStand(int x, int y, int radius) const;
+
+private:
+    QRect mExtent;
+    QVector<uchar> mValues;
+    uint mLimit;
+};
+
+/**
+  The tiles around an occupant that an actor can stand on if the occupant is ignored.
+
+  Actors that are obstacles themselves use this to find paths away from the tiles they occupy,
+  without actually removing their occupancy from the map.
+  */
+struct OccupantExclusion {
+    QRect area;
+    QVector<uchar> standable;
+
+    bool contains(int x, int y) const;
+    bool canStand(int x, int y) const;
+};
+
+/**
+  Stores the static per-tile information of a map.
+
+  The layers are loaded as quadtrees. Unless dense mode is disabled, the layers that are queried
+  all the time (walkability, height and vision) are additionally decoded into dense rasters, which
+  answer a query with two memory accesses instead of a walk through the tree.
+  */
 class TileInfo : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(bool dense READ isDense WRITE setDense)
 public:
     Q_INVOKABLE explicit TileInfo(QObject *parent = 0);
 
     static const float UnitsPerTile;
 
+    bool isDense() const;
+    void setDense(bool dense);
+
 public slots:
 
     bool load(const QString &filename);
@@ -27,14 +99,86 @@ public slots:
     bool isTileFlyable(int x, int y) const;
     const QString &tileMaterial(int x, int y) const;
     int tileHeight(int x, int y) const;
+    bool isVisionExtend(int x, int y) const;
     bool isVisionEnd(int x, int y) const;
+    bool isVisionBase(int x, int y) const;
+    bool isVisionArchway(int x, int y) const;
 
     bool isWalkable(const Vector4 &position) const;
     bool isFlyable(const Vector4 &position) const;
     const QString &material(const Vector4 &position) const;
     int height(const Vector4 &position) const;
 
+public:
+    /**
+      Checks whether an actor with the given radius (in tiles) can stand on a tile. This takes
+      walkability and dynamic occupancy into account and is a single lookup for the radii covered
+      by the clearance map.
+      */
+    bool canStandOnTile(int x, int y, int radius) const;
+
+    const ClearanceMap &clearanceMap() const;
+
+    /**
+      Makes the clearance map answer checks for actors up to the given radius (in tiles). Raising
+      the limit recomputes the whole map, but doesn't change the answer for any smaller radius.
+      */
+    void reserveClearance(int radius);
+
+    /**
+      Marks all tiles within a radius (in tiles) around a tile as occupied. Occupation is counted,
+      so overlapping occupants need to be removed individually. Only the clearance of the tiles
+      around the occupied area is updated: the clearance may change up to the clearance limit
+      away, and computing it there needs tiles up to the limit further out. A single tile
+      recomputes a window of about 4 * limit + 1 tiles along each axis.
+      */
+    void addOccupancy(const QPoint &center, int radius);
+
+    /**
+      Removes occupancy previously added using addOccupancy.
+      */
+    void removeOccupancy(const QPoint &center, int radius);
+
+    /**
+      Moves occupancy previously added using addOccupancy to a new center. The clearance is only
+      updated once for both areas, and nothing happens if the center stays the same.
+      */
+    void moveOccupancy(const QPoint &from, const QPoint &to, int radius);
+
+    bool isTileOccupied(int x, int y) const;
+
+    /**
+      Determines which tiles an actor with the given radius could stand on around an occupant if
+      the occupant wasn't there.
+      */
+    OccupantExclusion excludeOccupant(const QPoint &center, int occupantRadius, int radius) const;
+
+signals:
+    /**
+      Emitted when tiles in the given area became occupied or free.
+      */
+    void occupancyChanged(const QRect &area);
+
+    /**
+      Emitted after a map has been loaded. Loading drops all occupancy, so whoever added occupants
+      has to add them again.
+      */
+    void loaded();
+
 private:
+    void changeOccupancy(const QPoint &center, int radius, int delta);
+    QRect applyOccupancy(const QPoint &center, int radius, int delta);
+    void occupancyUpdated(const QRect &area);
+    uint occupancyCount(int x, int y) const;
+    void buildClearance();
+    void updateClearance(const QRect &region);
+    void computeClearance(const QRect &window, const QVector<uchar> &blocked, const QRect &target);
+    bool isTileBlocked(int x, int y) const;
+    void decodeRasters();
+
+    ClearanceMap mClearance;
+    QVector<uchar> mOccupancy; // Counts occupants per tile within the clearance map's extent
+
     BoolQuadtree mWalkableTiles;
     BoolQuadtree mFlyableTiles;
     StringQuadtree mTileMaterial;
@@ -45,9 +189,101 @@ private:
     BoolQuadtree mVisionBase;
     BoolQuadtree mVisionArchway;
 
+    bool mDense;
+    BitRaster mWalkableRaster;
+    BitRaster mFlyableRaster;
+    CharRaster mHeightRaster;
+    BitRaster mVisionExtendRaster;
+    BitRaster mVisionEndRaster;
+    BitRaster mVisionBaseRaster;
+    BitRaster mVisionArchwayRaster;
+
     static QPoint convertPosition(const Vector4 &position);
 };
 
+inline ClearanceMap::ClearanceMap() : mLimit(1)
+{
+}
+
+inline const QRect &ClearanceMap::extent() const
+{
+    return mExtent;
+}
+
+inline uint ClearanceMap::clearance(int x, int y) const
+{
+    if (!mExtent.contains(x, y))
+        return 0;
+
+    return mValues[(y - mExtent.top()) * mExtent.width() + (x - mExtent.left())];
+}
+
+inline uint ClearanceMap::limit() const
+{
+    return mLimit;
+}
+
+inline bool ClearanceMap::canStand(int x, int y, int radius) const
+{
+    Q_ASSERT((uint)radius < mLimit);
+    return clearance(x, y) > (uint)radius;
+}
+
+inline bool OccupantExclusion::contains(int x, int y) const
+{
+    return area.contains(x, y);
+}
+
+inline bool OccupantExclusion::canStand(int x, int y) const
+{
+    return standable[(y - area.top()) * area.width() + (x - area.left())];
+}
+
+inline const ClearanceMap &TileInfo::clearanceMap() const
+{
+    return mClearance;
+}
+
+inline uint TileInfo::occupancyCount(int x, int y) const
+{
+    const QRect &extent = mClearance.mExtent;
+
+    if (mOccupancy.isEmpty() || !extent.contains(x, y))
+        return 0;
+
+    return mOccupancy[(y - extent.top()) * extent.width() + (x - extent.left())];
+}
+
+inline bool TileInfo::isTileOccupied(int x, int y) const
+{
+    return occupancyCount(x, y) != 0;
+}
+
+inline bool TileInfo::isTileBlocked(int x, int y) const
+{
+    return !mClearance.mExtent.contains(x, y) || !isTileWalkable(x, y) || isTileOccupied(x, y);
+}
+
+inline bool TileInfo::canStandOnTile(int x, int y, int radius) const
+{
+    if ((uint)radius < mClearance.mLimit)
+        return mClearance.canStand(x, y, radius);
+
+    // Large actors are checked against every tile they cover
+    int sqradius = radius * radius;
+
+    for (int cx = - radius; cx <= radius; ++cx) {
+        int cxs = cx * cx;
+
+        for (int cy = - radius; cy <= radius; ++cy) {
+            if (cxs + cy * cy <= sqradius && isTileBlocked(x + cx, y + cy))
+                return false;
+        }
+    }
+
+    return true;
+}
+
 inline QPoint TileInfo::convertPosition(const Vector4 &position)
 {
     return QPoint(position.x() / UnitsPerTile, position.z() / UnitsPerTile);
@@ -77,14 +313,19 @@ inline int TileInfo::height(const Vector4 &position) const
     return tileHeight(tilePos.x(), tilePos.y());
 }
 
+inline bool TileInfo::isDense() const
+{
+    return mDense;
+}
+
 inline bool TileInfo::isTileWalkable(int x, int y) const
 {
-    return mWalkableTiles.get(x, y);
+    return mDense ? mWalkableRaster.get(x, y) : mWalkableTiles.get(x, y);
 }
 
 inline bool TileInfo::isTileFlyable(int x, int y) const
 {
-    return mFlyableTiles.get(x, y);
+    return mDense ? mFlyableRaster.get(x, y) : mFlyableTiles.get(x, y);
 }
 
 inline const QString &TileInfo::tileMaterial(int x, int y) const
@@ -94,12 +335,27 @@ inline const QString &TileInfo::tileMaterial(int x, int y) const
 
 inline int TileInfo::tileHeight(int x, int y) const
 {
-    return mTileHeight.get(x, y);
+    return mDense ? mHeightRaster.get(x, y) : mTileHeight.get(x, y);
+}
+
+inline bool TileInfo::isVisionExtend(int x, int y) const
+{
+    return mDense ? mVisionExtendRaster.get(x, y) : mVisionExtend.get(x, y);
 }
 
 inline bool TileInfo::isVisionEnd(int x, int y) const
 {
-    return mVisionEnd.get(x, y);
+    return mDense ? mVisionEndRaster.get(x, y) : mVisionEnd.get(x, y);
+}
+
+inline bool TileInfo::isVisionBase(int x, int y) const
+{
+    return mDense ? mVisionBaseRaster.get(x, y) : mVisionBase.get(x, y);
+}
+
+inline bool TileInfo::isVisionArchway(int x, int y) const
+{
+    return mDense ? mVisionArchwayRaster.get(x, y) : mVisionArchway.get(x, y);
 }
 
 }
@@ -0,0 +1,82 @@
+
+#include <string.h>
+
+#include "tilesearch.h"
+
+namespace EvilTemple {
+
+TileSearch::TileSearch() : mNodeCount(0), mPages(PagesPerAxis * PagesPerAxis), mExpandedNodes(0)
+{
+    mPages.fill(NULL);
+}
+
+TileSearch::~TileSearch()
+{
+    qDeleteAll(mPages);
+}
+
+void TileSearch::reset()
+{
+    // Neither the arena nor the pages are cleared, entries are validated against the node count
+    mNodeCount = 0;
+    mOpenSet.clear();
+    mExpandedNodes = 0;
+}
+
+uint TileSearch::createNode(int x, int y, uint parent, uint costFromStart, NodeState state)
+{
+    if (mNodeCount == (uint)mNodes.size())
+        mNodes.resize(qMax<int>(1024, mNodes.size() * 2));
+
+    uint index = mNodeCount++;
+
+    Node &node = mNodes[index];
+    node.x = x;
+    node.y = y;
+    node.state = state;
+    node.parent = parent;
+    node.costFromStart = costFromStart;
+
+    Page *&page = mPages[(y >> PageShift) * PagesPerAxis + (x >> PageShift)];
+
+    if (!page) {
+        page = new Page;
+        memset(page->nodes, 0xFF, sizeof(page->nodes));
+    }
+
+    page->nodes[((y & PageMask) << PageShift) | (x & PageMask)] = index;
+
+    return index;
+}
+
+QVector<QPoint> TileSearch::tracePath(uint node) const
+{
+    if (node == NoNode)
+        return QVector<QPoint>();
+
+    // Nodes are connected by straight or diagonal lines, which are a single step long unless they were jumped
+    int length = 1;
+    for (uint current = node; mNodes[current].parent != NoNode; current = mNodes[current].parent) {
+        QPoint d = tile(mNodes[current].parent) - tile(current);
+        length += qMax(qAbs(d.x()), qAbs(d.y()));
+    }
+
+    QVector<QPoint> result(length);
+
+    uint current = node;
+    for (; mNodes[current].parent != NoNode; current = mNodes[current].parent) {
+        QPoint from = tile(mNodes[current].parent);
+        QPoint to = tile(current);
+        QPoint d = to - from;
+        QPoint step((d.x() > 0) - (d.x() < 0), (d.y() > 0) - (d.y() < 0));
+
+        for (QPoint t = to; t != from; t -= step)
+            result[--length] = t;
+    }
+
+    result[--length] = tile(current);
+
+    return result;
+}
+
+}
@@ -0,0 +1,581 @@
+#ifndef TILESEARCH_H
+#define TILESEARCH_H
+
+#include <QtCore/QPoint>
+#include <QtCore/QVector>
+
+#include "binaryheap.h"
+
+namespace EvilTemple {
+
+/**
+  The goal of a search that has to reach one specific tile.
+  */
+struct TileGoal {
+    TileGoal(const QPoint &tile);
+
+    bool isGoal(const QPoint &tile) const;
+    uint heuristic(const QPoint &tile) const;
+
+    QPoint goal;
+};
+
+/**
+  The goal of a search that has to reach any tile within a circular range around a target tile.
+  */
+struct TileRangeGoal {
+    TileRangeGoal(const QPoint &target, int range);
+
+    bool isGoal(const QPoint &tile) const;
+    uint heuristic(const QPoint &tile) const;
+
+    QPoint target;
+    int rangeSquared;
+    uint rangeCost;
+};
+
+/**
+  Checks whether an actor can move along the straight line between the centers of two tiles, by
+  checking every tile the line passes through. Where the line passes exactly through the corner of
+  two tiles, it moves diagonally without checking the tiles beside the corner, just like searches do.
+  */
+template<typename Passable>
+bool isLineWalkable(const QPoint &from, const QPoint &to, const Passable &passable);
+
+/**
+  Removes all tiles from a path that an actor can skip by walking in a straight line to a later
+  tile of the path (string pulling). The first and last tile are always kept. Lines are checked
+  using isLineWalkable.
+  */
+template<typename Passable>
+QVector<QPoint> smoothPath(const QVector<QPoint> &tiles, const Passable &passable);
+
+/**
+  Reusable A* search engine for the tile grid.
+
+  The open set is an indexed binary heap with decrease-key, so expanding a node costs O(log n)
+  instead of re-sorting the entire open set. Node state lives in an arena that is only reset
+  (not freed) between searches, and tiles are mapped to their node through a lazily allocated,
+  paged lookup table. Looking up the state of a tile therefore never hashes and never allocates
+  once the search context has warmed up.
+
+  A search context is not thread-safe, but it is cheap to keep one around per thread.
+  */
+class TileSearch
+{
+public:
+    enum {
+        StraightCost = 10,
+        DiagonalCost = 14,
+        MaxTiles = 4096 // Tile coordinates must be within [0, MaxTiles)
+    };
+
+    static const uint NoNode = 0xFFFFFFFF;
+
+    TileSearch();
+    ~TileSearch();
+
+    /**
+      Runs an A* search starting at the given tile.
+
+      @param start The tile to start on. The caller is responsible for checking that it's passable.
+      @param passable Functor called with (x, y) for every tile the search tries to enter. It is called
+                      at most once per tile and search.
+      @param goal Decides whether a tile is a goal and provides the heuristic (see TileGoal).
+      @return The node that reached the goal or NoNode if the goal is unreachable.
+      */
+    template<typename Passable, typename Goal>
+    uint findPath(const QPoint &start, const Passable &passable, const Goal &goal);
+
+    /**
+      Runs a Jump Point Search starting at the given tile. Instead of adding every neighbour of a
+      tile to the open set, the search jumps along straight and diagonal lines until it hits a tile
+      where a shortest path may have to turn, so only those tiles become nodes. The path has the same
+      cost as the path found by findPath, but far fewer nodes are expanded on open terrain.
+
+      This only works because every step costs the same (see StraightCost and DiagonalCost). The
+      parameters are the same as for findPath, except that passable may be called several times
+      for the same tile.
+      */
+    template<typename Passable, typename Goal>
+    uint findJumpPath(const QPoint &start, const Passable &passable, const Goal &goal);
+
+    /**
+      Returns the tiles along the path from the start tile to the given node (both inclusive).
+      The tiles between the jump points of a Jump Point Search are filled in.
+      */
+    QVector<QPoint> tracePath(uint node) const;
+
+    /**
+      Returns the node of a tile that was expanded by the last search or NoNode. The cost of an
+      expanded node is final.
+      */
+    uint expandedNode(const QPoint &tile) const;
+
+    QPoint tile(uint node) const;
+    uint parent(uint node) const;
+    uint costFromStart(uint node) const;
+
+    /**
+      The number of nodes that were expanded by the last search.
+      */
+    uint expandedNodes() const;
+
+    static uint octileDistance(const QPoint &from, const QPoint &to);
+
+    /**
+      The priority of a node in the open set, which is ordered by total cost first.
+      */
+    static quint64 priority(uint totalCost, uint costFromStart);
+
+    static bool isInside(int x, int y);
+
+private:
+    enum NodeState {
+        Open,
+        Closed,
+        Blocked
+    };
+
+    struct Node {
+        qint16 x;
+        qint16 y;
+        quint8 state;
+        uint parent;
+        uint costFromStart;
+    };
+
+    enum {
+        PageShift = 6,
+        PageSidelength = 1 << PageShift,
+        PageMask = PageSidelength - 1,
+        PageArea = PageSidelength * PageSidelength,
+        PagesPerAxis = MaxTiles / PageSidelength
+    };
+
+    /*
+     A page maps the tiles of a 64x64 block to nodes. Entries are never cleared, an entry is
+     only valid if it points to a node of the current search that belongs to the same tile.
+     */
+    struct Page {
+        uint nodes[PageArea];
+    };
+
+    void reset();
+    uint nodeAt(int x, int y) const;
+
+    template<typename Passable>
+    static bool isOpen(const Passable &passable, int x, int y);
+
+    template<typename Passable>
+    static bool hasForcedNeighbour(const Passable &passable, int x, int y, int dx, int dy);
+
+    template<typename Passable, typename Goal>
+    static bool jump(const Passable &passable, const Goal &goal, int dx, int dy, QPoint &tile);
+    uint createNode(int x, int y, uint parent, uint costFromStart, NodeState state);
+
+    QVector<Node> mNodes;
+    uint mNodeCount;
+    QVector<Page*> mPages;
+    IndexedBinaryHeap<quint64> mOpenSet;
+    uint mExpandedNodes;
+
+    Q_DISABLE_COPY(TileSearch)
+};
+
+inline TileGoal::TileGoal(const QPoint &tile) : goal(tile)
+{
+}
+
+inline bool TileGoal::isGoal(const QPoint &tile) const
+{
+    return tile == goal;
+}
+
+inline uint TileGoal::heuristic(const QPoint &tile) const
+{
+    return TileSearch::octileDistance(tile, goal);
+}
+
+inline TileRangeGoal::TileRangeGoal(const QPoint &_target, int range)
+    : target(_target), rangeSquared(range * range), rangeCost(range * TileSearch::StraightCost)
+{
+}
+
+inline bool TileRangeGoal::isGoal(const QPoint &tile) const
+{
+    QPoint d = target - tile;
+    return d.x() * d.x() + d.y() * d.y() <= rangeSquared;
+}
+
+inline uint TileRangeGoal::heuristic(const QPoint &tile) const
+{
+    uint distance = TileSearch::octileDistance(tile, target);
+    return (distance > rangeCost) ? distance - rangeCost : 0;
+}
+
+inline uint TileSearch::octileDistance(const QPoint &from, const QPoint &to)
+{
+    int dx = qAbs(to.x() - from.x());
+    int dy = qAbs(to.y() - from.y());
+    return StraightCost * (dx + dy) + (DiagonalCost - 2 * StraightCost) * qMin(dx, dy);
+}
+
+inline bool TileSearch::isInside(int x, int y)
+{
+    return (uint)x < (uint)MaxTiles && (uint)y < (uint)MaxTiles;
+}
+
+inline quint64 TileSearch::priority(uint totalCost, uint costFromStart)
+{
+    // Ties are broken in favor of the node that is further along, which avoids expanding
+    // all the symmetric alternatives on open terrain.
+    return ((quint64)totalCost << 32) | (0xFFFFFFFF - costFromStart);
+}
+
+inline uint TileSearch::nodeAt(int x, int y) const
+{
+    const Page *page = mPages[(y >> PageShift) * PagesPerAxis + (x >> PageShift)];
+
+    if (!page)
+        return NoNode;
+
+    uint node = page->nodes[((y & PageMask) << PageShift) | (x & PageMask)];
+
+    if (node >= mNodeCount || mNodes[node].x != x || mNodes[node].y != y)
+        return NoNode;
+
+    return node;
+}
+
+inline uint TileSearch::expandedNode(const QPoint &tile) const
+{
+    if (!isInside(tile.x(), tile.y()))
+        return NoNode;
+
+    uint node = nodeAt(tile.x(), tile.y());
+
+    if (node == NoNode || mNodes[node].state != Closed)
+        return NoNode;
+
+    return node;
+}
+
+inline QPoint TileSearch::tile(uint node) const
+{
+    return QPoint(mNodes[node].x, mNodes[node].y);
+}
+
+inline uint TileSearch::parent(uint node) const
+{
+    return mNodes[node].parent;
+}
+
+inline uint TileSearch::costFromStart(uint node) const
+{
+    return mNodes[node].costFromStart;
+}
+
+inline uint TileSearch::expandedNodes() const
+{
+    return mExpandedNodes;
+}
+
+template<typename Passable, typename Goal>
+uint TileSearch::findPath(const QPoint &start, const Passable &passable, const Goal &goal)
+{
+    static const int offsetX[8] = { -1, 1, 1, -1, 0, 0, 1, -1 };
+    static const int offsetY[8] = { -1, -1, 1, 1, -1, 1, 0, 0 };
+
+    reset();
+
+    if (!isInside(start.x(), start.y()))
+        return NoNode;
+
+    uint startNode = createNode(start.x(), start.y(), NoNode, 0, Open);
+    mOpenSet.push(startNode, priority(goal.heuristic(start), 0));
+
+    while (!mOpenSet.isEmpty()) {
+        uint current = mOpenSet.pop();
+
+        // Don't keep a reference to the node, creating neighbours may grow the arena
+        mNodes[current].state = Closed;
+        QPoint currentTile = tile(current);
+        uint currentCost = mNodes[current].costFromStart;
+
+        mExpandedNodes++;
+
+        if (goal.isGoal(currentTile))
+            return current;
+
+        for (int i = 0; i < 8; ++i) {
+            int x = currentTile.x() + offsetX[i];
+            int y = currentTile.y() + offsetY[i];
+
+            uint cost = currentCost + ((i < 4) ? DiagonalCost : StraightCost);
+
+            if (!isInside(x, y))
+                continue;
+
+            uint neighbour = nodeAt(x, y);
+
+            if (neighbour == NoNode) {
+                if (!passable(x, y)) {
+                    // Remember this, so the tile is only ever checked once
+                    createNode(x, y, NoNode, 0, Blocked);
+                    continue;
+                }
+
+                neighbour = createNode(x, y, current, cost, Open);
+            } else {
+                Node &node = mNodes[neighbour];
+
+                if (node.state != Open || node.costFromStart <= cost)
+                    continue; // Skip, we already have a better path to this node
+
+                node.parent = current;
+                node.costFromStart = cost;
+            }
+
+            mOpenSet.push(neighbour, priority(cost + goal.heuristic(QPoint(x, y)), cost));
+        }
+    }
+
+    return NoNode;
+}
+
+template<typename Passable>
+inline bool TileSearch::isOpen(const Passable &passable, int x, int y)
+{
+    return isInside(x, y) && passable(x, y);
+}
+
+/*
+  Checks whether a shortest path moving through a tile in the given direction may have to turn
+  there, because a blocked tile beside it forces a neighbour that is not reached otherwise.
+  Diagonal steps may pass the corners of blocked tiles, just like in findPath.
+ */
+template<typename Passable>
+bool TileSearch::hasForcedNeighbour(const Passable &passable, int x, int y, int dx, int dy)
+{
+    if (dx && dy)
+        return (!isOpen(passable, x - dx, y) && isOpen(passable, x - dx, y + dy))
+            || (!isOpen(passable, x, y - dy) && isOpen(passable, x + dx, y - dy));
+    else if (dx)
+        return (!isOpen(passable, x, y + 1) && isOpen(passable, x + dx, y + 1))
+            || (!isOpen(passable, x, y - 1) && isOpen(passable, x + dx, y - 1));
+    else
+        return (!isOpen(passable, x + 1, y) && isOpen(passable, x + 1, y + dy))
+            || (!isOpen(passable, x - 1, y) && isOpen(passable, x - 1, y + dy));
+}
+
+/*
+  Moves from a tile in the given direction until reaching the next jump point, which is stored in
+  tile. Returns false if the line runs into a blocked tile first.
+ */
+template<typename Passable, typename Goal>
+bool TileSearch::jump(const Passable &passable, const Goal &goal, int dx, int dy, QPoint &tile)
+{
+    int x = tile.x();
+    int y = tile.y();
+
+    forever {
+        x += dx;
+        y += dy;
+
+        if (!isOpen(passable, x, y))
+            return false;
+
+        if (goal.isGoal(QPoint(x, y)) || hasForcedNeighbour(passable, x, y, dx, dy))
+            break;
+
+        // Diagonal lines stop wherever one of the straight lines branching off them reaches a jump point
+        if (dx && dy) {
+            QPoint branch(x, y);
+            if (jump(passable, goal, dx, 0, branch))
+                break;
+            branch = QPoint(x, y);
+            if (jump(passable, goal, 0, dy, branch))
+                break;
+        }
+    }
+
+    tile = QPoint(x, y);
+    return true;
+}
+
+template<typename Passable, typename Goal>
+uint TileSearch::findJumpPath(const QPoint &start, const Passable &passable, const Goal &goal)
+{
+    static const int offsetX[8] = { -1, 1, 1, -1, 0, 0, 1, -1 };
+    static const int offsetY[8] = { -1, -1, 1, 1, -1, 1, 0, 0 };
+
+    reset();
+
+    if (!isInside(start.x(), start.y()))
+        return NoNode;
+
+    uint startNode = createNode(start.x(), start.y(), NoNode, 0, Open);
+    mOpenSet.push(startNode, priority(goal.heuristic(start), 0));
+
+    while (!mOpenSet.isEmpty()) {
+        uint current = mOpenSet.pop();
+
+        mNodes[current].state = Closed;
+        QPoint currentTile = tile(current);
+        uint currentCost = mNodes[current].costFromStart;
+        uint parentNode = mNodes[current].parent;
+
+        mExpandedNodes++;
+
+        if (goal.isGoal(currentTile))
+            return current;
+
+        int x = currentTile.x();
+        int y = currentTile.y();
+
+        // The directions worth following from this tile, given the direction it was reached from
+        int directionsX[8];
+        int directionsY[8];
+        int directions = 0;
+
+        if (parentNode == NoNode) {
+            for (int i = 0; i < 8; ++i) {
+                directionsX[directions] = offsetX[i];
+                directionsY[directions++] = offsetY[i];
+            }
+        } else {
+            QPoint d = currentTile - tile(parentNode);
+            int dx = (d.x() > 0) - (d.x() < 0);
+            int dy = (d.y() > 0) - (d.y() < 0);
+
+            directionsX[directions] = dx;
+            directionsY[directions++] = dy;
+
+            if (dx && dy) {
+                directionsX[directions] = dx;
+                directionsY[directions++] = 0;
+                directionsX[directions] = 0;
+                directionsY[directions++] = dy;
+
+                if (!isOpen(passable, x - dx, y)) {
+                    directionsX[directions] = -dx;
+                    directionsY[directions++] = dy;
+                }
+                if (!isOpen(passable, x, y - dy)) {
+                    directionsX[directions] = dx;
+                    directionsY[directions++] = -dy;
+                }
+            } else if (dx) {
+                if (!isOpen(passable, x, y + 1)) {
+                    directionsX[directions] = dx;
+                    directionsY[directions++] = 1;
+                }
+                if (!isOpen(passable, x, y - 1)) {
+                    directionsX[directions] = dx;
+                    directionsY[directions++] = -1;
+                }
+            } else {
+                if (!isOpen(passable, x + 1, y)) {
+                    directionsX[directions] = 1;
+                    directionsY[directions++] = dy;
+                }
+                if (!isOpen(passable, x - 1, y)) {
+                    directionsX[directions] = -1;
+                    directionsY[directions++] = dy;
+                }
+            }
+        }
+
+        for (int i = 0; i < directions; ++i) {
+            QPoint jumpPoint = currentTile;
+
+            if (!jump(passable, goal, directionsX[i], directionsY[i], jumpPoint))
+                continue;
+
+            uint cost = currentCost + octileDistance(currentTile, jumpPoint);
+            uint neighbour = nodeAt(jumpPoint.x(), jumpPoint.y());
+
+            if (neighbour == NoNode) {
+                neighbour = createNode(jumpPoint.x(), jumpPoint.y(), current, cost, Open);
+            } else {
+                Node &node = mNodes[neighbour];
+
+                if (node.state != Open || node.costFromStart <= cost)
+                    continue;
+
+                node.parent = current;
+                node.costFromStart = cost;
+            }
+
+            mOpenSet.push(neighbour, priority(cost + goal.heuristic(jumpPoint), cost));
+        }
+    }
+
+    return NoNode;
+}
+
+template<typename Passable>
+bool isLineWalkable(const QPoint &from, const QPoint &to, const Passable &passable)
+{
+    int stepsX = qAbs(to.x() - from.x());
+    int stepsY = qAbs(to.y() - from.y());
+    int signX = (to.x() > from.x()) ? 1 : -1;
+    int signY = (to.y() > from.y()) ? 1 : -1;
+
+    int x = from.x();
+    int y = from.y();
+
+    if (!passable(x, y))
+        return false;
+
+    for (int ix = 0, iy = 0; ix < stepsX || iy < stepsY;) {
+        // Compares where the line leaves the current tile: through a vertical or horizontal edge
+        int decision = (1 + 2 * ix) * stepsY - (1 + 2 * iy) * stepsX;
+
+        if (decision == 0) {
+            x += signX;
+            y += signY;
+            ix++;
+            iy++;
+        } else if (decision < 0) {
+            x += signX;
+            ix++;
+        } else {
+            y += signY;
+            iy++;
+        }
+
+        if (!passable(x, y))
+            return false;
+    }
+
+    return true;
+}
+
+template<typename Passable>
+QVector<QPoint> smoothPath(const QVector<QPoint> &tiles, const Passable &passable)
+{
+    if (tiles.size() <= 2)
+        return tiles;
+
+    QVector<QPoint> result;
+    result.append(tiles.first());
+
+    // Extend the line from the last waypoint until it's blocked, and place a waypoint before that
+    int anchor = 0;
+
+    for (int i = 2; i < tiles.size(); ++i) {
+        if (!isLineWalkable(tiles[anchor], tiles[i], passable)) {
+            anchor = i - 1;
+            result.append(tiles[anchor]);
+        }
+    }
+
+    result.append(tiles.last());
+    return result;
+}
+
+}
+
+#endif // TILESEARCH_H
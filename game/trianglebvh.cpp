@@ -0,0 +1,286 @@
+
+#include <algorithm>
+#include <limits>
+
+#include "trianglebvh.h"
+#include "modelfile.h"
+
+namespace EvilTemple {
+
+/**
+  Orders triangles by the center of their bounds along one axis.
+  */
+struct TriangleCenterLess {
+    TriangleCenterLess(const float *_centers, int _axis) : centers(_centers), axis(_axis)
+    {
+    }
+
+    bool operator()(int a, int b) const
+    {
+        return centers[3 * a + axis] < centers[3 * b + axis];
+    }
+
+    const float *centers;
+    int axis;
+};
+
+void TriangleBvh::build(const Vector4 *positions, const FaceGroup *groups, int groupCount)
+{
+    mNodes.clear();
+    mIndices.clear();
+
+    QVector<ushort> indices;
+    for (int i = 0; i < groupCount; ++i)
+        indices += groups[i].indices;
+
+    int count = indices.size() / 3;
+
+    if (!count)
+        return;
+
+    QVector<float> centers(3 * count);
+    QVector<int> order(count);
+
+    for (int i = 0; i < count; ++i) {
+        const Vector4 &a = positions[indices[3 * i]];
+        const Vector4 &b = positions[indices[3 * i + 1]];
+        const Vector4 &c = positions[indices[3 * i + 2]];
+
+        for (int axis = 0; axis < 3; ++axis) {
+            float low = qMin(a.data()[axis], qMin(b.data()[axis], c.data()[axis]));
+            float high = qMax(a.data()[axis], qMax(b.data()[axis], c.data()[axis]));
+            centers[3 * i + axis] = (low + high) * 0.5f;
+        }
+
+        order[i] = i;
+    }
+
+    Node root;
+    root.first = 0;
+    root.count = count;
+    mNodes.append(root);
+
+    split(0, order.data(), centers.data());
+
+    // Store the triangles in the order of the leaves, so every leaf references a single range
+    mIndices.resize(3 * count);
+    for (int i = 0; i < count; ++i) {
+        mIndices[3 * i] = indices[3 * order[i]];
+        mIndices[3 * i + 1] = indices[3 * order[i] + 1];
+        mIndices[3 * i + 2] = indices[3 * order[i] + 2];
+    }
+
+    refit(positions);
+}
+
+void TriangleBvh::split(int node, int *triangles, const float *centers)
+{
+    int first = mNodes[node].first;
+    int count = mNodes[node].count;
+
+    if (count <= MaxLeafTriangles)
+        return;
+
+    // Split along the axis the centers are spread the most along
+    float low[3], high[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        low[axis] = std::numeric_limits<float>::infinity();
+        high[axis] = -std::numeric_limits<float>::infinity();
+    }
+
+    for (int i = first; i < first + count; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            low[axis] = qMin(low[axis], centers[3 * triangles[i] + axis]);
+            high[axis] = qMax(high[axis], centers[3 * triangles[i] + axis]);
+        }
+    }
+
+    int axis = 0;
+    for (int i = 1; i < 3; ++i) {
+        if (high[i] - low[i] > high[axis] - low[axis])
+            axis = i;
+    }
+
+    int half = count / 2;
+    std::nth_element(triangles + first, triangles + first + half, triangles + first + count,
+                     TriangleCenterLess(centers, axis));
+
+    int children = mNodes.size();
+
+    Node left;
+    left.first = first;
+    left.count = half;
+    mNodes.append(left);
+
+    Node right;
+    right.first = first + half;
+    right.count = count - half;
+    mNodes.append(right);
+
+    mNodes[node].first = children;
+    mNodes[node].count = 0;
+
+    split(children, triangles, centers);
+    split(children + 1, triangles, centers);
+}
+
+void TriangleBvh::updateBounds(Node &node, const Vector4 *positions) const
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        node.minimum[axis] = std::numeric_limits<float>::infinity();
+        node.maximum[axis] = -std::numeric_limits<float>::infinity();
+    }
+
+    for (int i = 3 * node.first; i < 3 * (node.first + node.count); ++i) {
+        const float *position = positions[mIndices[i]].data();
+
+        for (int axis = 0; axis < 3; ++axis) {
+            node.minimum[axis] = qMin(node.minimum[axis], position[axis]);
+            node.maximum[axis] = qMax(node.maximum[axis], position[axis]);
+        }
+    }
+}
+
+void TriangleBvh::refit(const Vector4 *positions)
+{
+    // Children are stored behind their parents, so they are updated first
+    for (int i = mNodes.size() - 1; i >= 0; --i) {
+        Node &node = mNodes[i];
+
+        if (node.count) {
+            updateBounds(node, positions);
+            continue;
+        }
+
+        const Node &left = mNodes[node.first];
+        const Node &right = mNodes[node.first + 1];
+
+        for (int axis = 0; axis < 3; ++axis) {
+            node.minimum[axis] = qMin(left.minimum[axis], right.minimum[axis]);
+            node.maximum[axis] = qMax(left.maximum[axis], right.maximum[axis]);
+        }
+    }
+}
+
+/**
+  Computes where a ray enters the bounds of a node, as a multiple of its direction.
+  */
+inline static bool intersectBounds(const float *origin, const float *direction, const float *minimum,
+                                   const float *maximum, float &entry)
+{
+    float nearest = 0;
+    float farthest = std::numeric_limits<float>::infinity();
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (qFuzzyIsNull(direction[axis])) {
+            if (origin[axis] < minimum[axis] || origin[axis] > maximum[axis])
+                return false;
+            continue;
+        }
+
+        float low = (minimum[axis] - origin[axis]) / direction[axis];
+        float high = (maximum[axis] - origin[axis]) / direction[axis];
+
+        if (low > high)
+            qSwap(low, high);
+
+        nearest = qMax(nearest, low);
+        farthest = qMin(farthest, high);
+
+        if (nearest > farthest)
+            return false;
+    }
+
+    entry = nearest;
+    return true;
+}
+
+bool TriangleBvh::intersect(const Ray3d &ray, const Vector4 *positions, float &distance) const
+{
+    if (mNodes.isEmpty())
+        return false;
+
+    Vector4 rayOrigin = ray.origin();
+    Vector4 rayDirection = ray.direction();
+    const float *origin = rayOrigin.data();
+    const float *direction = rayDirection.data();
+
+    // Triangles report their distance in units, nodes in multiples of the direction
+    float directionLength = rayDirection.length();
+
+    struct Pending {
+        int node;
+        float entry;
+    };
+
+    // The tree is balanced, and every level adds at most one node to the stack
+    Pending stack[64];
+    int stackSize = 0;
+
+    float entry;
+    const Node &root = mNodes.at(0);
+    if (!intersectBounds(origin, direction, root.minimum, root.maximum, entry))
+        return false;
+
+    stack[0].node = 0;
+    stack[0].entry = entry;
+    stackSize = 1;
+
+    bool hit = false;
+    float nearest = std::numeric_limits<float>::infinity();
+
+    while (stackSize > 0) {
+        Pending pending = stack[--stackSize];
+
+        if (pending.entry * directionLength >= nearest)
+            continue;
+
+        const Node &node = mNodes.at(pending.node);
+
+        if (node.count) {
+            for (int i = 3 * node.first; i < 3 * (node.first + node.count); i += 3) {
+                float triangleDistance;
+                if (intersectRay(ray, positions[mIndices[i]], positions[mIndices[i + 1]],
+                                 positions[mIndices[i + 2]], triangleDistance)
+                    && triangleDistance < nearest) {
+                    nearest = triangleDistance;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        int leftNode = node.first;
+        int rightNode = node.first + 1;
+        const Node &left = mNodes.at(leftNode);
+        const Node &right = mNodes.at(rightNode);
+
+        float leftEntry, rightEntry;
+        bool hitsLeft = intersectBounds(origin, direction, left.minimum, left.maximum, leftEntry);
+        bool hitsRight = intersectBounds(origin, direction, right.minimum, right.maximum, rightEntry);
+
+        // Push the farther child first, so the nearer one is visited first
+        if (hitsLeft && hitsRight && leftEntry < rightEntry) {
+            stack[stackSize].node = rightNode;
+            stack[stackSize++].entry = rightEntry;
+            hitsRight = false;
+        }
+
+        if (hitsLeft) {
+            stack[stackSize].node = leftNode;
+            stack[stackSize++].entry = leftEntry;
+        }
+
+        if (hitsRight) {
+            stack[stackSize].node = rightNode;
+            stack[stackSize++].entry = rightEntry;
+        }
+    }
+
+    if (hit)
+        distance = nearest;
+
+    return hit;
+}
+
+}
@@ -0,0 +1,157 @@
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <QtCore/QVector>
+
+#include <gamemath.h>
+using namespace GameMath;
+
+namespace EvilTemple {
+
+class FaceGroup;
+
+/**
+  A bounding volume hierarchy over the triangles of a model, used to intersect rays with the
+  model without testing every triangle.
+
+  The hierarchy only stores vertex indices, so it can be used with any set of positions for the
+  model's vertices. The tree is built once for the positions a model was loaded with. Animated
+  instances copy it and refit the bounds of its nodes to their skinned positions, which keeps the
+  tree intact, but makes it a little less tight.
+  */
+class TriangleBvh
+{
+public:
+    /**
+      Nodes with at most this many triangles are not split any further.
+      */
+    static const int MaxLeafTriangles = 4;
+
+    /**
+      Builds the tree for all triangles of the given face groups. Nodes are split at the median of
+      their triangles' centers along the longest axis, so the tree is balanced.
+      */
+    void build(const Vector4 *positions, const FaceGroup *groups, int groupCount);
+
+    /**
+      Updates the bounds of all nodes to new positions of the vertices the tree was built with.
+      */
+    void refit(const Vector4 *positions);
+
+    /**
+      Finds the nearest triangle hit by a ray. Nodes are visited front to back and skipped once
+      the ray enters them behind the nearest triangle found so far.
+
+      @param distance Receives the distance from the ray's origin to the intersection, if the ray
+                      hits a triangle.
+      @returns True if the ray hits a triangle.
+      */
+    bool intersect(const Ray3d &ray, const Vector4 *positions, float &distance) const;
+
+    int triangles() const;
+
+    bool isEmpty() const;
+
+private:
+    /**
+      Leaves store their triangles at first, inner nodes store their two children at first and
+      first + 1. Children are always stored behind their parent.
+      */
+    struct Node {
+        float minimum[3];
+        float maximum[3];
+        int first;
+        int count; // Triangles in a leaf, 0 for inner nodes
+    };
+
+    void split(int node, int *triangles, const float *centers);
+
+    void updateBounds(Node &node, const Vector4 *positions) const;
+
+    QVector<Node> mNodes;
+
+    QVector<ushort> mIndices; // Three vertex indices per triangle, in the order of the leaves
+};
+
+inline int TriangleBvh::triangles() const
+{
+    return mIndices.size() / 3;
+}
+
+inline bool TriangleBvh::isEmpty() const
+{
+    return mNodes.isEmpty();
+}
+
+/**
+  Intersects the ray with a triangle.
+
+  This algorithm is equivalent to the algorithm presented in Realtime Rendering p.750
+  as RayTriIntersect.
+
+  @param uOut If not null, this pointer receives the barycentric weight of
+                p1 for the point of intersection. But only if there is an intersection.
+  @param vOut If not null, this pointer receives the barycentric weight of
+                p2 for the point of intersection. But only if there is an intersection.
+
+  @returns True if the ray shoots through the triangle.
+  */
+inline bool intersectRay(const Ray3d &ray,
+                       const Vector4 &p0,
+                       const Vector4 &p1,
+                       const Vector4 &p2,
+                       float &distance,
+                       float *uOut = 0,
+                       float *vOut = 0) {
+
+    Vector4 e1 = p1 - p0;
+    Vector4 e2 = p2 - p0;
+
+    Vector4 q = ray.direction().cross(e2);
+    float determinant = e1.dot(q);
+
+    /**
+      If the determinant is close to zero, the ray lies in the plane of the triangle and thus
+      is very unlikely to intersect it.
+      */
+    if (qFuzzyIsNull(determinant))
+        return false;
+
+    float invertedDeterminant = 1 / determinant;
+
+    // Distance from vertex 0 to ray origin
+    Vector4 s = ray.origin() - p0;
+
+    // Calculate the first barycentric coordinate
+    float u = invertedDeterminant * s.dot(q);
+
+    if (u < 0)
+        return false; // Definetly outside the triangle
+
+    Vector4 r = s.cross(e1);
+
+    // Calcaulate the second barycentric coordinate
+    float v = invertedDeterminant * ray.direction().dot(r);
+
+    if (v < 0 || u + v > 1)
+        return false; // Definetly outside the triangle
+
+    // Triangles behind the origin of the ray are not hit
+    if (invertedDeterminant * e2.dot(r) < 0)
+        return false;
+
+    // Store u + v for further use
+    if (uOut)
+        *uOut = u;
+    if (vOut)
+        *vOut = v;
+
+    // Calculate the exact point of intersection and then the distance to the ray's origin
+    Vector4 point = (1 - u - v) * p0 + u * p1 + v * p2;
+    distance = (ray.origin() - point).length();
+    return true;
+}
+
+}
+
+#endif // TRIANGLEBVH_H
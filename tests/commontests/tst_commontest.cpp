@@ -2,6 +2,9 @@
 #include <QtTest/QtTest>
 
 #include "common/quadtree.h"
+#include "common/tileraster.h"
+#include "common/fieldofview.h"
+#include "common/gridline.h"
 
 class CommonTest : public QObject
 {
@@ -14,6 +17,100 @@ private Q_SLOTS:
     void testCase1();
     void test3x3Grid();
     void testRegressionOddSidelength();
+    void testBitRasterMatchesQuadtree();
+    void testCharRasterMatchesQuadtree();
+    void testRasterOddSidelength();
+    void testRasterMemoryUsage();
+    void benchmarkQuadtreeLookup();
+    void benchmarkRasterLookup();
+    void testShadowcastingMatchesLineOfSight();
+    void testShadowcastingIsSymmetric();
+    void testShadowcastingWall();
+    void benchmarkShadowcasting();
+    void testGridLineReachesEnd();
+    void testGridLineIsBlocked();
+};
+
+/*
+  Creates a map-like tree with a large uniform area, some walls and some noise.
+  */
+static void fillTestTree(BoolQuadtree &tree, int sidelength)
+{
+    qsrand(42);
+
+    for (int y = sidelength / 4; y < sidelength / 2; ++y)
+        for (int x = sidelength / 4; x < sidelength / 2; ++x)
+            tree.set(x, y, true);
+
+    for (int i = 0; i < sidelength / 2; ++i) {
+        tree.set(i, sidelength / 3, true);
+        tree.set(sidelength / 3, i, true);
+    }
+
+    for (int i = 0; i < sidelength * 4; ++i)
+        tree.set(qrand() % sidelength, qrand() % sidelength, qrand() % 2);
+
+    tree.compact();
+}
+
+/*
+  The number of bytes used by the nodes of a quadtree.
+  */
+struct QuadtreeMemoryVisitor {
+    QuadtreeMemoryVisitor() : leaves(0) {}
+
+    void operator()(int, int, int, bool)
+    {
+        leaves++;
+    }
+
+    uint memoryUsage() const
+    {
+        // Every inner node has exactly four children
+        return (4 * leaves - 1) / 3 * sizeof(QuadtreeNode<bool>);
+    }
+
+    uint leaves;
+};
+
+/*
+  A square grid of opaque and transparent tiles. Everything outside of the grid is opaque.
+  */
+struct VisionGrid {
+    VisionGrid(int _sidelength) : sidelength(_sidelength), opaque(_sidelength * _sidelength, false) {}
+
+    void fillRandomly(int percentOpaque)
+    {
+        for (int i = 0; i < opaque.size(); ++i)
+            opaque[i] = (qrand() % 100) < percentOpaque;
+    }
+
+    bool operator()(int x, int y) const
+    {
+        if (x < 0 || y < 0 || x >= sidelength || y >= sidelength)
+            return true;
+        return opaque[y * sidelength + x];
+    }
+
+    int sidelength;
+    QVector<bool> opaque;
+};
+
+/*
+  Collects the tiles revealed by shadowcasting.
+  */
+struct VisibleTiles {
+    void operator()(int x, int y)
+    {
+        tiles.insert(QPair<int,int>(x, y));
+    }
+
+    bool contains(int x, int y) const
+    {
+        return tiles.contains(QPair<int,int>(x, y));
+    }
+
+    QSet< QPair<int,int> > tiles;
 };
 
 CommonTest::CommonTest()
@@ -87,6 +184,265 @@ void CommonTest::test3x3Grid()
 
 }
 
+void CommonTest::testBitRasterMatchesQuadtree()
+{
+    BoolQuadtree quadTree(512, false);
+    fillTestTree(quadTree, 512);
+
+    BitRaster raster;
+    raster.decode(quadTree);
+
+    QCOMPARE(raster.sidelength(), 512);
+
+    for (int y = 0; y < 512; ++y)
+        for (int x = 0; x < 512; ++x)
+            QCOMPARE(raster.get(x, y), quadTree.get(x, y));
+
+    // Tiles outside of the raster are never set
+    QCOMPARE(raster.get(-1, 0), false);
+    QCOMPARE(raster.get(0, 512), false);
+}
+
+void CommonTest::testCharRasterMatchesQuadtree()
+{
+    CharQuadtree quadTree(256, 0);
+
+    qsrand(42);
+
+    for (int y = 0; y < 128; ++y)
+        for (int x = 0; x < 128; ++x)
+            quadTree.set(x, y, -5);
+
+    for (int i = 0; i < 2000; ++i)
+        quadTree.set(qrand() % 256, qrand() % 256, qrand() % 20 - 10);
+
+    quadTree.compact();
+
+    CharRaster raster;
+    raster.decode(quadTree);
+
+    for (int y = 0; y < 256; ++y)
+        for (int x = 0; x < 256; ++x)
+            QCOMPARE(raster.get(x, y), quadTree.get(x, y));
+
+    QCOMPARE(raster.get(256, 0), (qint8)0);
+}
+
+void CommonTest::testRasterOddSidelength()
+{
+    BoolQuadtree quadTree(100, false);
+
+    quadTree.set(0, 2, true);
+    quadTree.set(63, 64, true);
+    quadTree.set(99, 99, true);
+
+    BitRaster raster;
+    raster.decode(quadTree);
+
+    for (int y = 0; y < 100; ++y)
+        for (int x = 0; x < 100; ++x)
+            QCOMPARE(raster.get(x, y), quadTree.get(x, y));
+}
+
+void CommonTest::testRasterMemoryUsage()
+{
+    BoolQuadtree quadTree(1024, false);
+    fillTestTree(quadTree, 1024);
+
+    BitRaster raster;
+    raster.decode(quadTree);
+
+    QuadtreeMemoryVisitor visitor;
+    quadTree.visitLeaves(visitor);
+
+    qDebug("Quadtree: %d leaves, %d kb. Dense raster: %d kb.", visitor.leaves,
+           visitor.memoryUsage() / 1024, raster.memoryUsage() / 1024);
+
+    // A fully expanded raster would use 128kb
+    QVERIFY(raster.memoryUsage() <= 1024 * 1024 / 8 + 2 * 512 + 256 * sizeof(int));
+}
+
+void CommonTest::benchmarkQuadtreeLookup()
+{
+    BoolQuadtree quadTree(1024, false);
+    fillTestTree(quadTree, 1024);
+
+    int walkable = 0;
+
+    QBENCHMARK {
+        for (int y = 0; y < 1024; ++y)
+            for (int x = 0; x < 1024; ++x)
+                if (quadTree.get(x, y))
+                    walkable++;
+    }
+
+    QVERIFY(walkable > 0);
+}
+
+void CommonTest::benchmarkRasterLookup()
+{
+    BoolQuadtree quadTree(1024, false);
+    fillTestTree(quadTree, 1024);
+
+    BitRaster raster;
+    raster.decode(quadTree);
+
+    int walkable = 0;
+
+    QBENCHMARK {
+        for (int y = 0; y < 1024; ++y)
+            for (int x = 0; x < 1024; ++x)
+                if (raster.get(x, y))
+                    walkable++;
+    }
+
+    QVERIFY(walkable > 0);
+}
+
+void CommonTest::testShadowcastingMatchesLineOfSight()
+{
+    qsrand(42);
+
+    for (int i = 0; i < 500; ++i) {
+        VisionGrid grid(5 + qrand() % 30);
+        grid.fillRandomly(qrand() % 50);
+
+        int originX = qrand() % grid.sidelength;
+        int originY = qrand() % grid.sidelength;
+        int radius = 1 + qrand() % 25;
+        grid.opaque[originY * grid.sidelength + originX] = false;
+
+        VisibleTiles visible;
+        FieldOfView::castShadows(originX, originY, radius, grid, visible);
+
+        // Includes the opaque border around the grid
+        for (int y = -1; y <= grid.sidelength; ++y) {
+            for (int x = -1; x <= grid.sidelength; ++x) {
+                int dx = x - originX;
+                int dy = y - originY;
+                bool expected = dx * dx + dy * dy <= radius * radius
+                                && FieldOfView::isVisible(originX, originY, x, y, grid);
+
+                if (visible.contains(x, y) != expected)
+                    qDebug("Grid %d: Tile %d,%d seen from %d,%d", i, x, y, originX, originY);
+                QCOMPARE(visible.contains(x, y), expected);
+            }
+        }
+    }
+}
+
+void CommonTest::testShadowcastingIsSymmetric()
+{
+    qsrand(42);
+
+    for (int i = 0; i < 50; ++i) {
+        VisionGrid grid(12);
+        grid.fillRandomly(30);
+
+        for (int from = 0; from < grid.opaque.size(); ++from) {
+            if (grid.opaque[from])
+                continue;
+
+            VisibleTiles visible;
+            FieldOfView::castShadows(from % 12, from / 12, 24, grid, visible);
+
+            for (int to = 0; to < grid.opaque.size(); ++to) {
+                if (!grid.opaque[to] && visible.contains(to % 12, to / 12))
+                    QVERIFY(FieldOfView::isVisible(to % 12, to / 12, from % 12, from / 12, grid));
+            }
+        }
+    }
+}
+
+void CommonTest::testShadowcastingWall()
+{
+    VisionGrid grid(9);
+
+    // A wall with a single gap in front of the origin
+    for (int x = 0; x < 9; ++x)
+        grid.opaque[2 * 9 + x] = (x != 4);
+
+    VisibleTiles visible;
+    FieldOfView::castShadows(4, 4, 10, grid, visible);
+
+    QVERIFY(visible.contains(4, 4));
+    QVERIFY(visible.contains(4, 0));
+    QVERIFY(visible.contains(3, 2)); // The wall itself is visible
+    QVERIFY(!visible.contains(0, 0)); // Behind the wall
+    QVERIFY(!visible.contains(8, 1));
+    QVERIFY(visible.contains(0, 8));
+}
+
+void CommonTest::benchmarkShadowcasting()
+{
+    qsrand(42);
+
+    VisionGrid grid(256);
+    grid.fillRandomly(5);
+    grid.opaque[128 * 256 + 128] = false;
+
+    int revealed = 0;
+
+    QBENCHMARK {
+        VisibleTiles visible;
+        FieldOfView::castShadows(128, 128, 100, grid, visible);
+        revealed = visible.tiles.size();
+    }
+
+    QVERIFY(revealed > 0);
+}
+
+/*
+  Records the tiles visited by walkGridLine and blocks a single tile.
+  */
+struct LineTiles {
+    LineTiles(QList<QPoint> *_visited, const QPoint &_blocked = QPoint(-1000, -1000))
+        : visited(_visited), blocked(_blocked)
+    {
+    }
+
+    bool operator()(int x, int y) const
+    {
+        visited->append(QPoint(x, y));
+        return QPoint(x, y) != blocked;
+    }
+
+    QList<QPoint> *visited;
+    QPoint blocked;
+};
+
+void CommonTest::testGridLineReachesEnd()
+{
+    // Lines in every octant, shallow ones included
+    for (int dy = -7; dy <= 7; ++dy) {
+        for (int dx = -7; dx <= 7; ++dx) {
+            QList<QPoint> visited;
+            QVERIFY(walkGridLine(3, 4, 3 + dx, 4 + dy, LineTiles(&visited)));
+
+            QCOMPARE(visited.size(), qMax(qAbs(dx), qAbs(dy)) + 1);
+            QVERIFY(visited.contains(QPoint(3, 4)));
+            QVERIFY(visited.contains(QPoint(3 + dx, 4 + dy)));
+
+            for (int i = 1; i < visited.size(); ++i) {
+                QPoint step = visited[i] - visited[i - 1];
+                QVERIFY(qAbs(step.x()) <= 1 && qAbs(step.y()) <= 1);
+            }
+        }
+    }
+}
+
+void CommonTest::testGridLineIsBlocked()
+{
+    QList<QPoint> visited;
+
+    // The tile at the end of the axis isn't on a line that climbs three tiles
+    QVERIFY(walkGridLine(0, 0, 10, 3, LineTiles(&visited, QPoint(10, 0))));
+
+    visited.clear();
+    QVERIFY(!walkGridLine(0, 0, 10, 3, LineTiles(&visited, QPoint(7, 2))));
+    QCOMPARE(visited.last(), QPoint(7, 2));
+}
+
 QTEST_APPLESS_MAIN(CommonTest);
 
 #include "tst_commontest.moc"
@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Tests for the navigation meshes of the game library
+#
+#-------------------------------------------------
+
+QT       += testlib script
+
+QT       -= gui
+
+TARGET = tst_navigationmeshtest
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += tst_navigationmeshtest.cpp
+DEFINES += SRCDIR=\\\"$$PWD/\\\"
+
+TEMPLE_LIBS += game
+include(../../3rdparty/game-math/game-math.pri)
+include(../../base.pri)
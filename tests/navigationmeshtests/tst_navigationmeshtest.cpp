@@ -0,0 +1,182 @@
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtTest/QtTest>
+
+#include <navigationmesh.h>
+
+using namespace EvilTemple;
+
+class NavigationMeshTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    NavigationMeshTest();
+
+private Q_SLOTS:
+    void testSaveLoadRoundTrip();
+    void testOwnObstacleDoesNotBlock();
+};
+
+NavigationMeshTest::NavigationMeshTest()
+{
+}
+
+static void writeRect(QDataStream &stream, int left, int top, int right, int bottom)
+{
+    stream << left << top << right << bottom
+            << (left + right) * 0.5f << 0.0f << (top + bottom) * 0.5f << 1.0f;
+}
+
+/*
+  Writes a mesh in the format of version 1, which has no BSP tree. Three rectangles in a row are
+  connected by two portals.
+  */
+static QByteArray createVersion1Mesh()
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    stream << (uint)3;
+    writeRect(stream, 0, 0, 10, 10);
+    writeRect(stream, 10, 0, 20, 10);
+    writeRect(stream, 20, 2, 30, 8);
+
+    stream << (uint)2;
+    stream << 10.0f << 0.0f << 5.0f << 1.0f << (uint)0 << (uint)1 << (uint)NorthSouth << (uint)0 << (uint)10;
+    stream << 20.0f << 0.0f << 5.0f << 1.0f << (uint)1 << (uint)2 << (uint)NorthSouth << (uint)2 << (uint)8;
+
+    return data;
+}
+
+/*
+  Writes a corridor of four rectangles in the format of version 1. The third rectangle is only two
+  units wide, so an obstacle standing next to it covers it completely.
+  */
+static QByteArray createCorridorMesh()
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    stream << (uint)4;
+    writeRect(stream, 0, 0, 10, 10);
+    writeRect(stream, 10, 0, 20, 10);
+    writeRect(stream, 20, 2, 22, 8);
+    writeRect(stream, 22, 0, 32, 10);
+
+    stream << (uint)3;
+    stream << 10.0f << 0.0f << 5.0f << 1.0f << (uint)0 << (uint)1 << (uint)NorthSouth << (uint)0 << (uint)10;
+    stream << 20.0f << 0.0f << 5.0f << 1.0f << (uint)1 << (uint)2 << (uint)NorthSouth << (uint)2 << (uint)8;
+    stream << 22.0f << 0.0f << 5.0f << 1.0f << (uint)2 << (uint)3 << (uint)NorthSouth << (uint)2 << (uint)8;
+
+    return data;
+}
+
+static QByteArray saveMesh(const NavigationMesh &mesh)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    NavigationMesh::writeHeader(stream);
+    mesh.save(stream);
+
+    return data;
+}
+
+void NavigationMeshTest::testSaveLoadRoundTrip()
+{
+    QByteArray original = createVersion1Mesh();
+    QDataStream originalStream(original);
+    originalStream.setByteOrder(QDataStream::LittleEndian);
+
+    NavigationMesh mesh;
+    mesh.load(originalStream, 1);
+    QCOMPARE(originalStream.status(), QDataStream::Ok);
+
+    QByteArray saved = saveMesh(mesh);
+
+    // The header is followed by the mesh in the current format
+    QDataStream stream(saved);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    char magic[sizeof(NavigationMesh::FileMagic)];
+    stream.readRawData(magic, sizeof(magic));
+    QCOMPARE(QByteArray(magic, sizeof(magic)), QByteArray(NavigationMesh::FileMagic, sizeof(magic)));
+
+    uint version;
+    stream >> version;
+    QCOMPARE(version, (uint)NavigationMesh::FileVersion);
+
+    NavigationMesh loaded;
+    loaded.load(stream, version);
+    QCOMPARE(stream.status(), QDataStream::Ok);
+    QVERIFY(stream.atEnd());
+
+    QCOMPARE(loaded.rectangles().size(), mesh.rectangles().size());
+    for (int i = 0; i < mesh.rectangles().size(); ++i) {
+        const NavMeshRect &expected = mesh.rectangles()[i];
+        const NavMeshRect &actual = loaded.rectangles()[i];
+        QCOMPARE(actual.left, expected.left);
+        QCOMPARE(actual.top, expected.top);
+        QCOMPARE(actual.right, expected.right);
+        QCOMPARE(actual.bottom, expected.bottom);
+        QCOMPARE(actual.center.x(), expected.center.x());
+        QCOMPARE(actual.center.z(), expected.center.z());
+        QCOMPARE(actual.portals.size(), expected.portals.size());
+
+        // The stored BSP tree has to find the same rectangles
+        QCOMPARE(loaded.findRect(actual.center), &actual);
+    }
+
+    QCOMPARE(loaded.portals().size(), mesh.portals().size());
+    for (int i = 0; i < mesh.portals().size(); ++i) {
+        const NavMeshPortal &expected = mesh.portals()[i];
+        const NavMeshPortal &actual = loaded.portals()[i];
+        QCOMPARE(actual.center.x(), expected.center.x());
+        QCOMPARE(actual.center.z(), expected.center.z());
+        QCOMPARE(actual.sideA - loaded.rectangles().constData(), expected.sideA - mesh.rectangles().constData());
+        QCOMPARE(actual.sideB - loaded.rectangles().constData(), expected.sideB - mesh.rectangles().constData());
+        QCOMPARE(actual.axis, expected.axis);
+        QCOMPARE(actual.start, expected.start);
+        QCOMPARE(actual.end, expected.end);
+    }
+
+    // Saving the loaded mesh again has to produce the same file
+    QCOMPARE(saveMesh(loaded), saved);
+}
+
+void NavigationMeshTest::testOwnObstacleDoesNotBlock()
+{
+    QByteArray data = createCorridorMesh();
+    QDataStream stream(data);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    NavigationMesh mesh;
+    mesh.load(stream, 1);
+    QCOMPARE(stream.status(), QDataStream::Ok);
+
+    // The actor covers the narrow rectangle and blocks the portal behind it
+    Vector4 start(19, 0, 5, 1);
+    Vector4 end(30, 0, 5, 1);
+    mesh.addDynamicObstacle("actor", start, 5, false);
+
+    QVERIFY(mesh.isBlocked(&mesh.rectangles()[2]));
+    QVERIFY(mesh.isBlocked(&mesh.portals()[2]));
+
+    QVERIFY(mesh.findPath(start, end).isEmpty());
+    QVERIFY(!mesh.findPath(start, end, "actor").isEmpty());
+
+    // Other obstacles still block the path
+    mesh.addDynamicObstacle("other", Vector4(21, 0, 5, 1), 4, false);
+    QVERIFY(mesh.findPath(start, end, "actor").isEmpty());
+}
+
+QTEST_APPLESS_MAIN(NavigationMeshTest);
+
+#include "tst_navigationmeshtest.moc"
@@ -5,3 +5,4 @@ SUBDIRS += binkplayertests
 SUBDIRS += commontests
 SUBDIRS += conversiontests
 SUBDIRS += miniziptests
+SUBDIRS += navigationmeshtests